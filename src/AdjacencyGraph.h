@@ -0,0 +1,203 @@
+/*============================================================================
+ Name        : AdjacencyGraph.h
+ Author      : Nitin Puranik
+ Description : Builds the region adjacency graph of a set of objects, as in
+ 	 	 	   a floor plan or a map tiling. Two objects are neighbours if
+ 	 	 	   they share a stretch of boundary without overlapping, and
+ 	 	 	   each link carries the length of the shared stretch. The
+ 	 	 	   graph is kept in compressed sparse row form.
+ ============================================================================*/
+
+#ifndef ADJACENCYGRAPH_H
+#define ADJACENCYGRAPH_H
+
+#include <cmath>
+#include "BroadPhase.h"
+#include "ShapeDistance.h"
+
+/*
+ * How far apart, relative to the size of the set, two boundaries may
+ * be and still count as touching. Coordinates that were meant to be
+ * equal rarely stay exactly equal once the objects are rotated.
+ */
+#define ADJACENCY_TOLERANCE 1e-6f
+
+/*
+ * The graph in compressed sparse row form. The neighbours of object i
+ * are neighbours[offsets[i]] up to neighbours[offsets[i + 1]], sorted,
+ * and lengths holds the length of the shared boundary of each link.
+ * Every link is stored in both directions.
+ */
+struct AdjacencyGraph {
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> neighbours;
+	std::vector<float> lengths;
+};
+
+/*
+ * The length of the boundary the two objects share. For every edge of
+ * A, the edges of B whose end points both lie within tol of its line
+ * are projected onto it and the overlaps of the projections are added
+ * up. Overlaps no longer than tol are rounding, as where objects only
+ * meet at a corner, and are left out. The prepared edge vectors of A
+ * give the line.
+ */
+float SharedEdgeLength (const Shape& A, const Shape& B, float tol) {
+
+	const float *a = A.Points ( );
+	const float *b = B.Points ( );
+	unsigned int na = A.NumSides ( ), nb = B.NumSides ( );
+	float total = 0;
+
+	for (unsigned int i = 0; i < na; i++) {
+
+		float len = A.EdgeLengths ( )[i];
+
+		if (len == 0)
+			continue;
+
+		float x1 = a[2 * i], y1 = a[2 * i + 1];
+
+		/* The unit normal and the unit direction of the edge */
+		float nx = A.Normals ( )[2 * i] / len;
+		float ny = A.Normals ( )[2 * i + 1] / len;
+		float ux = -ny, uy = nx;
+
+		for (unsigned int j = 0; j < nb; j++) {
+
+			float qx1 = b[2 * j], qy1 = b[2 * j + 1];
+			float qx2 = b[(2 * j + 2) % (2 * nb)], qy2 = b[(2 * j + 3) % (2 * nb)];
+
+			if (std::fabs (nx * (qx1 - x1) + ny * (qy1 - y1)) > tol ||
+					std::fabs (nx * (qx2 - x1) + ny * (qy2 - y1)) > tol)
+				continue;
+
+			float t1 = ux * (qx1 - x1) + uy * (qy1 - y1);
+			float t2 = ux * (qx2 - x1) + uy * (qy2 - y1);
+
+			float lo = std::max (0.0f, std::min (t1, t2));
+			float hi = std::min (len, std::max (t1, t2));
+
+			if (hi - lo > tol)
+				total += hi - lo;
+		}
+	}
+
+	return total;
+}
+
+/* The tolerance for a set that fits in the given box */
+inline float AdjacencyTolerance (const BoundingBox& world) {
+
+	float scale = std::max (std::max (std::fabs (world.xmin), std::fabs (world.xmax)),
+			std::max (std::fabs (world.ymin), std::fabs (world.ymax)));
+
+	return ADJACENCY_TOLERANCE * std::max (1.0f, scale);
+}
+
+/* A link found by the sweep, before it is put in row form */
+struct AdjacencyLink {
+	unsigned int first, second;
+	float length;
+};
+
+/*
+ * The narrow phase visitor. Analyze reports adj when a whole edge of
+ * one object lies on an edge of the other. Objects that meet along
+ * part of an edge each, like staggered bricks, come out as touching
+ * intersections instead, with a translation depth of zero. Objects
+ * whose shared edges were rounded apart come out as apart, by a gap
+ * within the tolerance. All of them count as long as they share
+ * boundary of positive length.
+ */
+struct AdjacencyCollector {
+	std::vector<Shape*>& mShapes;
+	float mTol;
+	std::vector<AdjacencyLink> mLinks;
+
+	AdjacencyCollector (std::vector<Shape*>& shapes, float tol) : mShapes (shapes), mTol (tol) { }
+
+	void operator() (unsigned int i, unsigned int j) {
+
+		int which;
+		Penetration mtv;
+		CollisionType type = ProcessData (*mShapes[i], *mShapes[j], &which, NULL, &mtv);
+
+		if (type == contain)
+			return;
+
+		if (type == apart && SeparationGap (*mShapes[i], *mShapes[j]) > mTol)
+			return;
+
+		if (type == none && mtv.depth > mTol)
+			return;
+
+		AdjacencyLink link;
+
+		link.first = std::min (i, j);
+		link.second = std::max (i, j);
+		link.length = SharedEdgeLength (*mShapes[i], *mShapes[j], mTol);
+
+		if (link.length > 0)
+			mLinks.push_back (link);
+	}
+};
+
+/*
+ * Builds the adjacency graph of the set. The boxes are grown by the
+ * tolerance so that the inclusive sweep keeps every pair whose boxes
+ * meet exactly, or miss each other by a rounding error only.
+ */
+void BuildAdjacencyGraph (std::vector<Shape*>& shapes, AdjacencyGraph& graph) {
+
+	std::vector<BoundingBox> boxes;
+	CollectBounds (shapes, boxes);
+
+	float tol = AdjacencyTolerance (UnionBounds (boxes));
+
+	for (unsigned int i = 0; i < boxes.size ( ); i++) {
+		boxes[i].xmin -= tol;
+		boxes[i].ymin -= tol;
+		boxes[i].xmax += tol;
+		boxes[i].ymax += tol;
+	}
+
+	AdjacencyCollector collect (shapes, tol);
+	SweepAndPrune (boxes, collect);
+
+	const std::vector<AdjacencyLink>& links = collect.mLinks;
+
+	/* Count the links of every object, then turn the counts into offsets */
+	graph.offsets.assign (shapes.size ( ) + 1, 0);
+
+	for (unsigned int k = 0; k < links.size ( ); k++) {
+		graph.offsets[links[k].first + 1]++;
+		graph.offsets[links[k].second + 1]++;
+	}
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++)
+		graph.offsets[i + 1] += graph.offsets[i];
+
+	std::vector<unsigned int> next (graph.offsets.begin ( ), graph.offsets.end ( ) - 1);
+	std::vector<std::pair<unsigned int, float> > row (2 * links.size ( ));
+
+	for (unsigned int k = 0; k < links.size ( ); k++) {
+		row[next[links[k].first]++] = std::make_pair (links[k].second, links[k].length);
+		row[next[links[k].second]++] = std::make_pair (links[k].first, links[k].length);
+	}
+
+	graph.neighbours.resize (row.size ( ));
+	graph.lengths.resize (row.size ( ));
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++) {
+
+		std::sort (row.begin ( ) + graph.offsets[i], row.begin ( ) + graph.offsets[i + 1]);
+
+		for (unsigned int k = graph.offsets[i]; k < graph.offsets[i + 1]; k++) {
+			graph.neighbours[k] = row[k].first;
+			graph.lengths[k] = row[k].second;
+		}
+	}
+}
+
+#endif /* ADJACENCYGRAPH_H */
@@ -7,9 +7,14 @@
  	 		   of polygons. One such derived class provided is for rectangle.
  ============================================================================*/
 
+#ifndef BASECLASSSHAPE_H
+#define BASECLASSSHAPE_H
+
 #include <vector>
 #include <string>
 #include <iostream>
+#include <cmath>
+#include <algorithm>
 
 /* A sentinel value to check extreme cases */
 #define INV 0xdeadbeef
@@ -25,6 +30,24 @@
  */
 enum CollisionType { adj, contain, apart, none };
 
+/*
+ * An axis aligned bounding box of an object. The broad phase
+ * works on these boxes before the exact analyzer is called.
+ */
+struct BoundingBox {
+	float xmin, ymin, xmax, ymax;
+};
+
+/*
+ * The minimum translation vector of two intersecting objects.
+ * Moving object B by depth along the unit axis (nx, ny) is the
+ * shortest move that leaves the two objects merely touching.
+ */
+struct Penetration {
+	float nx, ny;
+	float depth;
+};
+
 /*
  * The base class shape that defines an inheritable interface
  * and provides many of the feature analyzer functionalities
@@ -43,14 +66,77 @@ protected:
 	/* The coordinate points for the vertices of the object */
 	float *mPoints;
 
+	/*
+	 * The prepared data derived from the points by Prepare. For each
+	 * edge, the rotated edge vector that the separating line test
+	 * projects onto, and its length. Also the bounding box.
+	 */
+	float *mNormals;
+	float *mEdgeLen;
+	BoundingBox mBox;
+
+	/* False for a view of points and prepared data kept elsewhere */
+	bool mOwned;
+
+	/* Derives the prepared data. To be called whenever the points change. */
+	void Prepare ( );
+
 public:
 	/* The english name of the given object */
 	std::string mName;
 
-	Shape (unsigned int num) : mNumSides (num) {
+	Shape (unsigned int num) : mNumSides (num), mOwned (true) {
+		mPoints = new float [2 * mNumSides];
+		mNormals = new float [2 * mNumSides];
+		mEdgeLen = new float [mNumSides];
+	}
+
+	/* Constructs the object straight from its coordinate points */
+	Shape (unsigned int num, const float *points) : mNumSides (num), mOwned (true) {
 		mPoints = new float [2 * mNumSides];
+		mNormals = new float [2 * mNumSides];
+		mEdgeLen = new float [mNumSides];
+		SetPoints (points);
+	}
+
+	/*
+	 * Constructs a view of an object whose points and prepared data are
+	 * already worked out and kept elsewhere, such as in shared memory.
+	 * Nothing is copied, the view does not own them, and its points
+	 * must not be replaced.
+	 */
+	Shape (unsigned int num, const float *points, const float *normals, const float *edgeLen,
+			const BoundingBox& box)
+		: mNumSides (num), mPoints (const_cast<float *> (points)), mNormals (const_cast<float *> (normals)),
+		  mEdgeLen (const_cast<float *> (edgeLen)), mBox (box), mOwned (false) { }
+
+	/* Replaces the coordinate points of the object */
+	void SetPoints (const float *points) {
+		for (unsigned int i = 0; i < 2 * mNumSides; i++)
+			mPoints[i] = points[i];
+
+		Prepare ( );
 	}
 
+	unsigned int NumSides ( ) const { return mNumSides; }
+
+	const float *Points ( ) const { return mPoints; }
+
+	/* The rotated edge vectors, two floats per edge */
+	const float *Normals ( ) const { return mNormals; }
+
+	/* The length of each edge */
+	const float *EdgeLengths ( ) const { return mEdgeLen; }
+
+	/* The axis aligned box that encloses the object */
+	const BoundingBox& Bounds ( ) const { return mBox; }
+
+	/* The area enclosed by the object */
+	float Area ( ) const;
+
+	/* Tells if the point (x, y) lies inside the object or on its boundary */
+	bool ContainsPoint (float x, float y) const;
+
 	/*
 	 * A utility method that tells if the two points x and y
 	 * lie on the given edge whose start point is identified
@@ -58,17 +144,93 @@ public:
 	 */
 	virtual bool LiesOnEdge (float x, float y, int index) const;
 
-	/* Friend function that analyzes the two objects. */
-	friend CollisionType Analyze (Shape&, const Shape&);
+	/* Friend functions that analyze the two objects. */
+	friend CollisionType AnalyzeEdges (const Shape&, const Shape&, std::vector<int> *,
+			int *, Penetration *);
+	friend CollisionType Analyze (Shape&, const Shape&, int *, Penetration *);
 
 	/* Friend function that finds the intersection points */
 	friend void FindIntersection (const Shape&, const Shape&);
 
 	virtual ~Shape ( ) {
-		delete[] mPoints;
+		if (mOwned) {
+			delete[] mPoints;
+			delete[] mNormals;
+			delete[] mEdgeLen;
+		}
 	}
+
+private:
+	/* The object owns its points, or is a view of them. Copying is not supported. */
+	Shape (const Shape&);
+	Shape& operator= (const Shape&);
 };
 
+/*
+ * Runs through the vertices once to find the bounding box,
+ * and through the edges once to find their rotated vectors.
+ * Analyze and the queries built on it read these instead
+ * of deriving them again for every pair.
+ */
+void Shape::Prepare ( ) {
+
+	mBox.xmin = mBox.xmax = mPoints[0];
+	mBox.ymin = mBox.ymax = mPoints[1];
+
+	for (unsigned int i = 0; i < mNumSides; i++) {
+
+		float x1 = mPoints[2 * i];
+		float y1 = mPoints[2 * i + 1];
+
+		float x2 = mPoints[(2 * i + 2) % (2 * mNumSides)];
+		float y2 = mPoints[(2 * i + 3) % (2 * mNumSides)];
+
+		if (x1 < mBox.xmin) mBox.xmin = x1;
+		if (x1 > mBox.xmax) mBox.xmax = x1;
+		if (y1 < mBox.ymin) mBox.ymin = y1;
+		if (y1 > mBox.ymax) mBox.ymax = y1;
+
+		mNormals[2 * i] = y2 - y1;
+		mNormals[2 * i + 1] = x1 - x2;
+		mEdgeLen[i] = std::sqrt ((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
+	}
+}
+
+/* The shoelace formula over the vertices, in either winding */
+float Shape::Area ( ) const {
+
+	float sum = 0;
+
+	for (unsigned int i = 0; i < mNumSides; i++) {
+
+		unsigned int k = (i + 1) % mNumSides;
+
+		sum += mPoints[2 * i] * mPoints[2 * k + 1] - mPoints[2 * k] * mPoints[2 * i + 1];
+	}
+
+	return 0.5f * std::fabs (sum);
+}
+
+/*
+ * The point is inside a convex object if it lies on the same side of
+ * every edge, whichever way the object winds. The side is the sign of
+ * the projection onto the prepared edge vector, as in Analyze.
+ */
+bool Shape::ContainsPoint (float x, float y) const {
+
+	bool below = false, above = false;
+
+	for (unsigned int i = 0; i < mNumSides; i++) {
+
+		float f = mNormals[2 * i] * (x - mPoints[2 * i]) + mNormals[2 * i + 1] * (y - mPoints[2 * i + 1]);
+
+		if (f < 0) below = true;
+		if (f > 0) above = true;
+	}
+
+	return (below && above) == false;
+}
+
 /*
  * This function returns a boolean value that tells whether
  * the given points x and y lie on a given edge whose start
@@ -93,8 +255,15 @@ bool Shape::LiesOnEdge (float x, float y, int index) const {
 /*
  * The main workhorse function that analyzes the two objects
  * and determines the type of their overlap in a 2-D plane.
+ * The candidate intersecting edges of A go to isectEdge if given.
+ * When the objects are apart, sepEdge (if given) receives
+ * the index of the edge of A that separates them. The projections
+ * onto the edges of A also give the overlap along each edge normal.
+ * If mtv is given, it is updated wherever an edge of A has a smaller
+ * overlap than mtv->depth, which the caller initializes.
  */
-CollisionType Analyze (Shape& A, const Shape& B) {
+CollisionType AnalyzeEdges (const Shape& A, const Shape& B, std::vector<int> *isectEdge,
+		int *sepEdge, Penetration *mtv) {
 
 	/* A counter to determine containment */
 	unsigned int contain_ct = 0;
@@ -102,23 +271,27 @@ CollisionType Analyze (Shape& A, const Shape& B) {
 	/* A counter to determine adjacency */
 	unsigned int adj_ct;
 
+	/* Forget the candidate edges of any earlier analysis */
+	if (isectEdge != NULL)
+		isectEdge->clear ( );
+
 	/* Implementation of the separating line test */
 	for (unsigned int i = 0; i < A.mNumSides; i++) {
 
-		float x1,y1,x2,y2;
+		float x1,y1;
 		float rot_x, rot_y;
 		float sum_A, sum_B;
 
-		/* Get the edge's vertices from the index */
+		/* The extent of the projections of A and B on the edge normal */
+		float min_A = 0, max_A = 0, min_B = 0, max_B = 0;
+
+		/* Get the edge's start vertex from the index */
 		x1 = A.mPoints[2 * i];
 		y1 = A.mPoints[2 * i + 1];
 
-		x2 = A.mPoints[(2 * i + 2) % (2 * A.mNumSides)];
-		y2 = A.mPoints[(2 * i + 3) % (2 * A.mNumSides)];
-
-		/* Get the rotated vertices */
-		rot_x = y2 - y1;
-		rot_y = x1 - x2;
+		/* Get the rotated vertices, prepared along with the points */
+		rot_x = A.mNormals[2 * i];
+		rot_y = A.mNormals[2 * i + 1];
 
 		sum_A = sum_B = 0;
 
@@ -136,6 +309,9 @@ CollisionType Analyze (Shape& A, const Shape& B) {
 
 			dotprod = (rot_x * (x - x1)) + (rot_y * (y - y1));
 			sum_A += dotprod;
+
+			if (dotprod < min_A) min_A = dotprod;
+			if (dotprod > max_A) max_A = dotprod;
 		}
 
 		sum_A = sum_A > 0 ? 1 : -1;
@@ -155,6 +331,9 @@ CollisionType Analyze (Shape& A, const Shape& B) {
 
 			dotprod = (rot_x * (x - x1)) + (rot_y * (y - y1));
 
+			if (j == 0 || dotprod < min_B) min_B = dotprod;
+			if (j == 0 || dotprod > max_B) max_B = dotprod;
+
 			if (dotprod != 0)
 				dotprod > 0 ? sum_B++ : sum_B--;
 			
@@ -163,8 +342,30 @@ CollisionType Analyze (Shape& A, const Shape& B) {
 		}
 
 		/* The two objects are completely apart */
-		if (sum_B == -sum_A * B.mNumSides)
+		if (sum_B == -sum_A * B.mNumSides) {
+			if (sepEdge != NULL)
+				*sepEdge = i;
 			return apart;
+		}
+
+		/* Keep the edge normal with the least overlap so far */
+		if (mtv != NULL) {
+
+			/* How far B has to move along and against the normal */
+			float len = A.mEdgeLen[i];
+			float up = (max_A - min_B) / len;
+			float down = (max_B - min_A) / len;
+			float depth = std::min (up, down);
+
+			if (len > 0 && depth < mtv->depth) {
+
+				float dir = up < down ? 1 : -1;
+
+				mtv->nx = dir * rot_x / len;
+				mtv->ny = dir * rot_y / len;
+				mtv->depth = depth;
+			}
+		}
 
 		if (adj_ct == 2) {
 			float sum_temp;
@@ -174,15 +375,16 @@ CollisionType Analyze (Shape& A, const Shape& B) {
 			if (sum_temp == -sum_A)
 				return adj;
 
-			A.mIsectEdge.push_back (i);
+			if (isectEdge != NULL)
+				isectEdge->push_back (i);
 		}
 
 		else if (sum_B == sum_A * B.mNumSides)
 			contain_ct++;
 
-		else
-			/* Candidate edges that may possibly be intersecting */
-			A.mIsectEdge.push_back (i);
+		/* Candidate edges that may possibly be intersecting */
+		else if (isectEdge != NULL)
+			isectEdge->push_back (i);
 	}
 
 	/* One object completely contains the other object */
@@ -193,172 +395,224 @@ CollisionType Analyze (Shape& A, const Shape& B) {
 	return none;
 }
 
+/*
+ * Analyzes the two objects with respect to A's edges and keeps the
+ * candidate intersecting edges in A for FindIntersection.
+ */
+CollisionType Analyze (Shape& A, const Shape& B, int *sepEdge = NULL, Penetration *mtv = NULL) {
+	return AnalyzeEdges (A, B, &A.mIsectEdge, sepEdge, mtv);
+}
+
 /*
  * The calling function that calls the analyzer twice if needed.
  * The first call analyzes the objects with respect to A's edges.
  * If no conclusion is drawn, then the analyzer works with B's edges.
  * The variable which tells which object contains the other object inside it.
+ * For objects that are apart, which tells whose edge separates them
+ * and sepEdge (if given) receives the index of that edge.
+ * For intersecting objects, mtv (if given) receives the minimum
+ * translation vector over the edges of both the objects. It is
+ * gathered during the two analyzer calls without any extra pass.
  */
-CollisionType ProcessData (Shape& A, Shape& B, int *which) {
+CollisionType ProcessData (Shape& A, Shape& B, int *which, int *sepEdge = NULL,
+		Penetration *mtv = NULL) {
+
+	if (mtv != NULL) {
+		mtv->nx = mtv->ny = 0;
+		mtv->depth = HUGE_VALF;
+	}
 
 	*which = 0;
-	CollisionType ret = Analyze (A, B);
+	CollisionType ret = Analyze (A, B, sepEdge, mtv);
 
 	if (ret != none) return ret;
 
 	*which = 1;
-	return Analyze (B, A);
+
+	if (mtv == NULL)
+		return Analyze (B, A, sepEdge);
+
+	/* The second call moves A out of B, so the axis is flipped around it */
+	mtv->nx = -mtv->nx;
+	mtv->ny = -mtv->ny;
+
+	ret = Analyze (B, A, sepEdge, mtv);
+
+	mtv->nx = -mtv->nx;
+	mtv->ny = -mtv->ny;
+
+	return ret;
 }
 
 /*
- * The utility method that finds the points of intersection
- * between the two objects. This function is only called after
- * it has been determined that the two objects intersect.
+ * The same as ProcessData, but neither object is touched, so any
+ * number of threads may classify pairs of the same objects at once.
+ * The candidate edges for FindIntersection are not kept.
  */
-void FindIntersection (const Shape& A, const Shape&B) {
+CollisionType Classify (const Shape& A, const Shape& B, int *which) {
 
-	/* Iterator that iterators over the indices of candidate edges */
-	std::vector<int>::const_iterator A_vit = A.mIsectEdge.begin();
+	*which = 0;
+	CollisionType ret = AnalyzeEdges (A, B, NULL, NULL, NULL);
 
-	for (; A_vit != A.mIsectEdge.end(); A_vit++ ) {
+	if (ret != none) return ret;
 
-		int A_index = *A_vit;
-		float A_x1,A_y1,A_x2,A_y2;
-		float A_slope, A_intercept;
+	*which = 1;
+	return AnalyzeEdges (B, A, NULL, NULL, NULL);
+}
 
-		/* Points of intersection */
-		float intr_x, intr_y;
+/*
+ * Tests a single edge of A the same way Analyze does. Returns true
+ * if every vertex of B lies strictly on the far side of the edge,
+ * that is, if this edge alone is enough to tell the objects apart.
+ */
+bool SeparatedByEdge (const Shape& A, const Shape& B, unsigned int i) {
 
-		/* Get A's edge points */
-		A_x1 = A.mPoints[2 * A_index];
-		A_y1 = A.mPoints[2 * A_index + 1];
+	const float *a = A.Points ( );
+	const float *b = B.Points ( );
+	unsigned int n = A.NumSides ( );
 
-		A_x2 = A.mPoints[(2 * A_index + 2) % (2 * A.mNumSides)];
-		A_y2 = A.mPoints[(2 * A_index + 3) % (2 * A.mNumSides)];
+	float x1 = a[2 * i], y1 = a[2 * i + 1];
 
-		/* Initialize the slope */
-		A_slope = INV;
+	float rot_x = A.Normals ( )[2 * i];
+	float rot_y = A.Normals ( )[2 * i + 1];
+	float sum_A = 0;
 
-		/* Edge parallel to y-axis */
-		if (A_x1 == A_x2)
-			intr_x = A_x1;
+	for (unsigned int j = 0; j < n; j++)
+		sum_A += (rot_x * (a[2 * j] - x1)) + (rot_y * (a[2 * j + 1] - y1));
 
-		/* Edge parallel to x-axis */
-		else if (A_y1 == A_y2)
-			intr_y = A_y1;
+	sum_A = sum_A > 0 ? 1 : -1;
 
-		/* Edge at an angle to the axes */
-		else {
-			A_slope = (A_y1 - A_y2) / (A_x1 - A_x2);
-			A_intercept = A_y1 - A_slope * A_x1;
-		}
+	for (unsigned int j = 0; j < B.NumSides ( ); j++) {
 
-		/* Work your way through the candidate edges of B */
-		std::vector<int>::const_iterator B_vit = B.mIsectEdge.begin();
+		float dotprod = (rot_x * (b[2 * j] - x1)) + (rot_y * (b[2 * j + 1] - y1));
 
-		for (; B_vit != B.mIsectEdge.end(); B_vit++ ) {
+		if (dotprod == 0 || (dotprod > 0) == (sum_A > 0))
+			return false;
+	}
 
-			int B_index = *B_vit;
-			float B_x1,B_y1,B_x2,B_y2;
-			float B_slope, B_intercept;
+	return true;
+}
 
-			/* Appropriately reset the intersection points */
-			if (A_x1 == A_x2)
-				intr_y = INV;
+/*
+ * Finds where the lines through the two edges (x1,y1)-(x2,y2) and
+ * (x3,y3)-(x4,y4) meet. Edges along the axes are handled apart from
+ * the rest, so that a point on such an edge lies exactly on it.
+ * Returns false for parallel edges, which never meet at one point.
+ */
+bool EdgeLineIntersection (float x1, float y1, float x2, float y2,
+		float x3, float y3, float x4, float y4, float *x, float *y) {
 
-			else if (A_y1 == A_y2)
-				intr_x = INV;
+	/* Both the edges are parallel to the same axis */
+	if ((x1 == x2 && x3 == x4) || (y1 == y2 && y3 == y4))
+		return false;
 
-			else {
-				intr_x = INV;
-				intr_y = INV;
-			}
+	float slope1 = 0, intercept1 = 0, slope2 = 0, intercept2 = 0;
 
-			/* Get the end point vertices of B's edge */
-			B_x1 = B.mPoints[2 * B_index];
-			B_y1 = B.mPoints[2 * B_index + 1];
+	/* The edges at an angle to the axes */
+	if (x1 != x2 && y1 != y2) {
+		slope1 = (y1 - y2) / (x1 - x2);
+		intercept1 = y1 - slope1 * x1;
+	}
 
-			B_x2 = B.mPoints[(2 * B_index + 2) % (2 * B.mNumSides)];
-			B_y2 = B.mPoints[(2 * B_index + 3) % (2 * B.mNumSides)];
+	if (x3 != x4 && y3 != y4) {
+		slope2 = (y3 - y4) / (x3 - x4);
+		intercept2 = y3 - slope2 * x3;
+	}
 
-			B_slope = INV;
+	/* Edge parallel to y-axis */
+	if (x1 == x2) {
+		*x = x1;
+		*y = (y3 == y4) ? y3 : slope2 * *x + intercept2;
+	}
 
-			/*
-			 * This condition tests if the two edges are parallel.
-			 * This would mean no intersection. Hence we move on.
-			 */
-			if ((A_x1 == A_x2 && B_x1 == B_x2) ||
-					(A_y1 == A_y2 && B_y1 == B_y2))
-				continue;
+	else if (x3 == x4) {
+		*x = x3;
+		*y = (y1 == y2) ? y1 : slope1 * *x + intercept1;
+	}
 
-			/* Edge parallel to y-axis */
-			if (B_x1 == B_x2)
-				intr_x = B_x1;
+	/* Edge parallel to x-axis, the other one at an angle */
+	else if (y1 == y2) {
+		*y = y1;
+		*x = (y1 - intercept2) / slope2;
+	}
 
-			/* Edge parallel to x-axis */
-			else if (B_y1 == B_y2)
-				intr_y = B_y1;
+	else if (y3 == y4) {
+		*y = y3;
+		*x = (y3 - intercept1) / slope1;
+	}
 
-			/* Edge at an angle to the axes */
-			else {
-				B_slope = (B_y1 - B_y2) / (B_x1 - B_x2);
-				B_intercept = B_y1 - B_slope * B_x1;
-			}
+	/* Both the edges at an angle to the axes */
+	else {
+		if (slope1 == slope2)
+			return false;
 
-			/*
-			 * This condition tests if the two edge lines intersect
-			 * perpendicular to each other.
-			 */
-			if ((intr_x == A_x1 && intr_y == B_y1) ||
-					(intr_x == B_x1 && intr_y == A_y1)) {
-
-				/*
-				 * This is an important function that tests
-				 * if the actual edges intersect or is it just
-				 * the extended lines that intersect.
-				 */
-				if (A.LiesOnEdge(intr_x, intr_y, A_index) == true &&
-						B.LiesOnEdge(intr_x, intr_y, B_index) == true)
-					std::cout << "( " << intr_x << ", " << intr_y << " )" << std::endl;
+		*x = (intercept2 - intercept1) / (slope1 - slope2);
+		*y = slope1 * *x + intercept1;
+	}
 
-				continue;
-			}
+	return true;
+}
 
-			/*
-			 * The below else-if conditions are for cases
-			 * where one edge is aligned to an axis and the
-			 * other edge is at an angle.
-			 */
-			else if (intr_x == A_x1 && B_slope != INV) {
-				intr_y = B_slope * intr_x + B_intercept;
-			}
+/*
+ * Finds the points where the candidate edges of A cross those of B,
+ * and appends them to points, two floats per point.
+ */
+void EdgeIntersections (const Shape& A, const std::vector<int>& edgesA,
+		const Shape& B, const std::vector<int>& edgesB, std::vector<float>& points) {
 
-			else if (intr_x == B_x1 && A_slope != INV) {
-				intr_y = A_slope * intr_x + A_intercept;
-			}
+	const float *a = A.Points ( );
+	const float *b = B.Points ( );
+	unsigned int na = A.NumSides ( ), nb = B.NumSides ( );
 
-			else if (intr_y == A_y1 && B_slope != INV) {
-				intr_x = (A_y1 - B_intercept) / B_slope;
-			}
+	/* Iterator that iterators over the indices of candidate edges */
+	std::vector<int>::const_iterator A_vit = edgesA.begin();
 
-			else if (intr_y == B_y1 && A_slope != INV) {
-				intr_x = (B_y1 - A_intercept) / A_slope;
-			}
+	for (; A_vit != edgesA.end(); A_vit++ ) {
 
-			/* Both the edges intersect at an angle to each other */
-			else {
-				intr_x = (B_intercept - A_intercept) / (A_slope - B_slope);
-				intr_y = A_slope * intr_x + A_intercept;
-			}
+		int A_index = *A_vit;
+		float A_x1,A_y1,A_x2,A_y2;
+
+		/* Points of intersection */
+		float intr_x, intr_y;
+
+		/* Get A's edge points */
+		A_x1 = a[2 * A_index];
+		A_y1 = a[2 * A_index + 1];
+
+		A_x2 = a[(2 * A_index + 2) % (2 * na)];
+		A_y2 = a[(2 * A_index + 3) % (2 * na)];
+
+		/* Work your way through the candidate edges of B */
+		std::vector<int>::const_iterator B_vit = edgesB.begin();
+
+		for (; B_vit != edgesB.end(); B_vit++ ) {
+
+			int B_index = *B_vit;
+			float B_x1,B_y1,B_x2,B_y2;
+
+			/* Get the end point vertices of B's edge */
+			B_x1 = b[2 * B_index];
+			B_y1 = b[2 * B_index + 1];
+
+			B_x2 = b[(2 * B_index + 2) % (2 * nb)];
+			B_y2 = b[(2 * B_index + 3) % (2 * nb)];
+
+			/* Parallel edges mean no intersection. Hence we move on. */
+			if (EdgeLineIntersection (A_x1, A_y1, A_x2, A_y2, B_x1, B_y1, B_x2, B_y2,
+					&intr_x, &intr_y) == false)
+				continue;
 
 			/*
 			 * This is a subtle edge case to test if the vertex of
 			 * one object itself happens to be the point of intersection.
 			 * Without this test below, that intersection point would be
-			 * printed twice.
+			 * printed twice. Edges at right angles to each other and to
+			 * the axes are exempt from it.
 			 */
-			if ((intr_x == A_x2 && intr_y == A_y2) ||
-					(intr_x == B_x2 && intr_y == B_y2))
+			bool square = (A_x1 == A_x2 && B_y1 == B_y2) || (A_y1 == A_y2 && B_x1 == B_x2);
+
+			if (square == false && ((intr_x == A_x2 && intr_y == A_y2) ||
+					(intr_x == B_x2 && intr_y == B_y2)))
 				continue;
 
 			/*
@@ -367,12 +621,46 @@ void FindIntersection (const Shape& A, const Shape&B) {
 			 * the extended lines that intersect.
 			 */
 			if (A.LiesOnEdge(intr_x, intr_y, A_index) == true &&
-					B.LiesOnEdge(intr_x, intr_y, B_index) == true)
-				std::cout << "( " << intr_x << ", " << intr_y << " )" << std::endl;
+					B.LiesOnEdge(intr_x, intr_y, B_index) == true) {
+				points.push_back (intr_x);
+				points.push_back (intr_y);
+			}
 		}
 	}
 }
 
+/*
+ * The utility method that finds the points of intersection
+ * between the two objects. This function is only called after
+ * ProcessData has determined that the two objects intersect,
+ * which leaves the candidate edges of both in mIsectEdge.
+ */
+void FindIntersection (const Shape& A, const Shape&B) {
+
+	std::vector<float> points;
+
+	EdgeIntersections (A, A.mIsectEdge, B, B.mIsectEdge, points);
+
+	for (unsigned int k = 0; k < points.size ( ); k += 2)
+		std::cout << "( " << points[k] << ", " << points[k + 1] << " )" << std::endl;
+}
+
+/*
+ * The points of intersection of two objects that intersect, two floats
+ * per point. Like Classify, it leaves both objects alone, so any number
+ * of threads may use it on the same objects at once.
+ */
+void IntersectionPoints (const Shape& A, const Shape& B, std::vector<float>& points) {
+
+	std::vector<int> edgesA, edgesB;
+
+	AnalyzeEdges (A, B, &edgesA, NULL, NULL);
+	AnalyzeEdges (B, A, &edgesB, NULL, NULL);
+
+	points.clear ( );
+	EdgeIntersections (A, edgesA, B, edgesB, points);
+}
+
 /*
  * This function calls its helper functions that
  * analyze the overlap features of the two objects
@@ -421,3 +709,5 @@ void Analyzer (Shape& A, Shape& B) {
 		break;
 	}
 }
+
+#endif /* BASECLASSSHAPE_H */
@@ -0,0 +1,236 @@
+/*============================================================================
+ Name        : BroadPhase.h
+ Author      : Nitin Puranik
+ Description : Analyzes whole sets of objects at once. A cheap broad phase
+ 	 	 	   over the bounding boxes picks the candidate pairs and only
+ 	 	 	   those pairs are handed to the exact analyzer.
+ ============================================================================*/
+
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <cmath>
+#include <algorithm>
+#include "BaseClassShape.h"
+#include "QueryBudget.h"
+
+/* Boxes swept between two looks at the budget, if any */
+#define SWEEP_STRIDE 1024
+
+/*
+ * The outcome of the analysis for one pair of objects in a set.
+ * first and second are the positions of the objects in the set
+ * and which has the same meaning as in ProcessData.
+ */
+struct PairResult {
+	unsigned int first, second;
+	CollisionType type;
+	int which;
+};
+
+/* Orders box indices by the left edge of their boxes */
+struct BoxLess {
+	const std::vector<BoundingBox>& mBoxes;
+
+	BoxLess (const std::vector<BoundingBox>& boxes) : mBoxes (boxes) { }
+
+	bool operator() (unsigned int a, unsigned int b) const {
+		return mBoxes[a].xmin < mBoxes[b].xmin;
+	}
+};
+
+/*
+ * Tells if the two boxes overlap along the y-axis. The test is
+ * inclusive so that boxes which merely touch are still reported,
+ * otherwise adjacent objects would be missed.
+ */
+inline bool OverlapY (const BoundingBox& a, const BoundingBox& b) {
+	return a.ymin <= b.ymax && b.ymin <= a.ymax;
+}
+
+/*
+ * The sweep and prune broad phase. The boxes are sorted by their
+ * left edge and swept along the x-axis. Every pair of boxes that
+ * overlaps on both the axes is handed to the visitor as visit (i, j)
+ * with i and j being the positions of the boxes in the given vector.
+ * Once the budget, if any, runs out the sweep stops early. Returns the
+ * number of boxes swept, every pair of which has been visited.
+ */
+template <class Visitor>
+unsigned int SweepAndPrune (const std::vector<BoundingBox>& boxes, Visitor& visit,
+		QueryBudget *budget = NULL) {
+
+	std::vector<unsigned int> order (boxes.size ( ));
+
+	for (unsigned int i = 0; i < order.size ( ); i++)
+		order[i] = i;
+
+	std::sort (order.begin ( ), order.end ( ), BoxLess (boxes));
+
+	for (unsigned int i = 0; i < order.size ( ); i++) {
+
+		if (i % SWEEP_STRIDE == 0 && BudgetExpired (budget))
+			return i;
+
+		const BoundingBox& a = boxes[order[i]];
+
+		/* Only the boxes starting before this one ends can overlap it */
+		for (unsigned int j = i + 1; j < order.size ( ); j++) {
+
+			const BoundingBox& b = boxes[order[j]];
+
+			if (b.xmin > a.xmax)
+				break;
+
+			if (OverlapY (a, b))
+				visit (order[i], order[j]);
+		}
+	}
+
+	return order.size ( );
+}
+
+/*
+ * The sweep and prune between two sets of boxes. Both the sets are
+ * sorted by their left edges and merged, always advancing the box that
+ * starts first and sweeping it against the other set only. Every pair
+ * of overlapping boxes a[i], b[j] is handed to the visitor as visit (i, j).
+ * Once the budget, if any, runs out the sweep stops early. Returns the
+ * number of boxes of both sets swept, every pair of which has been visited.
+ */
+template <class Visitor>
+unsigned int SweepAndPrune (const std::vector<BoundingBox>& a, const std::vector<BoundingBox>& b,
+		Visitor& visit, QueryBudget *budget = NULL) {
+
+	std::vector<unsigned int> oa (a.size ( )), ob (b.size ( ));
+
+	for (unsigned int i = 0; i < oa.size ( ); i++)
+		oa[i] = i;
+
+	for (unsigned int j = 0; j < ob.size ( ); j++)
+		ob[j] = j;
+
+	std::sort (oa.begin ( ), oa.end ( ), BoxLess (a));
+	std::sort (ob.begin ( ), ob.end ( ), BoxLess (b));
+
+	unsigned int ia = 0, ib = 0;
+
+	while (ia < oa.size ( ) && ib < ob.size ( )) {
+
+		if ((ia + ib) % SWEEP_STRIDE == 0 && BudgetExpired (budget))
+			return ia + ib;
+
+		const BoundingBox& p = a[oa[ia]];
+		const BoundingBox& q = b[ob[ib]];
+
+		if (p.xmin <= q.xmin) {
+			for (unsigned int j = ib; j < ob.size ( ) && b[ob[j]].xmin <= p.xmax; j++)
+				if (OverlapY (p, b[ob[j]]))
+					visit (oa[ia], ob[j]);
+			ia++;
+		}
+
+		else {
+			for (unsigned int i = ia; i < oa.size ( ) && a[oa[i]].xmin <= q.xmax; i++)
+				if (OverlapY (q, a[oa[i]]))
+					visit (oa[i], ob[ib]);
+			ib++;
+		}
+	}
+
+	/* The boxes left in one set start after every box of the other has ended */
+	return oa.size ( ) + ob.size ( );
+}
+
+/*
+ * The narrow phase visitor. Each candidate pair is run through
+ * ProcessData and is recorded unless the two objects are apart.
+ */
+struct PairCollector {
+	std::vector<Shape*>& mShapes;
+	std::vector<PairResult>& mResults;
+
+	PairCollector (std::vector<Shape*>& shapes, std::vector<PairResult>& results)
+		: mShapes (shapes), mResults (results) { }
+
+	void operator() (unsigned int i, unsigned int j) {
+
+		PairResult res;
+
+		/* Report each pair with the smaller position first */
+		res.first = std::min (i, j);
+		res.second = std::max (i, j);
+		res.type = ProcessData (*mShapes[res.first], *mShapes[res.second], &res.which);
+
+		if (res.type != apart)
+			mResults.push_back (res);
+	}
+};
+
+/* Collects the bounding boxes of all the objects in the set */
+void CollectBounds (const std::vector<Shape*>& shapes, std::vector<BoundingBox>& boxes) {
+
+	boxes.resize (shapes.size ( ));
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++)
+		boxes[i] = shapes[i]->Bounds ( );
+}
+
+/* Returns the box that encloses all the given boxes */
+BoundingBox UnionBounds (const std::vector<BoundingBox>& boxes) {
+
+	BoundingBox world = boxes.empty ( ) ? BoundingBox ( ) : boxes[0];
+
+	for (unsigned int i = 1; i < boxes.size ( ); i++) {
+		world.xmin = std::min (world.xmin, boxes[i].xmin);
+		world.ymin = std::min (world.ymin, boxes[i].ymin);
+		world.xmax = std::max (world.xmax, boxes[i].xmax);
+		world.ymax = std::max (world.ymax, boxes[i].ymax);
+	}
+
+	return world;
+}
+
+/*
+ * Splits the x-axis into strips holding about the same number of box
+ * left edges. The first and the last strips are open ended.
+ */
+void StripBounds (const std::vector<BoundingBox>& a, const std::vector<BoundingBox>& b,
+		unsigned int strips, std::vector<float>& bounds) {
+
+	std::vector<float> edges;
+	edges.reserve (a.size ( ) + b.size ( ));
+
+	for (unsigned int i = 0; i < a.size ( ); i++)
+		edges.push_back (a[i].xmin);
+
+	for (unsigned int j = 0; j < b.size ( ); j++)
+		edges.push_back (b[j].xmin);
+
+	std::sort (edges.begin ( ), edges.end ( ));
+
+	bounds.assign (1, -HUGE_VALF);
+
+	for (unsigned int s = 1; s < strips && edges.empty ( ) == false; s++)
+		bounds.push_back (edges[edges.size ( ) * s / strips]);
+
+	bounds.push_back (HUGE_VALF);
+}
+
+/*
+ * Analyzes every pair of objects in the set and returns
+ * the pairs that are adjacent, contained or intersecting.
+ * Once the budget, if any, runs out the analysis stops with the pairs
+ * found so far, and complete receives the share of the set swept.
+ */
+void AnalyzeSet (std::vector<Shape*>& shapes, std::vector<PairResult>& results,
+		QueryBudget *budget = NULL, float *complete = NULL) {
+
+	std::vector<BoundingBox> boxes;
+	CollectBounds (shapes, boxes);
+
+	PairCollector collect (shapes, results);
+	ReportComplete (complete, SweepAndPrune (boxes, collect, budget), boxes.size ( ));
+}
+
+#endif /* BROADPHASE_H */
@@ -0,0 +1,238 @@
+/*============================================================================
+ Name        : Components.h
+ Author      : Nitin Puranik
+ Description : Groups a set of objects into islands, the sets of objects
+ 	 	 	   connected through a chain of adjacent, contained or
+ 	 	 	   intersecting pairs. The pairs are found by a parallel sweep
+ 	 	 	   and merged into a shared union-find as they are found, so
+ 	 	 	   the list of pairs is never kept.
+ ============================================================================*/
+
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+
+#include <atomic>
+#include <thread>
+#include "BroadPhase.h"
+
+/* The relations that link two objects into the same island */
+#define LINK_ADJACENT	1
+#define LINK_CONTAIN	2
+#define LINK_INTERSECT	4
+#define LINK_ALL		(LINK_ADJACENT | LINK_CONTAIN | LINK_INTERSECT)
+
+/* Number of sorted boxes a worker takes from the sweep at a time */
+#define COMPONENT_CHUNK 256
+
+/* The link bit of a relation, none for objects that are apart */
+inline unsigned int LinkOf (CollisionType type) {
+
+	switch (type) {
+	case adj:
+		return LINK_ADJACENT;
+
+	case contain:
+		return LINK_CONTAIN;
+
+	case none:
+		return LINK_INTERSECT;
+
+	default:
+		return 0;
+	}
+}
+
+/*
+ * A union-find that any number of threads may use at once without
+ * locks. A root is only ever linked below a root with a smaller
+ * index, by a compare and swap that fails if the root was linked
+ * meanwhile, so no cycle can form. Find halves the paths it walks.
+ */
+class ConcurrentUnionFind {
+private:
+	std::atomic<unsigned int> *mParent;
+
+	ConcurrentUnionFind (const ConcurrentUnionFind&);
+	ConcurrentUnionFind& operator= (const ConcurrentUnionFind&);
+
+public:
+	ConcurrentUnionFind (unsigned int size) {
+		mParent = new std::atomic<unsigned int> [size];
+
+		for (unsigned int i = 0; i < size; i++)
+			mParent[i].store (i, std::memory_order_relaxed);
+	}
+
+	~ConcurrentUnionFind ( ) {
+		delete[] mParent;
+	}
+
+	unsigned int Find (unsigned int x) {
+
+		while (true) {
+
+			unsigned int p = mParent[x].load ( );
+
+			if (p == x)
+				return x;
+
+			unsigned int g = mParent[p].load ( );
+
+			/* Point x past its parent; losing the race does no harm */
+			if (g != p)
+				mParent[x].compare_exchange_weak (p, g);
+
+			x = g;
+		}
+	}
+
+	/* Tells if a and b are in the same set at the time of the call */
+	bool Same (unsigned int a, unsigned int b) {
+
+		while (true) {
+
+			a = Find (a);
+			b = Find (b);
+
+			if (a == b)
+				return true;
+
+			/* a is still a root, so the two sets were apart */
+			if (mParent[a].load ( ) == a)
+				return false;
+		}
+	}
+
+	/* Merges the sets of a and b. Returns false if they were one already. */
+	bool Unite (unsigned int a, unsigned int b) {
+
+		while (true) {
+
+			a = Find (a);
+			b = Find (b);
+
+			if (a == b)
+				return false;
+
+			if (a > b)
+				std::swap (a, b);
+
+			unsigned int expected = b;
+
+			if (mParent[b].compare_exchange_strong (expected, a))
+				return true;
+		}
+	}
+};
+
+/*
+ * One worker of the parallel sweep. The boxes are sorted once by their
+ * left edge and the workers take chunks of them in turn, each sweeping
+ * its boxes forward against the rest. Pairs already in the same island
+ * are skipped without running the exact analysis.
+ */
+struct ComponentSweep {
+	const std::vector<Shape*>& mShapes;
+	const std::vector<BoundingBox>& mBoxes;
+	const std::vector<unsigned int>& mOrder;
+	unsigned int mLinks;
+	ConcurrentUnionFind& mSets;
+	std::atomic<unsigned int>& mNext;
+
+	ComponentSweep (const std::vector<Shape*>& shapes, const std::vector<BoundingBox>& boxes,
+			const std::vector<unsigned int>& order, unsigned int links,
+			ConcurrentUnionFind& sets, std::atomic<unsigned int>& next)
+		: mShapes (shapes), mBoxes (boxes), mOrder (order), mLinks (links),
+		  mSets (sets), mNext (next) { }
+
+	void Run ( ) {
+
+		unsigned int n = mOrder.size ( );
+
+		for (unsigned int start = mNext.fetch_add (COMPONENT_CHUNK); start < n;
+				start = mNext.fetch_add (COMPONENT_CHUNK)) {
+
+			unsigned int end = std::min (n, start + COMPONENT_CHUNK);
+
+			for (unsigned int i = start; i < end; i++) {
+
+				const BoundingBox& a = mBoxes[mOrder[i]];
+
+				for (unsigned int j = i + 1; j < n; j++) {
+
+					const BoundingBox& b = mBoxes[mOrder[j]];
+
+					if (b.xmin > a.xmax)
+						break;
+
+					if (OverlapY (a, b))
+						Link (mOrder[i], mOrder[j]);
+				}
+			}
+		}
+	}
+
+	void Link (unsigned int i, unsigned int j) {
+
+		if (mSets.Same (i, j))
+			return;
+
+		int which;
+
+		if (LinkOf (Classify (*mShapes[i], *mShapes[j], &which)) & mLinks)
+			mSets.Unite (i, j);
+	}
+};
+
+/*
+ * Finds the islands of the set, where two objects are linked if their
+ * relation is one of the LINK_ bits in links. component[i] receives the
+ * island of shapes[i]. Islands are numbered from 0 in the order of
+ * their first object. Returns the number of islands.
+ */
+unsigned int ConnectedComponents (const std::vector<Shape*>& shapes, unsigned int links,
+		std::vector<unsigned int>& component, unsigned int threads = 0) {
+
+	if (threads == 0)
+		threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+	std::vector<BoundingBox> boxes;
+	std::vector<unsigned int> order (shapes.size ( ));
+
+	CollectBounds (shapes, boxes);
+
+	for (unsigned int i = 0; i < order.size ( ); i++)
+		order[i] = i;
+
+	std::sort (order.begin ( ), order.end ( ), BoxLess (boxes));
+
+	struct Worker {
+		static void Run (ComponentSweep *sweep) {
+			sweep->Run ( );
+		}
+	};
+
+	ConcurrentUnionFind sets (shapes.size ( ));
+	std::atomic<unsigned int> next (0);
+	ComponentSweep sweep (shapes, boxes, order, links, sets, next);
+	std::vector<std::thread> pool;
+
+	for (unsigned int t = 0; t < threads; t++)
+		pool.push_back (std::thread (Worker::Run, &sweep));
+
+	for (unsigned int t = 0; t < threads; t++)
+		pool[t].join ( );
+
+	/* Every root is the smallest position in its island */
+	unsigned int count = 0;
+	component.resize (shapes.size ( ));
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++) {
+		unsigned int root = sets.Find (i);
+		component[i] = (root == i) ? count++ : component[root];
+	}
+
+	return count;
+}
+
+#endif /* COMPONENTS_H */
@@ -0,0 +1,163 @@
+/*============================================================================
+ Name        : ContainmentForest.h
+ Author      : Nitin Puranik
+ Description : Builds the nesting forest of a set of objects: for each one
+ 	 	 	   the smallest object that contains it, and how deeply it is
+ 	 	 	   nested. Candidate containers are looked up in a spatial
+ 	 	 	   index instead of testing every pair.
+ ============================================================================*/
+
+#ifndef CONTAINMENTFOREST_H
+#define CONTAINMENTFOREST_H
+
+#include <thread>
+#include "SpatialIndex.h"
+#include "BroadPhase.h"
+
+/* The parent of an object that no other object contains */
+#define NO_PARENT ((unsigned int) -1)
+
+/*
+ * The order the forest is built in: larger objects first, and the
+ * earlier position first among objects of the same area. A container
+ * always comes before the objects it contains.
+ */
+struct AreaGreater {
+	const std::vector<float>& mArea;
+
+	AreaGreater (const std::vector<float>& area) : mArea (area) { }
+
+	bool operator() (unsigned int a, unsigned int b) const {
+		if (mArea[a] != mArea[b])
+			return mArea[a] > mArea[b];
+
+		return a < b;
+	}
+};
+
+/* Passes the boxes that enclose the given box */
+struct EnclosesBox {
+	const BoundingBox& mBox;
+
+	EnclosesBox (const BoundingBox& box) : mBox (box) { }
+
+	bool operator() (const BoundingBox& b) const {
+		return b.xmin <= mBox.xmin && b.ymin <= mBox.ymin &&
+				b.xmax >= mBox.xmax && b.ymax >= mBox.ymax;
+	}
+};
+
+/*
+ * Finds the parents of a share of the objects. The candidates for an
+ * object are the objects whose boxes enclose its box and which come
+ * before it in area order. They are tried from the smallest up, so the
+ * first one that contains the object is its parent.
+ */
+struct ParentFinder {
+	const std::vector<Shape*>& mShapes;
+	const SpatialIndex& mIndex;
+	const std::vector<float>& mArea;
+	std::vector<unsigned int>& mParent;
+
+	unsigned int mSelf;
+	std::vector<unsigned int> mCandidates;
+
+	ParentFinder (const std::vector<Shape*>& shapes, const SpatialIndex& index,
+			const std::vector<float>& area, std::vector<unsigned int>& parent)
+		: mShapes (shapes), mIndex (index), mArea (area), mParent (parent), mSelf (0) { }
+
+	void operator() (unsigned int i) {
+		if (i != mSelf && AreaGreater (mArea) (i, mSelf))
+			mCandidates.push_back (i);
+	}
+
+	void Find (unsigned int self) {
+
+		EnclosesBox test (mShapes[self]->Bounds ( ));
+
+		mSelf = self;
+		mCandidates.clear ( );
+		mIndex.Search (test, *this);
+
+		/* Smallest first: reverse of the area order */
+		std::sort (mCandidates.begin ( ), mCandidates.end ( ), AreaGreater (mArea));
+
+		mParent[self] = NO_PARENT;
+
+		for (unsigned int k = mCandidates.size ( ); k-- > 0; ) {
+
+			int which;
+
+			if (Classify (*mShapes[mCandidates[k]], *mShapes[self], &which) == contain && which == 0) {
+				mParent[self] = mCandidates[k];
+				return;
+			}
+		}
+	}
+
+	void Run (unsigned int begin, unsigned int step) {
+		for (unsigned int i = begin; i < mShapes.size ( ); i += step)
+			Find (i);
+	}
+};
+
+/*
+ * Builds the nesting forest. parent[i] receives the smallest object
+ * that contains shapes[i], or NO_PARENT, and depth[i] the number of its
+ * ancestors. Where two containers of an object overlap without either
+ * containing the other, the smaller one is taken as its parent.
+ */
+void ContainmentForest (const std::vector<Shape*>& shapes, std::vector<unsigned int>& parent,
+		std::vector<unsigned int>& depth, unsigned int threads = 0) {
+
+	if (threads == 0)
+		threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+	std::vector<BoundingBox> boxes;
+	std::vector<float> area (shapes.size ( ));
+
+	CollectBounds (shapes, boxes);
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++)
+		area[i] = shapes[i]->Area ( );
+
+	SpatialIndex index (boxes);
+
+	struct Worker {
+		static void Run (ParentFinder *finder, unsigned int begin, unsigned int step) {
+			finder->Run (begin, step);
+		}
+	};
+
+	std::vector<ParentFinder*> finders;
+	std::vector<std::thread> pool;
+
+	parent.resize (shapes.size ( ));
+
+	for (unsigned int t = 0; t < threads; t++) {
+		finders.push_back (new ParentFinder (shapes, index, area, parent));
+		pool.push_back (std::thread (Worker::Run, finders.back ( ), t, threads));
+	}
+
+	for (unsigned int t = 0; t < threads; t++) {
+		pool[t].join ( );
+		delete finders[t];
+	}
+
+	/* In area order every parent is settled before its children */
+	std::vector<unsigned int> order (shapes.size ( ));
+
+	for (unsigned int i = 0; i < order.size ( ); i++)
+		order[i] = i;
+
+	std::sort (order.begin ( ), order.end ( ), AreaGreater (area));
+
+	depth.resize (shapes.size ( ));
+
+	for (unsigned int k = 0; k < order.size ( ); k++) {
+		unsigned int i = order[k];
+		depth[i] = (parent[i] == NO_PARENT) ? 0 : depth[parent[i]] + 1;
+	}
+}
+
+#endif /* CONTAINMENTFOREST_H */
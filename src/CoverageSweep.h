@@ -0,0 +1,677 @@
+/*============================================================================
+ Name        : CoverageSweep.h
+ Author      : Nitin Puranik
+ Description : The area covered by the union of a set of objects, and the
+ 	 	 	   deepest point covered by the most objects at once. Axis
+ 	 	 	   aligned objects are swept along x over a segment tree of the
+ 	 	 	   y-coordinates. Other objects, with the axis aligned ones
+ 	 	 	   around them, are cut into vertical slabs that no two edges
+ 	 	 	   cross inside, where the covered length changes linearly, so
+ 	 	 	   each slab is measured exactly at its middle. Both split the
+ 	 	 	   x-axis into strips measured in parallel.
+ ============================================================================*/
+
+#ifndef COVERAGESWEEP_H
+#define COVERAGESWEEP_H
+
+#include <thread>
+#include "BroadPhase.h"
+#include "SpatialOrder.h"
+
+/* Tells if every edge of the object is horizontal or vertical */
+bool IsAxisAligned (const Shape& S) {
+
+	for (unsigned int i = 0; i < S.NumSides ( ); i++)
+		if (S.Normals ( )[2 * i] != 0 && S.Normals ( )[2 * i + 1] != 0)
+			return false;
+
+	return true;
+}
+
+/*
+ * A segment tree over the gaps between sorted y-coordinates. Each node
+ * keeps how many intervals cover its whole range, and the length of its
+ * range that is covered at all.
+ */
+class CoverTree {
+private:
+	const std::vector<float>& mYs;
+	std::vector<int> mCount;
+	std::vector<double> mLength;
+
+	void Update (unsigned int node, unsigned int lo, unsigned int hi,
+			unsigned int a, unsigned int b, int delta) {
+
+		if (b <= lo || hi <= a)
+			return;
+
+		if (a <= lo && hi <= b)
+			mCount[node] += delta;
+
+		else {
+			unsigned int mid = (lo + hi) / 2;
+			Update (2 * node, lo, mid, a, b, delta);
+			Update (2 * node + 1, mid, hi, a, b, delta);
+		}
+
+		if (mCount[node] > 0)
+			mLength[node] = (double) mYs[hi] - mYs[lo];
+
+		else if (hi - lo == 1)
+			mLength[node] = 0;
+
+		else
+			mLength[node] = mLength[2 * node] + mLength[2 * node + 1];
+	}
+
+public:
+	CoverTree (const std::vector<float>& ys)
+		: mYs (ys), mCount (4 * ys.size ( ), 0), mLength (4 * ys.size ( ), 0) { }
+
+	/* Adds delta to the cover count of [y1, y2], both of which are in ys */
+	void Add (float y1, float y2, int delta) {
+
+		unsigned int a = std::lower_bound (mYs.begin ( ), mYs.end ( ), y1) - mYs.begin ( );
+		unsigned int b = std::lower_bound (mYs.begin ( ), mYs.end ( ), y2) - mYs.begin ( );
+
+		if (a < b)
+			Update (1, 0, mYs.size ( ) - 1, a, b, delta);
+	}
+
+	double Covered ( ) const {
+		return mYs.size ( ) < 2 ? 0 : mLength[1];
+	}
+};
+
+/* The left or right side of a box in the sweep */
+struct CoverEvent {
+	float x, y1, y2;
+	int delta;
+
+	bool operator< (const CoverEvent& e) const {
+		return x < e.x;
+	}
+};
+
+/* The area of the union of the boxes, clipped to the strip [lo, hi) */
+double BoxStripArea (const std::vector<BoundingBox>& boxes, float lo, float hi) {
+
+	std::vector<CoverEvent> events;
+	std::vector<float> ys;
+
+	for (unsigned int i = 0; i < boxes.size ( ); i++) {
+
+		const BoundingBox& b = boxes[i];
+		float x1 = std::max (b.xmin, lo), x2 = std::min (b.xmax, hi);
+
+		if (x2 <= x1 || b.ymax <= b.ymin)
+			continue;
+
+		CoverEvent open = { x1, b.ymin, b.ymax, 1 };
+		CoverEvent close = { x2, b.ymin, b.ymax, -1 };
+
+		events.push_back (open);
+		events.push_back (close);
+		ys.push_back (b.ymin);
+		ys.push_back (b.ymax);
+	}
+
+	std::sort (ys.begin ( ), ys.end ( ));
+	ys.erase (std::unique (ys.begin ( ), ys.end ( )), ys.end ( ));
+	std::sort (events.begin ( ), events.end ( ));
+
+	CoverTree tree (ys);
+	double area = 0;
+
+	for (unsigned int k = 0; k < events.size ( ); k++) {
+
+		if (k > 0)
+			area += tree.Covered ( ) * ((double) events[k].x - events[k - 1].x);
+
+		tree.Add (events[k].y1, events[k].y2, events[k].delta);
+	}
+
+	return area;
+}
+
+/*
+ * The extent of the object along the vertical line at x, which must
+ * lie strictly within its box. Vertical edges are skipped; the line
+ * crosses the other edges on both sides.
+ */
+void ExtentAt (const Shape& S, double x, double *lo, double *hi) {
+
+	const float *p = S.Points ( );
+	unsigned int n = S.NumSides ( );
+
+	*lo = HUGE_VAL;
+	*hi = -HUGE_VAL;
+
+	for (unsigned int i = 0; i < n; i++) {
+
+		double x1 = p[2 * i], y1 = p[2 * i + 1];
+		double x2 = p[(2 * i + 2) % (2 * n)], y2 = p[(2 * i + 3) % (2 * n)];
+
+		if ((x < x1) == (x < x2))
+			continue;
+
+		double y = y1 + (y2 - y1) * (x - x1) / (x2 - x1);
+
+		*lo = std::min (*lo, y);
+		*hi = std::max (*hi, y);
+	}
+}
+
+/*
+ * The broad phase visitor of the slab path. It collects the x of every
+ * point where an edge of one object crosses an edge of another, which
+ * are the only places besides the vertices where the order of the
+ * extents along a vertical line can change.
+ */
+struct CrossingCollector {
+	const std::vector<Shape*>& mShapes;
+	std::vector<double> mXs;
+
+	CrossingCollector (const std::vector<Shape*>& shapes) : mShapes (shapes) { }
+
+	void operator() (unsigned int i, unsigned int j) {
+
+		const float *a = mShapes[i]->Points ( );
+		const float *b = mShapes[j]->Points ( );
+		unsigned int na = mShapes[i]->NumSides ( ), nb = mShapes[j]->NumSides ( );
+
+		for (unsigned int e = 0; e < na; e++) {
+
+			double px = a[2 * e], py = a[2 * e + 1];
+			double rx = a[(2 * e + 2) % (2 * na)] - px, ry = a[(2 * e + 3) % (2 * na)] - py;
+
+			for (unsigned int f = 0; f < nb; f++) {
+
+				double qx = b[2 * f], qy = b[2 * f + 1];
+				double sx = b[(2 * f + 2) % (2 * nb)] - qx, sy = b[(2 * f + 3) % (2 * nb)] - qy;
+
+				double den = rx * sy - ry * sx;
+
+				/* Parallel edges only meet at vertices, which are events already */
+				if (den == 0)
+					continue;
+
+				double t = ((qx - px) * sy - (qy - py) * sx) / den;
+				double u = ((qx - px) * ry - (qy - py) * rx) / den;
+
+				if (t > 0 && t < 1 && u > 0 && u < 1)
+					mXs.push_back (px + t * rx);
+			}
+		}
+	}
+};
+
+/*
+ * Hands the extents of the objects at the middle of each slab between
+ * xs[begin] and xs[end] to the measure, as measure (xa, xb, mid, extents).
+ * Every vertex and crossing is in xs, so an object either spans a slab
+ * or misses it, and within a slab the extents keep their order, so
+ * anything measured at the middle holds across the slab.
+ */
+template <class Measure>
+void WalkSlabs (const std::vector<Shape*>& shapes, const std::vector<BoundingBox>& boxes,
+		const std::vector<unsigned int>& order, const std::vector<double>& xs,
+		unsigned int begin, unsigned int end, Measure& measure) {
+
+	std::vector<unsigned int> active;
+	std::vector<std::pair<double, double> > extents;
+	unsigned int next = 0;
+
+	for (unsigned int k = begin; k < end; k++) {
+
+		double xa = xs[k], xb = xs[k + 1], mid = 0.5 * (xa + xb);
+
+		while (next < order.size ( ) && boxes[order[next]].xmin < mid)
+			active.push_back (order[next++]);
+
+		/* Drop the objects that ended before this slab */
+		unsigned int kept = 0;
+
+		for (unsigned int a = 0; a < active.size ( ); a++)
+			if (boxes[active[a]].xmax > mid)
+				active[kept++] = active[a];
+
+		active.resize (kept);
+		extents.clear ( );
+
+		for (unsigned int a = 0; a < active.size ( ); a++) {
+			double lo, hi;
+			ExtentAt (*shapes[active[a]], mid, &lo, &hi);
+
+			if (hi > lo)
+				extents.push_back (std::make_pair (lo, hi));
+		}
+
+		std::sort (extents.begin ( ), extents.end ( ));
+		measure (xa, xb, mid, extents);
+	}
+}
+
+/* Adds up the length covered by the extents of every slab times its width */
+struct UnionMeasure {
+	double area;
+
+	UnionMeasure ( ) : area (0) { }
+
+	void operator() (double xa, double xb, double, const std::vector<std::pair<double, double> >& extents) {
+
+		double covered = 0, top = -HUGE_VAL;
+
+		for (unsigned int e = 0; e < extents.size ( ); e++) {
+			if (extents[e].second <= top)
+				continue;
+
+			covered += extents[e].second - std::max (extents[e].first, top);
+			top = extents[e].second;
+		}
+
+		area += covered * (xb - xa);
+	}
+};
+
+/*
+ * Runs one measure per thread over equal runs of slabs. The events are
+ * every vertex and every crossing of two edges.
+ */
+template <class Measure>
+void MeasureSlabs (const std::vector<Shape*>& shapes, const std::vector<BoundingBox>& boxes,
+		std::vector<Measure>& measures) {
+
+	struct Worker {
+		static void Run (const std::vector<Shape*> *shapes, const std::vector<BoundingBox> *boxes,
+				const std::vector<unsigned int> *order, const std::vector<double> *xs,
+				unsigned int begin, unsigned int end, Measure *measure) {
+			WalkSlabs (*shapes, *boxes, *order, *xs, begin, end, *measure);
+		}
+	};
+
+	CrossingCollector crossings (shapes);
+	SweepAndPrune (boxes, crossings);
+
+	std::vector<double>& xs = crossings.mXs;
+	std::vector<unsigned int> order (shapes.size ( ));
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++) {
+
+		for (unsigned int v = 0; v < shapes[i]->NumSides ( ); v++)
+			xs.push_back (shapes[i]->Points ( )[2 * v]);
+
+		order[i] = i;
+	}
+
+	std::sort (xs.begin ( ), xs.end ( ));
+	xs.erase (std::unique (xs.begin ( ), xs.end ( )), xs.end ( ));
+	std::sort (order.begin ( ), order.end ( ), BoxLess (boxes));
+
+	/* Equal runs of slabs; the slabs are cheap where few objects are */
+	unsigned int slabs = xs.size ( ) < 2 ? 0 : xs.size ( ) - 1;
+	unsigned int threads = measures.size ( );
+	std::vector<std::thread> pool;
+
+	for (unsigned int t = 0; t < threads; t++)
+		pool.push_back (std::thread (Worker::Run, &shapes, &boxes, &order, &xs,
+				RangeStart (slabs, threads, t), RangeStart (slabs, threads, t + 1), &measures[t]));
+
+	for (unsigned int t = 0; t < threads; t++)
+		pool[t].join ( );
+}
+
+/* The union area of axis aligned objects, given their boxes */
+double AlignedUnionArea (const std::vector<BoundingBox>& boxes, unsigned int threads) {
+
+	struct Worker {
+		static void Run (const std::vector<BoundingBox> *boxes, float lo, float hi, double *area) {
+			*area = BoxStripArea (*boxes, lo, hi);
+		}
+	};
+
+	std::vector<float> bounds;
+	StripBounds (boxes, std::vector<BoundingBox> ( ), threads, bounds);
+
+	std::vector<double> parts (bounds.size ( ) - 1, 0);
+	std::vector<std::thread> pool;
+
+	for (unsigned int s = 0; s < parts.size ( ); s++)
+		pool.push_back (std::thread (Worker::Run, &boxes, bounds[s], bounds[s + 1], &parts[s]));
+
+	double area = 0;
+
+	for (unsigned int s = 0; s < pool.size ( ); s++) {
+		pool[s].join ( );
+		area += parts[s];
+	}
+
+	return area;
+}
+
+/*
+ * Splits a set for the two paths. aligned receives the boxes of the axis
+ * aligned objects. The slab path gets the other objects and, after them,
+ * the axis aligned objects whose boxes meet the box of one of them, the
+ * only ones that can cover any of the same points. near receives the
+ * boxes of those axis aligned objects.
+ */
+void SplitAligned (const std::vector<Shape*>& shapes, const std::vector<BoundingBox>& boxes,
+		std::vector<BoundingBox>& aligned, std::vector<Shape*>& slabShapes,
+		std::vector<BoundingBox>& slabBoxes, std::vector<BoundingBox>& near) {
+
+	std::vector<unsigned int> flat;
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++) {
+
+		if (IsAxisAligned (*shapes[i]) == false) {
+			slabShapes.push_back (shapes[i]);
+			slabBoxes.push_back (boxes[i]);
+		}
+
+		else {
+			flat.push_back (i);
+			aligned.push_back (boxes[i]);
+		}
+	}
+
+	struct Mark {
+		std::vector<bool> hit;
+		void operator() (unsigned int, unsigned int j) { hit[j] = true; }
+	} mark;
+
+	mark.hit.assign (flat.size ( ), false);
+	SweepAndPrune (slabBoxes, aligned, mark);
+
+	for (unsigned int j = 0; j < flat.size ( ); j++) {
+		if (mark.hit[j]) {
+			slabShapes.push_back (shapes[flat[j]]);
+			slabBoxes.push_back (aligned[j]);
+			near.push_back (aligned[j]);
+		}
+	}
+}
+
+/*
+ * The area covered by the union of the objects. The axis aligned ones
+ * take the segment tree sweep, in O(n log n). The others can only add
+ * the area they cover outside of that union, which is the area of the
+ * union of them and the axis aligned objects near them, less that of
+ * those axis aligned objects on their own. The slab decomposition that
+ * measures it takes s slabs, one per vertex and edge crossing, and
+ * sorts the extents of up to k objects in each, for O(s k log k) over
+ * just those objects. Few objects that are not axis aligned thus cost
+ * little more than none; many that crowd together cost up to cubic
+ * time in their number.
+ */
+double UnionArea (const std::vector<Shape*>& shapes, unsigned int threads = 0) {
+
+	if (threads == 0)
+		threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+	std::vector<BoundingBox> boxes, aligned, slabBoxes, near;
+	std::vector<Shape*> slabShapes;
+
+	CollectBounds (shapes, boxes);
+	SplitAligned (shapes, boxes, aligned, slabShapes, slabBoxes, near);
+
+	double area = aligned.empty ( ) ? 0 : AlignedUnionArea (aligned, threads);
+
+	if (slabShapes.empty ( ))
+		return area;
+
+	std::vector<UnionMeasure> measures (threads);
+
+	MeasureSlabs (slabShapes, slabBoxes, measures);
+
+	for (unsigned int t = 0; t < threads; t++)
+		area += measures[t].area;
+
+	return near.empty ( ) ? area : area - AlignedUnionArea (near, threads);
+}
+
+/*
+ * The point covered by the most objects, and by how many. Objects that
+ * only touch do not stack; the point lies inside all of them.
+ */
+struct DeepestPoint {
+	unsigned int depth;
+	float x, y;
+};
+
+/*
+ * A segment tree over the gaps between sorted y-coordinates that keeps
+ * the most intervals covering any one gap, and the gap. Additions to a
+ * whole node are kept in the node and never pushed down.
+ */
+class DepthTree {
+private:
+	const std::vector<float>& mYs;
+	std::vector<int> mAdd, mMax;
+	std::vector<unsigned int> mArg;
+
+	void Build (unsigned int node, unsigned int lo, unsigned int hi) {
+
+		mArg[node] = lo;
+
+		if (hi - lo > 1) {
+			Build (2 * node, lo, (lo + hi) / 2);
+			Build (2 * node + 1, (lo + hi) / 2, hi);
+		}
+	}
+
+	void Update (unsigned int node, unsigned int lo, unsigned int hi,
+			unsigned int a, unsigned int b, int delta) {
+
+		if (b <= lo || hi <= a)
+			return;
+
+		if (a <= lo && hi <= b) {
+			mAdd[node] += delta;
+			mMax[node] += delta;
+			return;
+		}
+
+		unsigned int mid = (lo + hi) / 2;
+		Update (2 * node, lo, mid, a, b, delta);
+		Update (2 * node + 1, mid, hi, a, b, delta);
+
+		unsigned int best = mMax[2 * node] >= mMax[2 * node + 1] ? 2 * node : 2 * node + 1;
+
+		mMax[node] = mAdd[node] + mMax[best];
+		mArg[node] = mArg[best];
+	}
+
+public:
+	DepthTree (const std::vector<float>& ys)
+		: mYs (ys), mAdd (4 * ys.size ( ), 0), mMax (4 * ys.size ( ), 0), mArg (4 * ys.size ( ), 0) {
+		if (ys.size ( ) > 1)
+			Build (1, 0, ys.size ( ) - 1);
+	}
+
+	/* Adds delta to the gaps within [y1, y2], both of which are in ys */
+	void Add (float y1, float y2, int delta) {
+
+		unsigned int a = std::lower_bound (mYs.begin ( ), mYs.end ( ), y1) - mYs.begin ( );
+		unsigned int b = std::lower_bound (mYs.begin ( ), mYs.end ( ), y2) - mYs.begin ( );
+
+		if (a < b)
+			Update (1, 0, mYs.size ( ) - 1, a, b, delta);
+	}
+
+	int Max ( ) const {
+		return mYs.size ( ) < 2 ? 0 : mMax[1];
+	}
+
+	/* The middle of the deepest gap */
+	float ArgMax ( ) const {
+		return 0.5f * (mYs[mArg[1]] + mYs[mArg[1] + 1]);
+	}
+};
+
+/* Boxes that end at an x are taken out before those that start there */
+struct DepthEventLess {
+	bool operator() (const CoverEvent& a, const CoverEvent& b) const {
+		return a.x < b.x || (a.x == b.x && a.delta < b.delta);
+	}
+};
+
+/* The deepest point of the boxes within the strip [lo, hi) */
+DeepestPoint BoxStripDepth (const std::vector<BoundingBox>& boxes, float lo, float hi) {
+
+	std::vector<CoverEvent> events;
+	std::vector<float> ys;
+	DeepestPoint best = { 0, 0, 0 };
+
+	for (unsigned int i = 0; i < boxes.size ( ); i++) {
+
+		const BoundingBox& b = boxes[i];
+		float x1 = std::max (b.xmin, lo), x2 = std::min (b.xmax, hi);
+
+		if (x2 <= x1 || b.ymax <= b.ymin)
+			continue;
+
+		CoverEvent open = { x1, b.ymin, b.ymax, 1 };
+		CoverEvent close = { x2, b.ymin, b.ymax, -1 };
+
+		events.push_back (open);
+		events.push_back (close);
+		ys.push_back (b.ymin);
+		ys.push_back (b.ymax);
+	}
+
+	std::sort (ys.begin ( ), ys.end ( ));
+	ys.erase (std::unique (ys.begin ( ), ys.end ( )), ys.end ( ));
+	std::sort (events.begin ( ), events.end ( ), DepthEventLess ( ));
+
+	DepthTree tree (ys);
+
+	for (unsigned int k = 0; k < events.size ( ); k++) {
+
+		tree.Add (events[k].y1, events[k].y2, events[k].delta);
+
+		/* The depth holds until the next x that has events */
+		if (k + 1 < events.size ( ) && events[k + 1].x != events[k].x &&
+				tree.Max ( ) > (int) best.depth) {
+			best.depth = tree.Max ( );
+			best.x = 0.5f * (events[k].x + events[k + 1].x);
+			best.y = tree.ArgMax ( );
+		}
+	}
+
+	return best;
+}
+
+/* The deepest point of axis aligned objects, given their boxes */
+DeepestPoint AlignedMaxDepth (const std::vector<BoundingBox>& boxes, unsigned int threads) {
+
+	struct Worker {
+		static void Run (const std::vector<BoundingBox> *boxes, float lo, float hi, DeepestPoint *best) {
+			*best = BoxStripDepth (*boxes, lo, hi);
+		}
+	};
+
+	std::vector<float> bounds;
+	StripBounds (boxes, std::vector<BoundingBox> ( ), threads, bounds);
+
+	std::vector<DeepestPoint> parts (bounds.size ( ) - 1);
+	std::vector<std::thread> pool;
+
+	for (unsigned int s = 0; s < parts.size ( ); s++)
+		pool.push_back (std::thread (Worker::Run, &boxes, bounds[s], bounds[s + 1], &parts[s]));
+
+	DeepestPoint best = { 0, 0, 0 };
+
+	for (unsigned int s = 0; s < pool.size ( ); s++) {
+		pool[s].join ( );
+
+		if (parts[s].depth > best.depth)
+			best = parts[s];
+	}
+
+	return best;
+}
+
+/* Finds the most extents that overlap at once in any slab */
+struct DepthMeasure {
+	DeepestPoint best;
+	std::vector<std::pair<double, int> > ends;
+
+	DepthMeasure ( ) {
+		best.depth = 0;
+		best.x = best.y = 0;
+	}
+
+	void operator() (double, double, double mid, const std::vector<std::pair<double, double> >& extents) {
+
+		if (extents.size ( ) <= best.depth)
+			return;
+
+		ends.clear ( );
+
+		/* At the same y an extent ends before the next one starts */
+		for (unsigned int e = 0; e < extents.size ( ); e++) {
+			ends.push_back (std::make_pair (extents[e].first, 1));
+			ends.push_back (std::make_pair (extents[e].second, -1));
+		}
+
+		std::sort (ends.begin ( ), ends.end ( ));
+
+		int depth = 0;
+
+		for (unsigned int e = 0; e + 1 < ends.size ( ); e++) {
+
+			depth += ends[e].second;
+
+			if (depth > (int) best.depth && ends[e + 1].first > ends[e].first) {
+				best.depth = depth;
+				best.x = mid;
+				best.y = 0.5 * (ends[e].first + ends[e + 1].first);
+			}
+		}
+	}
+};
+
+/*
+ * Finds the point covered by the most objects. The axis aligned ones
+ * take a sweep over a segment tree of maximum depths, in O(n log n).
+ * Every point covered by one of the others is covered only by objects
+ * near it, so those are measured slab by slab with just the axis aligned
+ * objects near them, and the deeper of the two points wins. A point of
+ * the sweep that is also covered by another object is never deeper than
+ * the slabs find it, so the depth reported is always that of its point.
+ * The slabs cost O(s k log k) for s vertices and edge crossings and up
+ * to k objects in a slab, over just those objects, as for UnionArea.
+ */
+DeepestPoint MaxOverlapDepth (const std::vector<Shape*>& shapes, unsigned int threads = 0) {
+
+	if (threads == 0)
+		threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+	std::vector<BoundingBox> boxes, aligned, slabBoxes, near;
+	std::vector<Shape*> slabShapes;
+
+	CollectBounds (shapes, boxes);
+	SplitAligned (shapes, boxes, aligned, slabShapes, slabBoxes, near);
+
+	DeepestPoint best = { 0, 0, 0 };
+
+	if (aligned.empty ( ) == false)
+		best = AlignedMaxDepth (aligned, threads);
+
+	if (slabShapes.empty ( ))
+		return best;
+
+	std::vector<DepthMeasure> measures (threads);
+
+	MeasureSlabs (slabShapes, slabBoxes, measures);
+
+	/* On a tie the point of the slabs wins, its depth counts every object */
+	for (unsigned int t = 0; t < threads; t++)
+		if (measures[t].best.depth > 0 && measures[t].best.depth >= best.depth)
+			best = measures[t].best;
+
+	return best;
+}
+
+#endif /* COVERAGESWEEP_H */
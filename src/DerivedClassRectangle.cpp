@@ -6,7 +6,34 @@
  	 	 	   its own methods.
  ============================================================================*/
 
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
 #include "BaseClassShape.h"
+#include "BroadPhase.h"
+#include "QuantizedBounds.h"
+#include "SeparatingAxisCache.h"
+#include "DynamicScene.h"
+#include "KineticSweep.h"
+#include "ShapeDistance.h"
+#include "SweptCollision.h"
+#include "DistanceJoin.h"
+#include "ShapeFile.h"
+#include "PartitionJoin.h"
+#include "SpatialOrder.h"
+#include "ExternalAnalyze.h"
+#include "Components.h"
+#include "ContainmentForest.h"
+#include "AdjacencyGraph.h"
+#include "CoverageSweep.h"
+#include "Raster.h"
+#include "PointQuery.h"
+#include "RayQuery.h"
+#include "NearestQuery.h"
+#include "QueryServer.h"
+#include "QueryBudget.h"
+#include "ShardedAnalyze.h"
+#include "SharedShapes.h"
 
 using namespace std;
 
@@ -18,6 +45,11 @@ private:
 public:
 	Rectangle ( );
 
+	/* Builds a rectangle from the given points without asking the user */
+	Rectangle (const float *points) : Shape (4, points) {
+		mName = "Rectangle";
+	}
+
 	/* Thoroughly check the user input for correctness of data */
 	bool SanityCheck ( );
 };
@@ -70,6 +102,9 @@ Rectangle::Rectangle ( ) : Shape (4) {
 		}
 	}
 
+	/* The points were read straight in, so derive the prepared data now */
+	Prepare ( );
+
 	std::cin.clear ( );
 	while (std::cin.get ( ) != '\n');
 }
@@ -216,7 +251,841 @@ void WelcomeScreen ( ) {
 	}
 }
 
+/*
+ * Reads rectangles from a stream, 8 coordinates per rectangle in the
+ * same sequence as the interactive input. Every rectangle goes through
+ * the same sanity check as the user input. Ill formed rectangles are
+ * reported and skipped. Returns false if the stream is malformed.
+ */
+bool ReadRectangles (std::istream& in, std::vector<Shape*>& shapes) {
+
+	unsigned int record = 0;
+	float points[8];
+
+	while (true) {
+
+		int i;
+
+		for (i = 0; i < 8 && (in >> points[i]); i++);
+
+		if (i == 0 && in.eof ( ))
+			return true;
+
+		record++;
+
+		if (i != 8) {
+			std::cerr << "Invalid input at rectangle " << record << "." << std::endl;
+			return false;
+		}
+
+		Rectangle *rect = new Rectangle (points);
+
+		if (rect->SanityCheck ( ) == false) {
+			std::cerr << "Ill formed rectangle " << record << " skipped." << std::endl;
+			delete rect;
+			continue;
+		}
+
+		shapes.push_back (rect);
+	}
+}
+
+/* Builds a rectangle for a server request, if it passes the sanity check */
+Shape *MakeRectangle (const float *points) {
+
+	Rectangle *rect = new Rectangle (points);
+
+	if (rect->SanityCheck ( ) == false) {
+		delete rect;
+		return NULL;
+	}
+
+	return rect;
+}
+
+/* Prints the results of a set analysis, one pair per line */
+void PrintPairs (const std::vector<PairResult>& results) {
+
+	for (unsigned int i = 0; i < results.size ( ); i++) {
+
+		const PairResult& res = results[i];
+
+		std::cout << res.first << " " << res.second << " ";
+
+		switch (res.type) {
+		case adj:
+			std::cout << "adjacent" << std::endl;
+			break;
+
+		case contain:
+			std::cout << "contain " << (res.which == 0 ? res.first : res.second) << std::endl;
+			break;
+
+		default:
+			std::cout << "intersect" << std::endl;
+			break;
+		}
+	}
+}
+
+/* Reads and validates a text file of rectangles */
+bool LoadRectangles (const char *file, std::vector<Shape*>& shapes) {
+
+	std::ifstream in (file);
+
+	if (in.is_open ( ) == false) {
+		std::cerr << "Cannot open " << file << std::endl;
+		return false;
+	}
+
+	return ReadRectangles (in, shapes);
+}
+
+void FreeRectangles (std::vector<Shape*>& shapes) {
+	for (unsigned int i = 0; i < shapes.size ( ); i++)
+		delete shapes[i];
+	shapes.clear ( );
+}
+
+/*
+ * Converts a text file of rectangles to a record file. The rectangles
+ * are validated on the way, and the id of a record is its position
+ * among the valid rectangles.
+ */
+bool ConvertRectangles (const char *text, const char *binary) {
+
+	std::vector<Shape*> shapes;
+	RecordFile out;
+	bool ok;
+
+	if (LoadRectangles (text, shapes) == false || out.Open (binary, "wb") == false) {
+		FreeRectangles (shapes);
+		return false;
+	}
+
+	ok = true;
+
+	for (unsigned int i = 0; ok && i < shapes.size ( ); i++) {
+
+		ShapeRecord rec;
+
+		rec.id = i;
+
+		for (unsigned int k = 0; k < 2 * RECORD_SIDES; k++)
+			rec.points[k] = shapes[i]->Points ( )[k];
+
+		ok = out.Write (rec);
+	}
+
+	FreeRectangles (shapes);
+	return ok;
+}
+
+/* Prints the pairs of a join as they are streamed in */
+struct PrintSink {
+	void operator() (const std::vector<PairResult>& results) {
+		PrintPairs (results);
+	}
+};
+
+/* Gathers the hits of a point query, to be printed in order */
+struct HitSink {
+	std::vector<PointHit> mHits;
+
+	void operator() (const std::vector<PointHit>& hits) {
+		mHits.insert (mHits.end ( ), hits.begin ( ), hits.end ( ));
+	}
+};
+
+/*
+ * The non-interactive batch mode. The commands are:
+ *
+ * --pairs <file> [--quantize <tiles>] [--order hilbert|zorder] [--deadline <ms>]
+ *         Analyze every pair of rectangles in the text file. With
+ *         --quantize the broad phase runs over 16-bit quantized boxes
+ *         on a tiles x tiles grid. With --order the set is first copied
+ *         in curve order, so that rectangles close in space are close in
+ *         memory too; the pairs are still reported by file position.
+ *         With --deadline the analysis stops like that of --join and
+ *         --analyze below; quantized, it stops in between tiles.
+ *
+ * --convert <text> <records>
+ *         Validate a text file of rectangles and write it as records.
+ *
+ * --join <recordsA> <recordsB> [--memory <MB>] [--temp <prefix>] [--deadline <ms>]
+ *         Report the pairs of rectangles of A and B that are not apart,
+ *         by record id, using at most about MB megabytes of memory.
+ *
+ * --analyze <records> [--memory <MB>] [--temp <prefix>] [--deadline <ms>]
+ *         Analyze every pair of rectangles in a record file too large
+ *         for memory, using at most about MB megabytes of memory.
+ *
+ *         With --deadline, either of the two stops after about ms
+ *         milliseconds with the pairs found so far, and prints the
+ *         share of the work it got through to the error stream.
+ *
+ * --components <file> [--links adjacent,contain,intersect]
+ *         Print the island of every rectangle in the text file, one
+ *         per line. --links picks the relations that link two
+ *         rectangles, all of them by default.
+ *
+ * --nesting <file>
+ *         Print the innermost container of every rectangle in the text
+ *         file and how deeply it is nested, one rectangle per line.
+ *
+ * --adjacency <file>
+ *         Print the adjacency graph of the rectangles in the text file
+ *         in compressed sparse row form: the number of rectangles and
+ *         of entries, then the offsets, the neighbours and the shared
+ *         edge lengths, one array per line.
+ *
+ * --area <file>
+ *         Print the area covered by the union of the rectangles in the
+ *         text file.
+ *
+ * --depth <file>
+ *         Print the most rectangles of the text file that cover any one
+ *         point, and such a point.
+ *
+ * --raster <file> <grid> [--size <W>x<H>] [--conservative]
+ *         Render the rectangles of the text file into a grid of counts
+ *         over their bounds, W x H cells (1024 x 1024 by default), and
+ *         write it as a raw raster file. --conservative counts every
+ *         rectangle touching a cell instead of those holding its centre.
+ *
+ * --points <file> <points> [--count]
+ *         For every point of the points file, one "x y" per line, print
+ *         the rectangles of the text file containing it, as one "point
+ *         rectangle" pair per line. With --count, print the number of
+ *         such rectangles for every point instead.
+ *
+ * --rays <file> <rays>
+ *         For every ray of the rays file, one "x y dx dy" per line, print
+ *         the first rectangle of the text file it hits, the ray parameter
+ *         and the point of entry, or "none".
+ *
+ * --polyline <file> <points>
+ *         Print every rectangle of the text file crossed or touched by
+ *         the polyline through the points of the points file, one "x y"
+ *         per line.
+ *
+ * --nearest <file> [<points>] [--k <k>]
+ *         For every point of the points file, print the k rectangles of
+ *         the text file nearest to it (1 by default), nearest first, as
+ *         "point rectangle distance" lines. Without a points file, print
+ *         the k rectangles nearest to every rectangle of the text file.
+ *
+ * --serve <file> <address>
+ *         Load and index the rectangles of the text file once, then
+ *         answer queries from any number of clients until interrupted.
+ *         The address is the path of a Unix socket, or tcp:<port> for a
+ *         port on the loopback address. See QueryServer.h for the protocol.
+ *         Joins run a slice at a time in between other queries; built
+ *         as C++20 they run as coroutines.
+ *
+ * --shards <records> [--workers <n>] [--connect <address>,<address>...] [--timeout <ms>]
+ *         Analyze every pair of rectangles in the record file across
+ *         worker processes, one vertical shard each, and print the pairs
+ *         ordered by record id. n workers are forked (one per core by
+ *         default), or with --connect one shard goes to each worker
+ *         listening at the addresses. Workers send a heartbeat every
+ *         quarter second while they work. One that stays silent for
+ *         over ms milliseconds, 60000 by default and never under 1000,
+ *         has its shard run again on a forked worker.
+ *
+ * --worker <address>
+ *         Serve shards for --shards --connect until interrupted. The
+ *         address is as for --serve, or tcp:<host>:<port> to listen on
+ *         the given IPv4 address. See ShardedAnalyze.h for the protocol.
+ *
+ * --publish <file> <name>
+ *         Publish the rectangles of the text file in shared memory under
+ *         the name, as its next generation, and print the generation.
+ *
+ * --attach <name>
+ *         Attach to the current generation published under the name and
+ *         analyze every pair of its rectangles in place, as for --pairs.
+ *
+ * --unpublish <name>
+ *         Remove the name and its current generation.
+ */
+int BatchMode (int argc, char **argv) {
+
+	std::string command = argv[1];
+	std::vector<const char *> files;
+	unsigned int tiles = 0;
+	std::string order;
+	unsigned int links = LINK_ALL;
+	unsigned int width = 1024, height = 1024;
+	RasterMode mode = sampled;
+	bool count = false;
+	unsigned int neighbours = 1;
+	unsigned long long memory = 1024;
+	std::string temp = "rectangles.tmp";
+	unsigned int deadline = 0;
+	unsigned int workers = 0;
+	unsigned int timeout = 0;
+	std::vector<std::string> addresses;
+
+	for (int i = 2; i < argc; i++) {
+
+		if (strcmp (argv[i], "--quantize") == 0 && i + 1 < argc)
+			tiles = atoi (argv[++i]);
+
+		else if (strcmp (argv[i], "--order") == 0 && i + 1 < argc)
+			order = argv[++i];
+
+		else if (strcmp (argv[i], "--links") == 0 && i + 1 < argc) {
+			const char *list = argv[++i];
+			links = 0;
+
+			if (strstr (list, "adjacent")) links |= LINK_ADJACENT;
+			if (strstr (list, "contain")) links |= LINK_CONTAIN;
+			if (strstr (list, "intersect")) links |= LINK_INTERSECT;
+		}
+
+		else if (strcmp (argv[i], "--size") == 0 && i + 1 < argc) {
+			if (sscanf (argv[++i], "%ux%u", &width, &height) != 2) {
+				std::cerr << "Bad size " << argv[i] << std::endl;
+				return 1;
+			}
+		}
+
+		else if (strcmp (argv[i], "--conservative") == 0)
+			mode = conservative;
+
+		else if (strcmp (argv[i], "--count") == 0)
+			count = true;
+
+		else if (strcmp (argv[i], "--k") == 0 && i + 1 < argc)
+			neighbours = atoi (argv[++i]);
+
+		else if (strcmp (argv[i], "--memory") == 0 && i + 1 < argc)
+			memory = strtoull (argv[++i], NULL, 10);
+
+		else if (strcmp (argv[i], "--temp") == 0 && i + 1 < argc)
+			temp = argv[++i];
+
+		else if (strcmp (argv[i], "--deadline") == 0 && i + 1 < argc)
+			deadline = atoi (argv[++i]);
+
+		else if (strcmp (argv[i], "--workers") == 0 && i + 1 < argc)
+			workers = atoi (argv[++i]);
+
+		else if (strcmp (argv[i], "--timeout") == 0 && i + 1 < argc)
+			timeout = atoi (argv[++i]);
+
+		else if (strcmp (argv[i], "--connect") == 0 && i + 1 < argc) {
+			std::stringstream list (argv[++i]);
+			std::string address;
+
+			while (std::getline (list, address, ','))
+				if (address.empty ( ) == false)
+					addresses.push_back (address);
+		}
+
+		else if (argv[i][0] != '-')
+			files.push_back (argv[i]);
+
+		else {
+			std::cerr << "Unknown option " << argv[i] << std::endl;
+			return 1;
+		}
+	}
+
+	if (command == "--pairs" && files.size ( ) == 1) {
+
+		std::vector<Shape*> shapes;
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		std::vector<PairResult> results;
+		std::vector<unsigned int> perm;
+		CurveOrderedSet ordered;
+		QueryBudget budget (deadline);
+		float complete = 1;
+
+		/* The rectangles are copied in curve order, and the copies analyzed */
+		if (order == "hilbert" || order == "zorder") {
+			ordered.Build (shapes, order == "hilbert" ? hilbert : zorder);
+			FreeRectangles (shapes);
+			shapes = ordered.Shapes ( );
+			perm = ordered.Perm ( );
+		}
+
+		else if (order.empty ( ) == false) {
+			std::cerr << "Unknown order " << order << std::endl;
+			FreeRectangles (shapes);
+			return 1;
+		}
+
+		if (tiles > 0) {
+			std::vector<BoundingBox> boxes;
+			CollectBounds (shapes, boxes);
+			AnalyzeSetQuantized (shapes, UnionBounds (boxes), tiles, tiles, results,
+					deadline ? &budget : NULL, &complete);
+		}
+
+		else
+			AnalyzeSet (shapes, results, deadline ? &budget : NULL, &complete);
+
+		/* Map the pairs back to the positions of the rectangles in the file */
+		for (unsigned int k = 0; k < results.size ( ) && perm.empty ( ) == false; k++) {
+
+			PairResult& res = results[k];
+
+			res.first = perm[res.first];
+			res.second = perm[res.second];
+
+			if (res.first > res.second) {
+				std::swap (res.first, res.second);
+				res.which = 1 - res.which;
+			}
+		}
+
+		PrintPairs (results);
+
+		/* The copies in curve order go with the ordered set */
+		if (order.empty ( ))
+			FreeRectangles (shapes);
+
+		if (complete < 1)
+			std::cerr << "Deadline reached, " << 100 * complete << "% complete" << std::endl;
+
+		return 0;
+	}
+
+	if (command == "--convert" && files.size ( ) == 2)
+		return ConvertRectangles (files[0], files[1]) ? 0 : 1;
+
+	if ((command == "--join" && files.size ( ) == 2) || (command == "--analyze" && files.size ( ) == 1)) {
+
+		PrintSink sink;
+		QueryBudget budget (deadline);
+		float complete;
+		bool ok;
+
+		if (command == "--join")
+			ok = PartitionJoin (files[0], files[1], temp, memory << 20, sink,
+					deadline ? &budget : NULL, &complete);
+		else
+			ok = ExternalAnalyze (files[0], temp, memory << 20, sink,
+					deadline ? &budget : NULL, &complete);
+
+		if (ok && complete < 1)
+			std::cerr << "Deadline reached, " << 100 * complete << "% complete" << std::endl;
+
+		return ok ? 0 : 1;
+	}
+
+	if (command == "--components" && files.size ( ) == 1) {
+
+		std::vector<Shape*> shapes;
+		std::vector<unsigned int> component;
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		ConnectedComponents (shapes, links, component);
+
+		for (unsigned int i = 0; i < component.size ( ); i++)
+			std::cout << i << " " << component[i] << std::endl;
+
+		FreeRectangles (shapes);
+		return 0;
+	}
+
+	if (command == "--nesting" && files.size ( ) == 1) {
+
+		std::vector<Shape*> shapes;
+		std::vector<unsigned int> parent, depth;
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		ContainmentForest (shapes, parent, depth);
+
+		for (unsigned int i = 0; i < parent.size ( ); i++) {
+
+			std::cout << i << " ";
+
+			if (parent[i] == NO_PARENT)
+				std::cout << "none";
+			else
+				std::cout << parent[i];
+
+			std::cout << " " << depth[i] << std::endl;
+		}
+
+		FreeRectangles (shapes);
+		return 0;
+	}
+
+	if (command == "--adjacency" && files.size ( ) == 1) {
+
+		std::vector<Shape*> shapes;
+		AdjacencyGraph graph;
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		BuildAdjacencyGraph (shapes, graph);
+
+		std::cout << shapes.size ( ) << " " << graph.neighbours.size ( ) << std::endl;
+
+		for (unsigned int i = 0; i < graph.offsets.size ( ); i++)
+			std::cout << (i ? " " : "") << graph.offsets[i];
+
+		std::cout << std::endl;
+
+		for (unsigned int k = 0; k < graph.neighbours.size ( ); k++)
+			std::cout << (k ? " " : "") << graph.neighbours[k];
+
+		std::cout << std::endl;
+
+		for (unsigned int k = 0; k < graph.lengths.size ( ); k++)
+			std::cout << (k ? " " : "") << graph.lengths[k];
+
+		std::cout << std::endl;
+
+		FreeRectangles (shapes);
+		return 0;
+	}
+
+	if (command == "--area" && files.size ( ) == 1) {
+
+		std::vector<Shape*> shapes;
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		std::cout.precision (12);
+		std::cout << UnionArea (shapes) << std::endl;
+
+		FreeRectangles (shapes);
+		return 0;
+	}
+
+	if (command == "--depth" && files.size ( ) == 1) {
+
+		std::vector<Shape*> shapes;
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		DeepestPoint best = MaxOverlapDepth (shapes);
+		std::cout << best.depth << " " << best.x << " " << best.y << std::endl;
+
+		FreeRectangles (shapes);
+		return 0;
+	}
+
+	if (command == "--raster" && files.size ( ) == 2) {
+
+		std::vector<Shape*> shapes;
+		std::vector<BoundingBox> boxes;
+		RasterGrid grid;
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		CollectBounds (shapes, boxes);
+		Rasterize (shapes, UnionBounds (boxes), width, height, mode, grid);
+
+		bool ok = WriteRaster (files[1], grid);
+
+		FreeRectangles (shapes);
+		return ok ? 0 : 1;
+	}
+
+	if (command == "--points" && files.size ( ) == 2) {
+
+		std::vector<Shape*> shapes;
+		std::vector<float> xy;
+		std::ifstream in (files[1]);
+		float x, y;
+
+		if (in.is_open ( ) == false) {
+			std::cerr << "Cannot open " << files[1] << std::endl;
+			return 1;
+		}
+
+		while (in >> x >> y) {
+			xy.push_back (x);
+			xy.push_back (y);
+		}
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		{
+			PointLocator locator (shapes);
+			unsigned int n = xy.size ( ) / 2;
+
+			if (count) {
+				std::vector<unsigned int> counts (n);
+				locator.Count (xy.data ( ), n, counts.data ( ));
+
+				for (unsigned int i = 0; i < n; i++)
+					std::cout << i << " " << counts[i] << std::endl;
+			}
+
+			else {
+				HitSink sink;
+				locator.Hits (xy.data ( ), n, 0, sink);
+				std::sort (sink.mHits.begin ( ), sink.mHits.end ( ));
+
+				for (unsigned int k = 0; k < sink.mHits.size ( ); k++)
+					std::cout << sink.mHits[k].first << " " << sink.mHits[k].second << std::endl;
+			}
+		}
+
+		FreeRectangles (shapes);
+		return 0;
+	}
+
+	if (command == "--rays" && files.size ( ) == 2) {
+
+		std::vector<Shape*> shapes;
+		std::vector<Ray> rays;
+		std::vector<RayHit> hits;
+		std::ifstream in (files[1]);
+		Ray ray;
+
+		if (in.is_open ( ) == false) {
+			std::cerr << "Cannot open " << files[1] << std::endl;
+			return 1;
+		}
+
+		ray.tmax = FLT_MAX;
+
+		while (in >> ray.x >> ray.y >> ray.dx >> ray.dy)
+			rays.push_back (ray);
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		{
+			RayCaster caster (shapes);
+			caster.FirstHits (rays, hits);
+		}
+
+		for (unsigned int i = 0; i < hits.size ( ); i++) {
+			if (hits[i].object == NO_HIT)
+				std::cout << i << " none" << std::endl;
+			else
+				std::cout << i << " " << hits[i].object << " " << hits[i].t << " "
+						<< hits[i].x << " " << hits[i].y << std::endl;
+		}
+
+		FreeRectangles (shapes);
+		return 0;
+	}
+
+	if (command == "--polyline" && files.size ( ) == 2) {
+
+		std::vector<Shape*> shapes;
+		std::vector<float> xy;
+		std::vector<unsigned int> crossed;
+		std::ifstream in (files[1]);
+		float x, y;
+
+		if (in.is_open ( ) == false) {
+			std::cerr << "Cannot open " << files[1] << std::endl;
+			return 1;
+		}
+
+		while (in >> x >> y) {
+			xy.push_back (x);
+			xy.push_back (y);
+		}
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		{
+			RayCaster caster (shapes);
+			caster.CrossedByPolyline (xy.data ( ), xy.size ( ) / 2, crossed);
+		}
+
+		for (unsigned int k = 0; k < crossed.size ( ); k++)
+			std::cout << crossed[k] << std::endl;
+
+		FreeRectangles (shapes);
+		return 0;
+	}
+
+	if (command == "--nearest" && (files.size ( ) == 1 || files.size ( ) == 2)) {
+
+		std::vector<Shape*> shapes;
+		std::vector<float> xy;
+		std::vector<Neighbour> found;
+
+		if (files.size ( ) == 2) {
+
+			std::ifstream in (files[1]);
+			float x, y;
+
+			if (in.is_open ( ) == false) {
+				std::cerr << "Cannot open " << files[1] << std::endl;
+				return 1;
+			}
+
+			while (in >> x >> y) {
+				xy.push_back (x);
+				xy.push_back (y);
+			}
+		}
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		{
+			NearestIndex index (shapes);
+			unsigned int n = (files.size ( ) == 2) ? xy.size ( ) / 2 : shapes.size ( );
+
+			if (files.size ( ) == 2)
+				index.NearestAll (xy.data ( ), n, neighbours, found);
+
+			else {
+				NearestQueue queue;
+				std::vector<Neighbour> nearest;
+				Neighbour none = { NO_NEIGHBOUR, HUGE_VALF };
+
+				found.assign ((size_t) n * neighbours, none);
+
+				for (unsigned int i = 0; i < n; i++) {
+					index.Nearest (ShapeTarget (*shapes[i]), neighbours, nearest, queue, i);
+					std::copy (nearest.begin ( ), nearest.end ( ), found.begin ( ) + (size_t) i * neighbours);
+				}
+			}
+
+			for (unsigned int i = 0; i < n; i++)
+				for (unsigned int j = 0; j < neighbours; j++) {
+					const Neighbour& nb = found[(size_t) i * neighbours + j];
+
+					if (nb.object != NO_NEIGHBOUR)
+						std::cout << i << " " << nb.object << " " << nb.distance << std::endl;
+				}
+		}
+
+		FreeRectangles (shapes);
+		return 0;
+	}
+
+	if (command == "--serve" && files.size ( ) == 2) {
+#ifdef __linux__
+		std::vector<Shape*> shapes;
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		bool ok;
+
+		{
+			QueryServer server (shapes, MakeRectangle);
+
+			ok = server.Listen (files[1]);
+
+			if (ok)
+				server.Run ( );
+		}
+
+		FreeRectangles (shapes);
+		return ok ? 0 : 1;
+#else
+		std::cerr << "The server needs Linux." << std::endl;
+		return 1;
+#endif
+	}
+
+	if (command == "--shards" && files.size ( ) == 1) {
+#ifdef __linux__
+		std::vector<PairResult> results;
+
+		if (workers == 0)
+			workers = std::max (1u, std::thread::hardware_concurrency ( ));
+
+		if (ShardedAnalyze (files[0], addresses, workers, results, timeout ? timeout : SHARD_TIMEOUT) == false)
+			return 1;
+
+		PrintPairs (results);
+		return 0;
+#else
+		std::cerr << "Sharding needs Linux." << std::endl;
+		return 1;
+#endif
+	}
+
+	if (command == "--publish" && files.size ( ) == 2) {
+#ifdef __linux__
+		std::vector<Shape*> shapes;
+		unsigned long long generation;
+
+		if (LoadRectangles (files[0], shapes) == false)
+			return 1;
+
+		bool ok = PublishShapes (files[1], shapes, &generation);
+
+		if (ok)
+			std::cout << generation << std::endl;
+
+		FreeRectangles (shapes);
+		return ok ? 0 : 1;
+#else
+		std::cerr << "Shared sets need Linux." << std::endl;
+		return 1;
+#endif
+	}
+
+	if (command == "--attach" && files.size ( ) == 1) {
+#ifdef __linux__
+		SharedShapeSet set;
+
+		if (set.Attach (files[0]) == false)
+			return 1;
+
+		std::vector<Shape*> shapes = set.Shapes ( );
+		std::vector<PairResult> results;
+
+		AnalyzeSet (shapes, results);
+		PrintPairs (results);
+		return 0;
+#else
+		std::cerr << "Shared sets need Linux." << std::endl;
+		return 1;
+#endif
+	}
+
+	if (command == "--unpublish" && files.size ( ) == 1) {
+#ifdef __linux__
+		UnpublishShapes (files[0]);
+		return 0;
+#else
+		std::cerr << "Shared sets need Linux." << std::endl;
+		return 1;
+#endif
+	}
+
+	if (command == "--worker" && files.size ( ) == 1) {
+#ifdef __linux__
+		return RunShardWorker (files[0]) ? 0 : 1;
+#else
+		std::cerr << "Sharding needs Linux." << std::endl;
+		return 1;
+#endif
+	}
+
+	std::cerr << "Unknown command or wrong number of files." << std::endl;
+	return 1;
+}
+
 int main (int argc, char **argv) {
+
+	if (argc > 1)
+		return BatchMode (argc, argv);
+
 	WelcomeScreen( );
 	return 0;
 }
@@ -0,0 +1,210 @@
+/*============================================================================
+ Name        : DistanceJoin.h
+ Author      : Nitin Puranik
+ Description : Finds every pair of objects from two sets that are closer
+ 	 	 	   than a given distance, overlapping pairs included. This is
+ 	 	 	   the spacing check of design rule checking. The work is split
+ 	 	 	   into vertical strips that are joined in parallel, and the
+ 	 	 	   pairs are streamed out in batches as they are found.
+ ============================================================================*/
+
+#ifndef DISTANCEJOIN_H
+#define DISTANCEJOIN_H
+
+#include <mutex>
+#include <thread>
+#include "BroadPhase.h"
+#include "ShapeDistance.h"
+#include "QueryBudget.h"
+
+/* A pair found by a join: a position in the first set and one in the second */
+typedef std::pair<unsigned int, unsigned int> JoinPair;
+
+/* Number of pairs a worker gathers before handing them to the sink */
+#define JOIN_BATCH 4096
+
+/* Strips per thread when the join runs on a budget, so that it can stop in between */
+#define JOIN_STRIPS 64
+
+/*
+ * Deals the boxes out to the strips they meet, a strip [lo, hi) holding
+ * every box with xmax >= lo and xmin < hi. Each box costs two binary
+ * searches, however many strips there are. A box spanning several
+ * strips goes to each of them.
+ */
+void BucketStrips (const std::vector<BoundingBox>& boxes, const std::vector<float>& bounds,
+		std::vector<std::vector<unsigned int> >& buckets) {
+
+	buckets.assign (bounds.size ( ) - 1, std::vector<unsigned int> ( ));
+
+	for (unsigned int i = 0; i < boxes.size ( ); i++) {
+
+		unsigned int first = std::upper_bound (bounds.begin ( ) + 1, bounds.end ( ), boxes[i].xmin) - bounds.begin ( ) - 1;
+		unsigned int last = std::upper_bound (bounds.begin ( ), bounds.end ( ), boxes[i].xmax) - bounds.begin ( ) - 1;
+
+		for (unsigned int s = first; s <= last && s < buckets.size ( ); s++)
+			buckets[s].push_back (i);
+	}
+}
+
+/*
+ * Joins the boxes of one strip. A pair of boxes that overlap is seen in
+ * every strip their overlap spans, so it is only reported by the strip
+ * that holds the left edge of the overlap, the reference point.
+ */
+template <class Sink>
+struct StripJoin {
+	const std::vector<Shape*>& mA;
+	const std::vector<Shape*>& mB;
+	float mDist;
+	float mLo, mHi;
+	Sink& mSink;
+	std::mutex& mLock;
+
+	std::vector<BoundingBox> mBoxA, mBoxB;
+	std::vector<unsigned int> mIdA, mIdB;
+	std::vector<JoinPair> mFound;
+
+	StripJoin (const std::vector<Shape*>& A, const std::vector<Shape*>& B, float d,
+			float lo, float hi, Sink& sink, std::mutex& lock)
+		: mA (A), mB (B), mDist (d), mLo (lo), mHi (hi), mSink (sink), mLock (lock) { }
+
+	void Flush ( ) {
+		if (mFound.empty ( ))
+			return;
+
+		std::lock_guard<std::mutex> guard (mLock);
+		mSink (mFound);
+		mFound.clear ( );
+	}
+
+	void operator() (unsigned int i, unsigned int j) {
+
+		float ref = std::max (mBoxA[i].xmin, mBoxB[j].xmin);
+
+		if (ref < mLo || ref >= mHi)
+			return;
+
+		if (WithinDistance (*mA[mIdA[i]], *mB[mIdB[j]], mDist) == false)
+			return;
+
+		mFound.push_back (JoinPair (mIdA[i], mIdB[j]));
+
+		if (mFound.size ( ) >= JOIN_BATCH)
+			Flush ( );
+	}
+
+	/* Joins the boxes the strip was dealt by BucketStrips */
+	void Run (const std::vector<BoundingBox>& boxA, const std::vector<BoundingBox>& boxB,
+			const std::vector<unsigned int>& idA, const std::vector<unsigned int>& idB) {
+
+		mIdA = idA;
+		mIdB = idB;
+		mBoxA.resize (idA.size ( ));
+		mBoxB.resize (idB.size ( ));
+
+		for (unsigned int i = 0; i < idA.size ( ); i++)
+			mBoxA[i] = boxA[idA[i]];
+
+		for (unsigned int j = 0; j < idB.size ( ); j++)
+			mBoxB[j] = boxB[idB[j]];
+
+		SweepAndPrune (mBoxA, mBoxB, *this);
+		Flush ( );
+	}
+};
+
+/*
+ * Reports every pair A[i], B[j] that lies within distance d of each
+ * other. The boxes of A are grown by d so that the broad phase keeps
+ * every pair that can be that close, and the candidates are refined
+ * with WithinDistance. The sink is called with batches of pairs as
+ * sink (const std::vector<JoinPair>&), one call at a time, from the
+ * worker threads.
+ *
+ * With a budget the axis is cut into more strips than threads, and the
+ * workers look at the budget before taking the next one. Once it runs
+ * out the join stops with the pairs of the strips done so far, and
+ * complete receives the share of the strips that were joined.
+ */
+template <class Sink>
+void DistanceJoin (const std::vector<Shape*>& A, const std::vector<Shape*>& B, float d,
+		Sink& sink, unsigned int threads = 0, QueryBudget *budget = NULL, float *complete = NULL) {
+
+	if (threads == 0)
+		threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+	std::vector<BoundingBox> boxA, boxB;
+
+	CollectBounds (A, boxA);
+	CollectBounds (B, boxB);
+
+	for (unsigned int i = 0; i < boxA.size ( ); i++) {
+		boxA[i].xmin -= d;
+		boxA[i].ymin -= d;
+		boxA[i].xmax += d;
+		boxA[i].ymax += d;
+	}
+
+	std::vector<float> bounds;
+	std::vector<std::vector<unsigned int> > bucketA, bucketB;
+
+	StripBounds (boxA, boxB, budget ? threads * JOIN_STRIPS : threads, bounds);
+	BucketStrips (boxA, bounds, bucketA);
+	BucketStrips (boxB, bounds, bucketB);
+
+	/* The strips not yet taken, and those joined */
+	struct Strips {
+		const std::vector<Shape*>& mA;
+		const std::vector<Shape*>& mB;
+		float mDist;
+		const std::vector<BoundingBox>& mBoxA;
+		const std::vector<BoundingBox>& mBoxB;
+		const std::vector<float>& mBounds;
+		const std::vector<std::vector<unsigned int> >& mBucketA;
+		const std::vector<std::vector<unsigned int> >& mBucketB;
+		Sink& mSink;
+		QueryBudget *mBudget;
+
+		std::mutex mLock;
+		std::atomic<unsigned int> mNext, mDone;
+
+		Strips (const std::vector<Shape*>& A, const std::vector<Shape*>& B, float d,
+				const std::vector<BoundingBox>& boxA, const std::vector<BoundingBox>& boxB,
+				const std::vector<float>& bounds, const std::vector<std::vector<unsigned int> >& bucketA,
+				const std::vector<std::vector<unsigned int> >& bucketB, Sink& sink, QueryBudget *budget)
+			: mA (A), mB (B), mDist (d), mBoxA (boxA), mBoxB (boxB), mBounds (bounds),
+			  mBucketA (bucketA), mBucketB (bucketB), mSink (sink), mBudget (budget), mNext (0), mDone (0) { }
+	} strips (A, B, d, boxA, boxB, bounds, bucketA, bucketB, sink, budget);
+
+	struct Worker {
+		static void Run (Strips *strips) {
+
+			while (BudgetExpired (strips->mBudget) == false) {
+
+				unsigned int s = strips->mNext++;
+
+				if (s + 1 >= strips->mBounds.size ( ))
+					return;
+
+				StripJoin<Sink> strip (strips->mA, strips->mB, strips->mDist, strips->mBounds[s],
+						strips->mBounds[s + 1], strips->mSink, strips->mLock);
+
+				strip.Run (strips->mBoxA, strips->mBoxB, strips->mBucketA[s], strips->mBucketB[s]);
+				strips->mDone++;
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+
+	for (unsigned int t = 0; t < threads; t++)
+		pool.push_back (std::thread (Worker::Run, &strips));
+
+	for (unsigned int t = 0; t < threads; t++)
+		pool[t].join ( );
+
+	ReportComplete (complete, strips.mDone, bounds.size ( ) - 1);
+}
+
+#endif /* DISTANCEJOIN_H */
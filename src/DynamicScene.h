@@ -0,0 +1,349 @@
+/*============================================================================
+ Name        : DynamicScene.h
+ Author      : Nitin Puranik
+ Description : A scene of objects that are inserted, moved and removed over
+ 	 	 	   time. The scene keeps the set of touching pairs up to date
+ 	 	 	   incrementally and reports what changed since the last tick,
+ 	 	 	   instead of analyzing every pair again from scratch.
+ ============================================================================*/
+
+#ifndef DYNAMICSCENE_H
+#define DYNAMICSCENE_H
+
+#include <cmath>
+#include <unordered_map>
+#include "BroadPhase.h"
+#include "SeparatingAxisCache.h"
+
+/* The changes to the touching pairs since the last tick */
+struct SceneDelta {
+
+	/* Pairs that started touching */
+	std::vector<PairResult> added;
+
+	/*
+	 * Pairs that stopped touching. The type is the one they had at the
+	 * start of the tick, the last one reported, whatever they went
+	 * through during the tick before they parted.
+	 */
+	std::vector<PairResult> ended;
+
+	/* Pairs that still touch but changed their type */
+	std::vector<PairResult> changed;
+};
+
+class DynamicScene {
+private:
+
+	/* An object of the scene along with the grid cells it covers */
+	struct Entry {
+		Shape *shape;
+		BoundingBox box;
+		int cx0, cy0, cx1, cy1;
+		std::vector<unsigned int> partners;
+	};
+
+	/* The side length of one cell of the uniform grid */
+	float mCellSize;
+
+	/*
+	 * The objects by id. Erased ids have a null shape and are reused,
+	 * but only from the next tick on so that the deltas of one tick
+	 * never mix up two different objects.
+	 */
+	std::vector<Entry> mEntries;
+	std::vector<unsigned int> mFreeIds;
+	std::vector<unsigned int> mErasedIds;
+
+	/* The uniform grid that finds the neighbours of an object */
+	std::unordered_map<unsigned long long, std::vector<unsigned int> > mGrid;
+
+	/* The pairs that currently touch, keyed by PairKey */
+	std::unordered_map<unsigned long long, PairResult> mPairs;
+
+	/*
+	 * The pairs touched during the current tick along with their state
+	 * at the start of the tick. A pair whose type is apart did not touch.
+	 */
+	std::unordered_map<unsigned long long, PairResult> mDirty;
+
+	/* Neighbours that stay apart tick after tick are settled from here */
+	SeparatingAxisCache mAxisCache;
+
+	static unsigned long long PairKey (unsigned int a, unsigned int b) {
+		return ((unsigned long long) a << 32) | b;
+	}
+
+	static unsigned long long CellKey (int cx, int cy) {
+		return ((unsigned long long) (unsigned int) cx << 32) | (unsigned int) cy;
+	}
+
+	int Cell (float v) const { return (int) std::floor (v / mCellSize); }
+
+	void AddToGrid (unsigned int id);
+	void RemoveFromGrid (unsigned int id);
+	void Touch (unsigned int a, unsigned int b);
+	void SetPair (unsigned int a, unsigned int b);
+	void DropPair (unsigned int a, unsigned int b);
+	void Refresh (unsigned int id);
+
+public:
+	/*
+	 * The cell size should be around the size of a typical object.
+	 * Much smaller cells make large objects cover many cells, much
+	 * larger cells put too many objects in one cell.
+	 */
+	DynamicScene (float cellSize) : mCellSize (cellSize > 0 ? cellSize : 1) { }
+
+	~DynamicScene ( );
+
+	/* Adds a convex object with the given points and returns its id */
+	unsigned int Insert (unsigned int numSides, const float *points);
+
+	/* Removes the object. All its pairs end. */
+	void Erase (unsigned int id);
+
+	/* Moves the object to its new points */
+	void Update (unsigned int id, const float *points);
+
+	/* The pairs that touch right now */
+	const std::unordered_map<unsigned long long, PairResult>& Pairs ( ) const { return mPairs; }
+
+	/* Reports the changes since the last call and starts a new tick */
+	void TakeDelta (SceneDelta& delta);
+};
+
+DynamicScene::~DynamicScene ( ) {
+	for (unsigned int i = 0; i < mEntries.size ( ); i++)
+		delete mEntries[i].shape;
+}
+
+/* Registers the object in every grid cell its box covers */
+void DynamicScene::AddToGrid (unsigned int id) {
+
+	Entry& e = mEntries[id];
+
+	e.box = e.shape->Bounds ( );
+	e.cx0 = Cell (e.box.xmin);
+	e.cy0 = Cell (e.box.ymin);
+	e.cx1 = Cell (e.box.xmax);
+	e.cy1 = Cell (e.box.ymax);
+
+	for (int cx = e.cx0; cx <= e.cx1; cx++)
+		for (int cy = e.cy0; cy <= e.cy1; cy++)
+			mGrid[CellKey (cx, cy)].push_back (id);
+}
+
+void DynamicScene::RemoveFromGrid (unsigned int id) {
+
+	Entry& e = mEntries[id];
+
+	for (int cx = e.cx0; cx <= e.cx1; cx++) {
+		for (int cy = e.cy0; cy <= e.cy1; cy++) {
+
+			std::unordered_map<unsigned long long, std::vector<unsigned int> >::iterator
+				it = mGrid.find (CellKey (cx, cy));
+			std::vector<unsigned int>& cell = it->second;
+
+			cell.erase (std::find (cell.begin ( ), cell.end ( ), id));
+
+			if (cell.empty ( ))
+				mGrid.erase (it);
+		}
+	}
+}
+
+/* Remembers the state of the pair at the start of the tick */
+void DynamicScene::Touch (unsigned int a, unsigned int b) {
+
+	unsigned long long key = PairKey (a, b);
+
+	if (mDirty.count (key))
+		return;
+
+	std::unordered_map<unsigned long long, PairResult>::iterator it = mPairs.find (key);
+
+	if (it != mPairs.end ( ))
+		mDirty[key] = it->second;
+
+	else {
+		PairResult res;
+		res.first = a;
+		res.second = b;
+		res.type = apart;
+		res.which = 0;
+		mDirty[key] = res;
+	}
+}
+
+/* Analyzes the pair a, b with a < b and records the outcome */
+void DynamicScene::SetPair (unsigned int a, unsigned int b) {
+
+	PairResult res;
+
+	res.first = a;
+	res.second = b;
+	res.type = mAxisCache.ProcessData (a, *mEntries[a].shape, b, *mEntries[b].shape, &res.which);
+
+	unsigned long long key = PairKey (a, b);
+	std::unordered_map<unsigned long long, PairResult>::iterator it = mPairs.find (key);
+
+	if (res.type == apart) {
+		if (it != mPairs.end ( ))
+			DropPair (a, b);
+		return;
+	}
+
+	if (it == mPairs.end ( )) {
+		Touch (a, b);
+		mPairs[key] = res;
+		mEntries[a].partners.push_back (b);
+		mEntries[b].partners.push_back (a);
+	}
+
+	else if (it->second.type != res.type || it->second.which != res.which) {
+		Touch (a, b);
+		it->second = res;
+	}
+}
+
+/* Forgets the pair a, b with a < b */
+void DynamicScene::DropPair (unsigned int a, unsigned int b) {
+
+	std::vector<unsigned int>& pa = mEntries[a].partners;
+	std::vector<unsigned int>& pb = mEntries[b].partners;
+
+	Touch (a, b);
+	mPairs.erase (PairKey (a, b));
+
+	pa.erase (std::find (pa.begin ( ), pa.end ( ), b));
+	pb.erase (std::find (pb.begin ( ), pb.end ( ), a));
+}
+
+/*
+ * Analyzes the object against its neighbours in the grid. Former
+ * partners that are no longer neighbours are dropped without
+ * running the analyzer at all.
+ */
+void DynamicScene::Refresh (unsigned int id) {
+
+	Entry& e = mEntries[id];
+	std::vector<unsigned int> near;
+
+	for (int cx = e.cx0; cx <= e.cx1; cx++) {
+		for (int cy = e.cy0; cy <= e.cy1; cy++) {
+
+			const std::vector<unsigned int>& cell = mGrid[CellKey (cx, cy)];
+
+			for (unsigned int k = 0; k < cell.size ( ); k++) {
+
+				const BoundingBox& b = mEntries[cell[k]].box;
+
+				if (cell[k] != id && e.box.xmin <= b.xmax && b.xmin <= e.box.xmax &&
+						OverlapY (e.box, b))
+					near.push_back (cell[k]);
+			}
+		}
+	}
+
+	/* Objects sharing several cells show up more than once */
+	std::sort (near.begin ( ), near.end ( ));
+	near.erase (std::unique (near.begin ( ), near.end ( )), near.end ( ));
+
+	std::vector<unsigned int> old (e.partners);
+
+	for (unsigned int k = 0; k < old.size ( ); k++)
+		if (std::binary_search (near.begin ( ), near.end ( ), old[k]) == false)
+			DropPair (std::min (id, old[k]), std::max (id, old[k]));
+
+	for (unsigned int k = 0; k < near.size ( ); k++)
+		SetPair (std::min (id, near[k]), std::max (id, near[k]));
+}
+
+unsigned int DynamicScene::Insert (unsigned int numSides, const float *points) {
+
+	unsigned int id;
+
+	if (mFreeIds.empty ( )) {
+		id = mEntries.size ( );
+		mEntries.push_back (Entry ( ));
+	}
+
+	else {
+		id = mFreeIds.back ( );
+		mFreeIds.pop_back ( );
+	}
+
+	mEntries[id].shape = new Shape (numSides, points);
+	mEntries[id].partners.clear ( );
+
+	AddToGrid (id);
+	Refresh (id);
+
+	return id;
+}
+
+void DynamicScene::Erase (unsigned int id) {
+
+	Entry& e = mEntries[id];
+
+	while (e.partners.empty ( ) == false) {
+		unsigned int other = e.partners.back ( );
+		DropPair (std::min (id, other), std::max (id, other));
+	}
+
+	RemoveFromGrid (id);
+
+	delete e.shape;
+	e.shape = NULL;
+
+	mErasedIds.push_back (id);
+}
+
+void DynamicScene::Update (unsigned int id, const float *points) {
+
+	RemoveFromGrid (id);
+	mEntries[id].shape->SetPoints (points);
+	AddToGrid (id);
+
+	Refresh (id);
+}
+
+/*
+ * Compares every pair touched during the tick with its state at the
+ * start of the tick. A pair that started and ended within the same
+ * tick is not reported at all.
+ */
+void DynamicScene::TakeDelta (SceneDelta& delta) {
+
+	delta.added.clear ( );
+	delta.ended.clear ( );
+	delta.changed.clear ( );
+
+	std::unordered_map<unsigned long long, PairResult>::const_iterator it = mDirty.begin ( );
+
+	for (; it != mDirty.end ( ); it++) {
+
+		const PairResult& before = it->second;
+		std::unordered_map<unsigned long long, PairResult>::const_iterator
+			now = mPairs.find (it->first);
+
+		if (now == mPairs.end ( )) {
+			if (before.type != apart)
+				delta.ended.push_back (before);
+		}
+
+		else if (before.type == apart)
+			delta.added.push_back (now->second);
+
+		else if (before.type != now->second.type || before.which != now->second.which)
+			delta.changed.push_back (now->second);
+	}
+
+	mDirty.clear ( );
+
+	mFreeIds.insert (mFreeIds.end ( ), mErasedIds.begin ( ), mErasedIds.end ( ));
+	mErasedIds.clear ( );
+}
+
+#endif /* DYNAMICSCENE_H */
@@ -0,0 +1,232 @@
+/*============================================================================
+ Name        : ExternalAnalyze.h
+ Author      : Nitin Puranik
+ Description : Analyzes every pair of a record file that does not fit in
+ 	 	 	   memory. The file is cut into chunks that are compact along a
+ 	 	 	   space filling curve and hold about the same number of records.
+ 	 	 	   Only two chunks are in memory at a time: the one being
+ 	 	 	   analyzed and the next one, which is read in the background.
+ ============================================================================*/
+
+#ifndef EXTERNALANALYZE_H
+#define EXTERNALANALYZE_H
+
+#include <future>
+#include "PartitionJoin.h"
+
+/*
+ * The analysis of one chunk. As with the join, a pair of records that
+ * spans several chunks is only reported by the chunk owning the lower
+ * left corner of the overlap of their boxes.
+ */
+template <class Sink>
+struct ChunkRefine {
+	const OwnerChain& mOwners;
+	Sink& mSink;
+
+	const std::vector<ShapeRecord>& mRecs;
+	std::vector<Shape*> mShapes;
+	std::vector<BoundingBox> mBoxes;
+	std::vector<PairResult> mFound;
+
+	ChunkRefine (const OwnerChain& owners, const std::vector<ShapeRecord>& recs, Sink& sink)
+		: mOwners (owners), mSink (sink), mRecs (recs) {
+		BuildShapes (recs, mShapes, mBoxes);
+	}
+
+	~ChunkRefine ( ) {
+		FreeShapes (mShapes);
+	}
+
+	void operator() (unsigned int i, unsigned int j) {
+
+		float rx = std::max (mBoxes[i].xmin, mBoxes[j].xmin);
+		float ry = std::max (mBoxes[i].ymin, mBoxes[j].ymin);
+
+		if (mOwners.Owns (rx, ry) == false)
+			return;
+
+		/* Report each pair with the smaller record id first */
+		if (mRecs[i].id > mRecs[j].id)
+			std::swap (i, j);
+
+		PairResult res;
+
+		res.first = mRecs[i].id;
+		res.second = mRecs[j].id;
+		res.type = ProcessData (*mShapes[i], *mShapes[j], &res.which);
+
+		if (res.type != apart)
+			mFound.push_back (res);
+
+		if (mFound.size ( ) >= PARTITION_BATCH)
+			Flush ( );
+	}
+
+	void Flush ( ) {
+		if (mFound.empty ( ) == false)
+			mSink (mFound);
+		mFound.clear ( );
+	}
+
+	/* Returns the share of the records swept, all of whose pairs have been reported */
+	double Run (QueryBudget *budget) {
+
+		unsigned int swept = SweepAndPrune (mBoxes, *this, budget);
+
+		Flush ( );
+		return mBoxes.empty ( ) ? 1 : (double) swept / mBoxes.size ( );
+	}
+};
+
+/* Reads a run file in the background */
+bool PrefetchRun (std::string path, std::vector<ShapeRecord> *recs) {
+	return LoadRecords (path.c_str ( ), *recs);
+}
+
+/*
+ * Analyzes the records of a file: the input at the top, the run of a
+ * chunk below it. The records are spilled to chunks along the curve,
+ * and every chunk that fits half the memory budget is analyzed in
+ * memory while the next one is read. One that does not, because its
+ * records crowd a single tile, is cut again over just its own tiles,
+ * into tiles that are that much finer, even if it kept all the records
+ * as long as the tiles get finer. Records that no cut spreads out, like
+ * ones all overlapping a single point, fail the analysis.
+ *
+ * The budget, if any, is looked at every BUDGET_RECORDS records read,
+ * before every chunk and while it is swept. share receives the share
+ * of the work done before it ran out: for every chunk, of its records,
+ * those swept, weighted by how many records it has.
+ */
+template <class Sink>
+bool AnalyzeRuns (const char *path, const std::string& prefix, unsigned long long memoryBudget,
+		OwnerChain& owners, Sink& sink, QueryBudget *budget, double *share) {
+
+	BoundingBox world;
+	unsigned long long count;
+
+	*share = 0;
+
+	if (ScanRecords (path, world, &count, budget) == false)
+		return false;
+
+	if (BudgetExpired (budget))
+		return true;
+
+	if (count == 0) {
+		*share = 1;
+		return true;
+	}
+
+	owners.Clip (world);
+
+	unsigned long long chunkBudget = memoryBudget / 2;
+	PartitionPlan plan = PlanPartitions (world, count, chunkBudget, SpillFanout (memoryBudget),
+			owners.Levels ( ));
+	std::vector<unsigned long long> runs;
+
+	if (PlanCurvePartitions (plan, path, NULL, budget) == false ||
+			SpillRecords (path, plan, prefix, &runs, budget) == false) {
+		RemoveRuns (plan, prefix);
+		return false;
+	}
+
+	bool ok = true;
+	std::vector<ShapeRecord> current, next;
+	std::future<bool> pending;
+	double records = 0, done = 0;
+
+	for (unsigned int p = 0; p < plan.partitions; p++)
+		records += runs[p];
+
+	for (unsigned int p = 0; ok && p < plan.partitions && BudgetExpired (budget) == false; p++) {
+
+		std::string run = RunName (prefix, p);
+		double part = 0;
+
+		owners.Push (plan, p);
+
+		if (runs[p] * RECORD_MEMORY <= chunkBudget) {
+
+			/* The chunk was read in the background unless the one before was too large */
+			ok = pending.valid ( ) ? pending.get ( ) : LoadRecords (run.c_str ( ), next);
+			current.swap (next);
+			next.clear ( );
+
+			/* Start reading the next chunk before working on this one */
+			if (p + 1 < plan.partitions && runs[p + 1] * RECORD_MEMORY <= chunkBudget)
+				pending = std::async (std::launch::async, PrefetchRun, RunName (prefix, p + 1), &next);
+
+			if (ok) {
+				ChunkRefine<Sink> refine (owners, current, sink);
+				part = refine.Run (budget);
+			}
+
+			/* Give the memory of the chunk back before the next one comes in */
+			std::vector<ShapeRecord> ( ).swap (current);
+		}
+
+		else if ((runs[p] < count || plan.CanCutFiner ( )) && owners.Levels ( ) <= PARTITION_LEVELS) {
+
+			ok = AnalyzeRuns (run.c_str ( ), run, memoryBudget, owners, sink, budget, &part);
+
+		}
+
+		else {
+			std::cerr << "Cannot cut the records down to the memory budget" << std::endl;
+			ok = false;
+		}
+
+		owners.Pop ( );
+		done += runs[p] * part;
+	}
+
+	/* The chunk being read must land before its buffer goes away */
+	if (pending.valid ( ))
+		ok = pending.get ( ) && ok;
+
+	RemoveRuns (plan, prefix);
+
+	*share = records > 0 ? done / records : 1;
+	return ok;
+}
+
+/*
+ * Analyzes every pair of records in the file and reports the pairs that
+ * are not apart, by record id. The memory budget in bytes covers the two
+ * chunks that are in memory at once, and the buffers of the run files
+ * being written. When it is small, the same work is simply done in more
+ * and smaller chunks. The sink is called with up to PARTITION_BATCH
+ * pairs at a time as sink (const std::vector<PairResult>&). Returns
+ * false on an I/O error, or when the budget cannot be met.
+ *
+ * The budget, if any, is looked at before every chunk, while the
+ * records are read and spilled, and while a chunk is swept. Once it
+ * runs out the analysis stops with the pairs found so far, and complete
+ * receives the share of the records of the chunks that were swept, all
+ * of whose pairs have been reported.
+ */
+template <class Sink>
+bool ExternalAnalyze (const char *path, const std::string& tempPrefix,
+		unsigned long long memoryBudget, Sink& sink, QueryBudget *budget = NULL, float *complete = NULL) {
+
+	ReportComplete (complete, 0, 1);
+
+	if (SpillFanout (memoryBudget) < 2) {
+		std::cerr << "The memory budget is too small to spill the records" << std::endl;
+		return false;
+	}
+
+	OwnerChain owners;
+	double share;
+
+	bool ok = AnalyzeRuns (path, tempPrefix, memoryBudget, owners, sink, budget, &share);
+
+	if (ok && complete != NULL)
+		*complete = (float) share;
+
+	return ok;
+}
+
+#endif /* EXTERNALANALYZE_H */
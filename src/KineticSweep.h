@@ -0,0 +1,296 @@
+/*============================================================================
+ Name        : KineticSweep.h
+ Author      : Nitin Puranik
+ Description : A sweep and prune that lives across time steps. The sorted
+ 	 	 	   lists of box end points are kept from one step to the next
+ 	 	 	   and repaired with insertion sort, which is close to linear
+ 	 	 	   when the objects only move a little per step. Every swap of
+ 	 	 	   end points toggles the box overlap of one pair.
+ ============================================================================*/
+
+#ifndef KINETICSWEEP_H
+#define KINETICSWEEP_H
+
+#include <unordered_set>
+#include "DynamicScene.h"
+
+class KineticSweep {
+private:
+
+	/* One end of the interval of an object's box along an axis */
+	struct EndPoint {
+		float value;
+		unsigned int id;
+		bool isMax;
+	};
+
+	/*
+	 * End points are ordered by value. At equal values the lower ends
+	 * come first so that boxes which merely touch count as overlapping.
+	 */
+	static bool Less (const EndPoint& a, const EndPoint& b) {
+		return a.value < b.value || (a.value == b.value && !a.isMax && b.isMax);
+	}
+
+	std::vector<Shape*> mShapes;
+	std::vector<BoundingBox> mBoxes;
+
+	/* The sorted end points along the x-axis [0] and the y-axis [1] */
+	std::vector<EndPoint> mAxis[2];
+
+	/* Pairs whose boxes overlap, and the box partners of every object */
+	std::unordered_set<unsigned long long> mOverlap;
+	std::vector<std::vector<unsigned int> > mPartners;
+
+	/* The pairs that touch, as classified by the analyzer */
+	std::unordered_map<unsigned long long, PairResult> mPairs;
+
+	/* Pairs whose box overlap toggled, and objects that moved, this step */
+	std::vector<unsigned long long> mToggled;
+	std::vector<unsigned int> mMoved;
+
+	/* Set when objects were added and the lists need a full sort */
+	bool mRebuild;
+
+	SeparatingAxisCache mAxisCache;
+
+	static unsigned long long PairKey (unsigned int a, unsigned int b) {
+		return a < b ? ((unsigned long long) a << 32) | b : ((unsigned long long) b << 32) | a;
+	}
+
+	void SetOverlap (unsigned int a, unsigned int b, bool overlap);
+	void Repair (int axis);
+	void Rebuild ( );
+	void Classify (unsigned long long key, SceneDelta& delta);
+
+public:
+	KineticSweep ( ) : mRebuild (false) { }
+
+	~KineticSweep ( ) {
+		for (unsigned int i = 0; i < mShapes.size ( ); i++)
+			delete mShapes[i];
+	}
+
+	/* Adds a convex object with the given points and returns its id */
+	unsigned int Add (unsigned int numSides, const float *points);
+
+	/* Moves the object. The lists are repaired on the next Step. */
+	void Move (unsigned int id, const float *points);
+
+	/* Brings the lists and the pairs up to date and reports the changes */
+	void Step (SceneDelta& delta);
+
+	/* The pairs that touch right now */
+	const std::unordered_map<unsigned long long, PairResult>& Pairs ( ) const { return mPairs; }
+};
+
+unsigned int KineticSweep::Add (unsigned int numSides, const float *points) {
+
+	unsigned int id = mShapes.size ( );
+
+	mShapes.push_back (new Shape (numSides, points));
+	mBoxes.push_back (mShapes[id]->Bounds ( ));
+	mPartners.push_back (std::vector<unsigned int> ( ));
+
+	for (int axis = 0; axis < 2; axis++) {
+
+		EndPoint lo = { axis ? mBoxes[id].ymin : mBoxes[id].xmin, id, false };
+		EndPoint hi = { axis ? mBoxes[id].ymax : mBoxes[id].xmax, id, true };
+
+		mAxis[axis].push_back (lo);
+		mAxis[axis].push_back (hi);
+	}
+
+	mRebuild = true;
+	return id;
+}
+
+void KineticSweep::Move (unsigned int id, const float *points) {
+
+	mShapes[id]->SetPoints (points);
+	mBoxes[id] = mShapes[id]->Bounds ( );
+	mMoved.push_back (id);
+}
+
+/* Records the new box overlap status of the pair a, b */
+void KineticSweep::SetOverlap (unsigned int a, unsigned int b, bool overlap) {
+
+	unsigned long long key = PairKey (a, b);
+
+	if (overlap) {
+		if (mOverlap.insert (key).second == false)
+			return;
+
+		mPartners[a].push_back (b);
+		mPartners[b].push_back (a);
+	}
+
+	else {
+		if (mOverlap.erase (key) == 0)
+			return;
+
+		mPartners[a].erase (std::find (mPartners[a].begin ( ), mPartners[a].end ( ), b));
+		mPartners[b].erase (std::find (mPartners[b].begin ( ), mPartners[b].end ( ), a));
+	}
+
+	mToggled.push_back (key);
+}
+
+/*
+ * Insertion sort of the end points along one axis. Only two kinds of
+ * swaps matter. A lower end moving left past an upper end starts an
+ * overlap along this axis, and the pair overlaps for real if it also
+ * does so along the other axis. An upper end moving left past a lower
+ * end ends the overlap.
+ */
+void KineticSweep::Repair (int axis) {
+
+	std::vector<EndPoint>& list = mAxis[axis];
+
+	/* Pick up the new values of the end points first */
+	for (unsigned int i = 0; i < list.size ( ); i++) {
+
+		const BoundingBox& box = mBoxes[list[i].id];
+
+		if (axis == 0)
+			list[i].value = list[i].isMax ? box.xmax : box.xmin;
+		else
+			list[i].value = list[i].isMax ? box.ymax : box.ymin;
+	}
+
+	for (unsigned int i = 1; i < list.size ( ); i++) {
+
+		EndPoint key = list[i];
+		unsigned int j = i;
+
+		for (; j > 0 && Less (key, list[j - 1]); j--) {
+
+			const EndPoint& other = list[j - 1];
+
+			if (key.isMax == false && other.isMax == true) {
+
+				const BoundingBox& a = mBoxes[key.id];
+				const BoundingBox& b = mBoxes[other.id];
+
+				bool cross = axis == 0 ? OverlapY (a, b) : (a.xmin <= b.xmax && b.xmin <= a.xmax);
+
+				if (cross)
+					SetOverlap (key.id, other.id, true);
+			}
+
+			else if (key.isMax == true && other.isMax == false)
+				SetOverlap (key.id, other.id, false);
+
+			list[j] = list[j - 1];
+		}
+
+		list[j] = key;
+	}
+}
+
+/*
+ * Sorts the lists from scratch after objects were added. The box
+ * pairs are found again by the ordinary sweep and prune and compared
+ * with the pairs known so far.
+ */
+void KineticSweep::Rebuild ( ) {
+
+	struct Collect {
+		std::unordered_set<unsigned long long> pairs;
+		void operator() (unsigned int a, unsigned int b) { pairs.insert (PairKey (a, b)); }
+	} found;
+
+	for (int axis = 0; axis < 2; axis++)
+		std::sort (mAxis[axis].begin ( ), mAxis[axis].end ( ), Less);
+
+	SweepAndPrune (mBoxes, found);
+
+	std::vector<unsigned long long> gone;
+
+	for (std::unordered_set<unsigned long long>::iterator it = mOverlap.begin ( ); it != mOverlap.end ( ); it++)
+		if (found.pairs.count (*it) == 0)
+			gone.push_back (*it);
+
+	for (unsigned int k = 0; k < gone.size ( ); k++)
+		SetOverlap (gone[k] >> 32, (unsigned int) gone[k], false);
+
+	for (std::unordered_set<unsigned long long>::iterator it = found.pairs.begin ( ); it != found.pairs.end ( ); it++)
+		SetOverlap (*it >> 32, (unsigned int) *it, true);
+
+	mRebuild = false;
+}
+
+/* Runs the narrow phase for one pair and reports how it changed */
+void KineticSweep::Classify (unsigned long long key, SceneDelta& delta) {
+
+	unsigned int a = key >> 32, b = (unsigned int) key;
+
+	PairResult res;
+	res.first = a;
+	res.second = b;
+	res.which = 0;
+	res.type = apart;
+
+	/* Pairs whose boxes no longer overlap are apart without analysis */
+	if (mOverlap.count (key))
+		res.type = mAxisCache.ProcessData (a, *mShapes[a], b, *mShapes[b], &res.which);
+
+	std::unordered_map<unsigned long long, PairResult>::iterator it = mPairs.find (key);
+
+	if (it == mPairs.end ( )) {
+		if (res.type != apart) {
+			mPairs[key] = res;
+			delta.added.push_back (res);
+		}
+	}
+
+	else if (res.type == apart) {
+		delta.ended.push_back (it->second);
+		mPairs.erase (it);
+	}
+
+	else if (it->second.type != res.type || it->second.which != res.which) {
+		it->second = res;
+		delta.changed.push_back (res);
+	}
+}
+
+/*
+ * Repairs both the lists, then runs the analyzer only for the pairs
+ * whose box overlap toggled, plus the overlapping pairs of objects that
+ * moved, since those may have changed their type without any swap.
+ */
+void KineticSweep::Step (SceneDelta& delta) {
+
+	delta.added.clear ( );
+	delta.ended.clear ( );
+	delta.changed.clear ( );
+
+	if (mRebuild)
+		Rebuild ( );
+
+	Repair (0);
+	Repair (1);
+
+	std::vector<unsigned long long> work;
+	work.swap (mToggled);
+
+	for (unsigned int k = 0; k < mMoved.size ( ); k++) {
+
+		const std::vector<unsigned int>& partners = mPartners[mMoved[k]];
+
+		for (unsigned int p = 0; p < partners.size ( ); p++)
+			work.push_back (PairKey (mMoved[k], partners[p]));
+	}
+
+	mMoved.clear ( );
+
+	/* A pair toggled on and off again within the step shows up twice */
+	std::sort (work.begin ( ), work.end ( ));
+	work.erase (std::unique (work.begin ( ), work.end ( )), work.end ( ));
+
+	for (unsigned int k = 0; k < work.size ( ); k++)
+		Classify (work[k], delta);
+}
+
+#endif /* KINETICSWEEP_H */
@@ -0,0 +1,244 @@
+/*============================================================================
+ Name        : NearestQuery.h
+ Author      : Nitin Puranik
+ Description : Finds the k objects of a set nearest to a point or to an
+ 	 	 	   object, by their true distance rather than that of their
+ 	 	 	   boxes. The index is walked best first: nodes and objects
+ 	 	 	   wait in one queue ordered by the distance of their boxes,
+ 	 	 	   which is a lower bound, and an object's exact distance is
+ 	 	 	   only worked out once it reaches the front of the queue.
+ ============================================================================*/
+
+#ifndef NEARESTQUERY_H
+#define NEARESTQUERY_H
+
+#include <cfloat>
+#include <thread>
+#include <functional>
+#include "SpatialIndex.h"
+#include "BroadPhase.h"
+#include "SpatialOrder.h"
+#include "ShapeDistance.h"
+
+/* The object to leave out of a query: none */
+#define NO_NEIGHBOUR ((unsigned int) -1)
+
+/*
+ * Box distances are shrunk by this much before they go in the queue.
+ * They are worked out with other sums than the exact distances, and a
+ * bound must never come out above the distance it bounds.
+ */
+#define NEAREST_SLACK (1 - 8 * FLT_EPSILON)
+
+/* One of the k nearest objects, and its distance */
+struct Neighbour {
+	unsigned int object;
+	float distance;
+};
+
+/*
+ * An entry of the queue: a node with the distance of its box, an object
+ * with the distance of its box, or an object with its exact distance.
+ * The queue is ordered by distance, then by kind, then by id, so that
+ * everything that may still come out at the same distance is looked at
+ * before an exact distance is taken off, and ties go to the lower object.
+ */
+enum NearestKind { nodeBound, objectBound, objectExact };
+
+struct NearestItem {
+	float distance;
+	NearestKind kind;
+	unsigned int id;
+
+	bool operator> (const NearestItem& e) const {
+		if (distance != e.distance)
+			return distance > e.distance;
+
+		if (kind != e.kind)
+			return kind > e.kind;
+
+		return id > e.id;
+	}
+};
+
+/* The queue of a query. It is kept between queries, so that they do not allocate. */
+typedef std::vector<NearestItem> NearestQueue;
+
+/* The distance between the point and the box, 0 if it lies inside */
+inline float BoxDistance (const BoundingBox& b, float x, float y) {
+
+	float dx = std::max (0.0f, std::max (b.xmin - x, x - b.xmax));
+	float dy = std::max (0.0f, std::max (b.ymin - y, y - b.ymax));
+
+	return std::sqrt (dx * dx + dy * dy);
+}
+
+/* The distance between two boxes, 0 if they overlap or touch */
+inline float BoxDistance (const BoundingBox& a, const BoundingBox& b) {
+
+	float dx = std::max (0.0f, std::max (b.xmin - a.xmax, a.xmin - b.xmax));
+	float dy = std::max (0.0f, std::max (b.ymin - a.ymax, a.ymin - b.ymax));
+
+	return std::sqrt (dx * dx + dy * dy);
+}
+
+/* What a query measures from: a point */
+struct PointTarget {
+	float mX, mY;
+
+	PointTarget (float x, float y) : mX (x), mY (y) { }
+
+	float Bound (const BoundingBox& b) const { return BoxDistance (b, mX, mY); }
+
+	float Exact (const Shape& S) const { return PointDistance (S, mX, mY); }
+};
+
+/* What a query measures from: an object */
+struct ShapeTarget {
+	const Shape& mShape;
+
+	ShapeTarget (const Shape& S) : mShape (S) { }
+
+	float Bound (const BoundingBox& b) const { return BoxDistance (mShape.Bounds ( ), b); }
+
+	float Exact (const Shape& S) const { return Distance (mShape, S); }
+};
+
+/*
+ * An indexed set of objects to find neighbours in. The index holds on
+ * to the boxes of the set, so the set must not change while it is in
+ * use. Queries only read it, and may run from any number of threads,
+ * each with its own queue.
+ */
+class NearestIndex {
+private:
+	const std::vector<Shape*>& mShapes;
+	SpatialIndex mIndex;
+
+	NearestIndex (const NearestIndex&);
+	NearestIndex& operator= (const NearestIndex&);
+
+	static void Push (NearestQueue& queue, float distance, NearestKind kind, unsigned int id) {
+
+		NearestItem item = { distance, kind, id };
+
+		queue.push_back (item);
+		std::push_heap (queue.begin ( ), queue.end ( ), std::greater<NearestItem> ( ));
+	}
+
+public:
+	NearestIndex (const std::vector<Shape*>& shapes) : mShapes (shapes) {
+
+		std::vector<BoundingBox> boxes;
+		CollectBounds (shapes, boxes);
+		mIndex.Build (boxes);
+	}
+
+	/*
+	 * The k objects nearest to the target, nearest first, leaving out
+	 * the object at position skip. Fewer come out if the set is smaller.
+	 */
+	template <class Target>
+	void Nearest (const Target& target, unsigned int k, std::vector<Neighbour>& found,
+			NearestQueue& queue, unsigned int skip = NO_NEIGHBOUR) const {
+
+		found.clear ( );
+		queue.clear ( );
+
+		if (mIndex.Empty ( ) || k == 0)
+			return;
+
+		Push (queue, NEAREST_SLACK * target.Bound (mIndex.Root ( ).box), nodeBound, mIndex.RootNode ( ));
+
+		while (queue.empty ( ) == false) {
+
+			NearestItem item = queue.front ( );
+			std::pop_heap (queue.begin ( ), queue.end ( ), std::greater<NearestItem> ( ));
+			queue.pop_back ( );
+
+			if (item.kind == objectExact) {
+
+				Neighbour n = { item.id, item.distance };
+				found.push_back (n);
+
+				if (found.size ( ) == k)
+					return;
+			}
+
+			else if (item.kind == objectBound)
+				Push (queue, target.Exact (*mShapes[item.id]), objectExact, item.id);
+
+			else {
+				const IndexNode& node = mIndex.Node (item.id);
+
+				for (unsigned int c = node.first; c < node.first + node.count; c++) {
+
+					if (node.leaf == false)
+						Push (queue, NEAREST_SLACK * target.Bound (mIndex.Node (c).box), nodeBound, c);
+
+					else if (mIndex.Entry (c) != skip)
+						Push (queue, NEAREST_SLACK * target.Bound (mIndex.Box (mIndex.Entry (c))),
+								objectBound, mIndex.Entry (c));
+				}
+			}
+		}
+	}
+
+	/* The k objects nearest to the point */
+	void Nearest (float x, float y, unsigned int k, std::vector<Neighbour>& found) const {
+
+		NearestQueue queue;
+		Nearest (PointTarget (x, y), k, found, queue);
+	}
+
+	/*
+	 * The k nearest objects for each of the n points of xy (two floats
+	 * each). found[i * k + j] is the j-th nearest to point i; a point with
+	 * fewer than k objects in reach has the rest set to NO_NEIGHBOUR. The
+	 * points are taken in curve order and split over threads, each with
+	 * its own queue.
+	 */
+	void NearestAll (const float *xy, unsigned int n, unsigned int k, std::vector<Neighbour>& found,
+			unsigned int threads = 0) const {
+
+		if (threads == 0)
+			threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+		Neighbour none = { NO_NEIGHBOUR, HUGE_VALF };
+		found.assign ((size_t) n * k, none);
+
+		if (n == 0)
+			return;
+
+		std::vector<unsigned int> order;
+		CurveOrderPoints (xy, n, order, threads);
+
+		struct Worker {
+			static void Run (const NearestIndex *index, const float *xy, const unsigned int *order,
+					unsigned int begin, unsigned int end, unsigned int k, Neighbour *found) {
+
+				NearestQueue queue;
+				std::vector<Neighbour> nearest;
+
+				for (unsigned int p = begin; p < end; p++) {
+
+					unsigned int i = order[p];
+
+					index->Nearest (PointTarget (xy[2 * i], xy[2 * i + 1]), k, nearest, queue);
+					std::copy (nearest.begin ( ), nearest.end ( ), found + (size_t) i * k);
+				}
+			}
+		};
+
+		std::vector<std::thread> pool;
+
+		for (unsigned int t = 0; t < threads; t++)
+			pool.push_back (std::thread (Worker::Run, this, xy, order.data ( ),
+					RangeStart (n, threads, t), RangeStart (n, threads, t + 1), k, found.data ( )));
+
+		for (unsigned int t = 0; t < threads; t++)
+			pool[t].join ( );
+	}
+};
+
+#endif /* NEARESTQUERY_H */
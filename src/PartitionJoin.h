@@ -0,0 +1,659 @@
+/*============================================================================
+ Name        : PartitionJoin.h
+ Author      : Nitin Puranik
+ Description : A partition based spatial merge join of two record files
+ 	 	 	   that are each larger than memory. Space is cut into tiles,
+ 	 	 	   the tiles are dealt out to partitions, and every record is
+ 	 	 	   spilled to the run file of each partition it overlaps. The
+ 	 	 	   partitions are then joined one at a time, in memory. A
+ 	 	 	   partition that is still too large is partitioned again.
+ ============================================================================*/
+
+#ifndef PARTITIONJOIN_H
+#define PARTITIONJOIN_H
+
+#include <cmath>
+#include <string>
+#include <sstream>
+#include "BroadPhase.h"
+#include "ShapeFile.h"
+#include "SpatialOrder.h"
+#include "QueryBudget.h"
+
+/*
+ * A rough count of the bytes one record takes while its partition is
+ * joined: the record, the object built from it with its prepared data,
+ * its box and the sort indices of the sweep.
+ */
+#define RECORD_MEMORY 256
+
+/* Tiles per partition. More tiles spread dense areas over more partitions. */
+#define TILES_PER_PARTITION 16
+
+/* Every partition keeps a run file open while spilling, so keep them bounded */
+#define MAX_PARTITIONS 1000
+
+/* Times a partition may be partitioned again before the join gives up */
+#define PARTITION_LEVELS 16
+
+/* The most tiles along each axis of a plan. The plans of every level stay in memory. */
+#define MAX_TILE_SIDE 256
+
+/* The most pairs handed to the sink at once */
+#define PARTITION_BATCH 4096
+
+/* Records read between two looks at the budget, if any */
+#define BUDGET_RECORDS 4096
+
+/*
+ * The tiling of the world and the mapping of tiles to partitions.
+ * By default tiles are dealt out round robin, so that a dense area of
+ * the world ends up spread over many partitions instead of overloading
+ * one. A plan may instead carry an explicit tile to partition table.
+ */
+struct PartitionPlan {
+	BoundingBox world;
+	unsigned int tilesX, tilesY;
+	unsigned int partitions;
+
+	/* The partition of every tile, row by row. Empty for round robin. */
+	std::vector<unsigned int> tileMap;
+
+	void TileOf (float x, float y, unsigned int *tx, unsigned int *ty) const {
+
+		float fx = (x - world.xmin) / (world.xmax - world.xmin) * tilesX;
+		float fy = (y - world.ymin) / (world.ymax - world.ymin) * tilesY;
+
+		/* A single tile along an axis also covers a world flat along it */
+		*tx = (tilesX == 1 || fx <= 0) ? 0 : std::min ((unsigned int) fx, tilesX - 1);
+		*ty = (tilesY == 1 || fy <= 0) ? 0 : std::min ((unsigned int) fy, tilesY - 1);
+	}
+
+	unsigned int PartitionOf (unsigned int tx, unsigned int ty) const {
+		if (tileMap.empty ( ) == false)
+			return tileMap[ty * tilesX + tx];
+
+		return (ty * tilesX + tx) % partitions;
+	}
+
+	/* The partition whose tile holds the point (x, y) */
+	unsigned int PartitionAt (float x, float y) const {
+		unsigned int tx, ty;
+		TileOf (x, y, &tx, &ty);
+		return PartitionOf (tx, ty);
+	}
+
+	/* Tells if a plan one level deeper would have finer tiles */
+	bool CanCutFiner ( ) const {
+		return 2 * std::max (tilesX, tilesY) <= MAX_TILE_SIDE;
+	}
+
+	/* The box of all the tiles of the partition */
+	BoundingBox TilesOf (unsigned int partition) const {
+
+		unsigned int tx0 = tilesX, ty0 = tilesY, tx1 = 0, ty1 = 0;
+
+		for (unsigned int ty = 0; ty < tilesY; ty++) {
+			for (unsigned int tx = 0; tx < tilesX; tx++) {
+				if (PartitionOf (tx, ty) == partition) {
+					tx0 = std::min (tx0, tx);
+					ty0 = std::min (ty0, ty);
+					tx1 = std::max (tx1, tx);
+					ty1 = std::max (ty1, ty);
+				}
+			}
+		}
+
+		BoundingBox box = world;
+
+		if (tx0 > tx1 || ty0 > ty1)
+			return box;
+
+		float w = world.xmax - world.xmin, h = world.ymax - world.ymin;
+
+		if (tilesX > 1) {
+			box.xmin = world.xmin + w * tx0 / tilesX;
+			box.xmax = world.xmin + w * (tx1 + 1) / tilesX;
+		}
+
+		if (tilesY > 1) {
+			box.ymin = world.ymin + h * ty0 / tilesY;
+			box.ymax = world.ymin + h * (ty1 + 1) / tilesY;
+		}
+
+		return box;
+	}
+
+	/* The distinct partitions whose tiles the box overlaps */
+	void PartitionsOf (const BoundingBox& box, std::vector<unsigned int>& parts) const {
+
+		unsigned int tx0, ty0, tx1, ty1;
+
+		TileOf (box.xmin, box.ymin, &tx0, &ty0);
+		TileOf (box.xmax, box.ymax, &tx1, &ty1);
+
+		parts.clear ( );
+
+		/* A row of as many tiles as partitions is dealt to every partition */
+		if (tileMap.empty ( ) && tx1 - tx0 + 1 >= partitions) {
+			for (unsigned int p = 0; p < partitions; p++)
+				parts.push_back (p);
+			return;
+		}
+
+		for (unsigned int ty = ty0; ty <= ty1; ty++)
+			for (unsigned int tx = tx0; tx <= tx1; tx++)
+				parts.push_back (PartitionOf (tx, ty));
+
+		std::sort (parts.begin ( ), parts.end ( ));
+		parts.erase (std::unique (parts.begin ( ), parts.end ( )), parts.end ( ));
+	}
+};
+
+/*
+ * The partitions a pair must fall in to be reported, one for every
+ * level of partitioning its records went through. A partition that is
+ * partitioned again keeps its own place in the chain, so a pair found
+ * in several partitions at any level is still reported just once.
+ */
+class OwnerChain {
+private:
+	std::vector<const PartitionPlan*> mPlans;
+	std::vector<unsigned int> mPartitions;
+
+public:
+	void Push (const PartitionPlan& plan, unsigned int partition) {
+		mPlans.push_back (&plan);
+		mPartitions.push_back (partition);
+	}
+
+	void Pop ( ) {
+		mPlans.pop_back ( );
+		mPartitions.pop_back ( );
+	}
+
+	unsigned int Levels ( ) const { return mPlans.size ( ); }
+
+	/*
+	 * Narrows a world down to the tiles of the partition at the last
+	 * level. Only pairs owned there are reported, so cutting any more
+	 * of the world into tiles would be wasted on pairs found elsewhere.
+	 */
+	void Clip (BoundingBox& world) const {
+
+		if (mPlans.empty ( ))
+			return;
+
+		BoundingBox tiles = mPlans.back ( )->TilesOf (mPartitions.back ( ));
+
+		world.xmin = std::max (world.xmin, tiles.xmin);
+		world.ymin = std::max (world.ymin, tiles.ymin);
+		world.xmax = std::max (world.xmin, std::min (world.xmax, tiles.xmax));
+		world.ymax = std::max (world.ymin, std::min (world.ymax, tiles.ymax));
+	}
+
+	/* Tells if the point lies in the tiles of the partition at every level */
+	bool Owns (float x, float y) const {
+		for (unsigned int k = 0; k < mPlans.size ( ); k++)
+			if (mPlans[k]->PartitionAt (x, y) != mPartitions[k])
+				return false;
+
+		return true;
+	}
+};
+
+/*
+ * Reads a record file once to find its world box and record count.
+ * Once the budget, if any, runs out it stops reading early.
+ */
+bool ScanRecords (const char *path, BoundingBox& world, unsigned long long *count,
+		QueryBudget *budget = NULL) {
+
+	RecordFile file;
+	ShapeRecord rec;
+
+	if (file.Open (path, "rb") == false)
+		return false;
+
+	*count = 0;
+
+	while (file.Read (rec)) {
+
+		if (*count % BUDGET_RECORDS == 0 && BudgetExpired (budget))
+			break;
+
+		BoundingBox box = RecordBounds (rec);
+
+		if (*count == 0)
+			world = box;
+
+		else {
+			world.xmin = std::min (world.xmin, box.xmin);
+			world.ymin = std::min (world.ymin, box.ymin);
+			world.xmax = std::max (world.xmax, box.xmax);
+			world.ymax = std::max (world.ymax, box.ymax);
+		}
+
+		(*count)++;
+	}
+
+	return true;
+}
+
+/*
+ * The most partitions a spill may write to at once. Each of them keeps
+ * a run file with its buffer open, and the buffers get half the budget.
+ */
+unsigned int SpillFanout (unsigned long long memoryBudget) {
+	return (unsigned int) std::min ((unsigned long long) MAX_PARTITIONS, memoryBudget / (2 * RECORD_BUFFER));
+}
+
+/*
+ * Chooses enough partitions for one partition's worth of records to
+ * fit in the given number of bytes, assuming the records are spread
+ * evenly, but no more than maxPartitions. The world should already
+ * enclose every record. A partition that is cut again at the given
+ * level gets tiles that many times twice as fine, up to MAX_TILE_SIDE:
+ * its tiles need not form a box, so its world may not shrink, and a
+ * crowd that filled one tile must still end up spread over several.
+ */
+PartitionPlan PlanPartitions (const BoundingBox& world, unsigned long long records,
+		unsigned long long memoryBudget, unsigned int maxPartitions = MAX_PARTITIONS,
+		unsigned int level = 0) {
+
+	PartitionPlan plan;
+	unsigned long long bytes = records * RECORD_MEMORY;
+
+	plan.world = world;
+	memoryBudget = std::max (1ULL, memoryBudget);
+	plan.partitions = (unsigned int) std::max (1ULL, std::min ((unsigned long long) maxPartitions,
+			(bytes + memoryBudget - 1) / memoryBudget));
+
+	unsigned int side = (unsigned int) std::ceil (std::sqrt ((double) plan.partitions * TILES_PER_PARTITION));
+
+	side = std::max (1u, side);
+
+	for (unsigned int k = 0; k < level && 2 * side <= MAX_TILE_SIDE; k++)
+		side *= 2;
+
+	plan.tilesX = plan.tilesY = side;
+
+	/* A world that is flat along an axis gets a single row of tiles */
+	if (world.xmax <= world.xmin) plan.tilesX = 1;
+	if (world.ymax <= world.ymin) plan.tilesY = 1;
+
+	return plan;
+}
+
+/* Adds the records of the file to the counts of the tiles of their box centres */
+bool CountTiles (const char *path, const PartitionPlan& plan, std::vector<unsigned long long>& counts,
+		QueryBudget *budget) {
+
+	RecordFile file;
+	ShapeRecord rec;
+	unsigned long long seen = 0;
+
+	if (file.Open (path, "rb") == false)
+		return false;
+
+	counts.resize (plan.tilesX * plan.tilesY, 0);
+
+	while (file.Read (rec)) {
+
+		if (seen++ % BUDGET_RECORDS == 0 && BudgetExpired (budget))
+			break;
+
+		BoundingBox box = RecordBounds (rec);
+		unsigned int tx, ty;
+
+		plan.TileOf (0.5f * (box.xmin + box.xmax), 0.5f * (box.ymin + box.ymax), &tx, &ty);
+		counts[ty * plan.tilesX + tx]++;
+	}
+
+	return true;
+}
+
+/*
+ * Deals the tiles of the plan out to its partitions in Morton order,
+ * cutting the curve before a tile that would take the partition past an
+ * equal share of the records. Each partition is then a compact run of
+ * tiles, dense areas are cut into more and smaller runs than sparse
+ * ones, and a tile crowded beyond a share gets a partition of its own.
+ * The records of both files, the second being optional, are counted in
+ * the tile of their box centre. Once the budget, if any, runs out the
+ * counting stops early and the plan is only fit to be thrown away.
+ */
+bool PlanCurvePartitions (PartitionPlan& plan, const char *pathA, const char *pathB = NULL,
+		QueryBudget *budget = NULL) {
+
+	unsigned int numTiles = plan.tilesX * plan.tilesY;
+	std::vector<unsigned long long> counts;
+	unsigned long long total = 0;
+
+	if (CountTiles (pathA, plan, counts, budget) == false ||
+			(pathB != NULL && CountTiles (pathB, plan, counts, budget) == false))
+		return false;
+
+	for (unsigned int t = 0; t < numTiles; t++)
+		total += counts[t];
+
+	std::vector<std::pair<unsigned int, unsigned int> > curve (numTiles);
+
+	for (unsigned int t = 0; t < numTiles; t++)
+		curve[t] = std::make_pair (MortonCode (t % plan.tilesX, t / plan.tilesX), t);
+
+	std::sort (curve.begin ( ), curve.end ( ));
+
+	plan.tileMap.resize (numTiles);
+	unsigned long long share = (total + plan.partitions - 1) / plan.partitions, held = 0;
+	unsigned int partition = 0;
+
+	for (unsigned int k = 0; k < numTiles; k++) {
+
+		unsigned int tile = curve[k].second;
+
+		if (held > 0 && held + counts[tile] > share && partition + 1 < plan.partitions) {
+			partition++;
+			held = 0;
+		}
+
+		plan.tileMap[tile] = partition;
+		held += counts[tile];
+	}
+
+	return true;
+}
+
+/* The name of the run file of one input and one partition */
+std::string RunName (const std::string& prefix, unsigned int partition) {
+	std::ostringstream name;
+	name << prefix << ".p" << partition;
+	return name.str ( );
+}
+
+/*
+ * Spills the records of the input file to one run file per partition,
+ * and counts the records of every run if asked to. A record goes to every partition
+ * its box overlaps. Every run file is only ever appended to, so the disk
+ * I/O stays sequential. Once the budget, if any, runs out the spill
+ * stops early, and the runs are only fit to be removed.
+ */
+bool SpillRecords (const char *path, const PartitionPlan& plan, const std::string& prefix,
+		std::vector<unsigned long long> *counts = NULL, QueryBudget *budget = NULL) {
+
+	RecordFile in;
+	std::vector<RecordFile> runs (plan.partitions);
+	std::vector<unsigned int> parts;
+	ShapeRecord rec;
+	unsigned long long seen = 0;
+
+	if (counts != NULL)
+		counts->assign (plan.partitions, 0);
+
+	if (in.Open (path, "rb") == false)
+		return false;
+
+	for (unsigned int p = 0; p < plan.partitions; p++)
+		if (runs[p].Open (RunName (prefix, p).c_str ( ), "wb") == false)
+			return false;
+
+	while (in.Read (rec)) {
+
+		if (seen++ % BUDGET_RECORDS == 0 && BudgetExpired (budget))
+			break;
+
+		plan.PartitionsOf (RecordBounds (rec), parts);
+
+		for (unsigned int k = 0; k < parts.size ( ); k++) {
+			if (runs[parts[k]].Write (rec) == false) {
+				std::cerr << "Cannot write " << RunName (prefix, parts[k]) << std::endl;
+				return false;
+			}
+
+			if (counts != NULL)
+				(*counts)[parts[k]]++;
+		}
+	}
+
+	return true;
+}
+
+/* Deletes the run files left behind by SpillRecords */
+void RemoveRuns (const PartitionPlan& plan, const std::string& prefix) {
+	for (unsigned int p = 0; p < plan.partitions; p++)
+		std::remove (RunName (prefix, p).c_str ( ));
+}
+
+/* Builds the objects of a partition from its records */
+void BuildShapes (const std::vector<ShapeRecord>& recs, std::vector<Shape*>& shapes,
+		std::vector<BoundingBox>& boxes) {
+
+	shapes.resize (recs.size ( ));
+	boxes.resize (recs.size ( ));
+
+	for (unsigned int i = 0; i < recs.size ( ); i++) {
+		shapes[i] = new Shape (RECORD_SIDES, recs[i].points);
+		boxes[i] = shapes[i]->Bounds ( );
+	}
+}
+
+void FreeShapes (std::vector<Shape*>& shapes) {
+	for (unsigned int i = 0; i < shapes.size ( ); i++)
+		delete shapes[i];
+	shapes.clear ( );
+}
+
+/*
+ * The refinement of one partition. A pair of records spanning several
+ * tiles is found in every partition they share, but it is only
+ * reported by the partition owning the tile of its reference point,
+ * the lower left corner of the overlap of the two boxes. The pairs go
+ * to the sink in batches, so a crowded partition does not pile them up.
+ */
+template <class Sink>
+struct PartitionRefine {
+	const OwnerChain& mOwners;
+	Sink& mSink;
+
+	const std::vector<ShapeRecord> &mRecA, &mRecB;
+	std::vector<Shape*> mShapeA, mShapeB;
+	std::vector<BoundingBox> mBoxA, mBoxB;
+	std::vector<PairResult> mFound;
+
+	PartitionRefine (const OwnerChain& owners, const std::vector<ShapeRecord>& recA,
+			const std::vector<ShapeRecord>& recB, Sink& sink)
+		: mOwners (owners), mSink (sink), mRecA (recA), mRecB (recB) {
+		BuildShapes (recA, mShapeA, mBoxA);
+		BuildShapes (recB, mShapeB, mBoxB);
+	}
+
+	~PartitionRefine ( ) {
+		FreeShapes (mShapeA);
+		FreeShapes (mShapeB);
+	}
+
+	void operator() (unsigned int i, unsigned int j) {
+
+		float rx = std::max (mBoxA[i].xmin, mBoxB[j].xmin);
+		float ry = std::max (mBoxA[i].ymin, mBoxB[j].ymin);
+
+		if (mOwners.Owns (rx, ry) == false)
+			return;
+
+		PairResult res;
+
+		res.first = mRecA[i].id;
+		res.second = mRecB[j].id;
+		res.type = ProcessData (*mShapeA[i], *mShapeB[j], &res.which);
+
+		if (res.type != apart)
+			mFound.push_back (res);
+
+		if (mFound.size ( ) >= PARTITION_BATCH)
+			Flush ( );
+	}
+
+	void Flush ( ) {
+		if (mFound.empty ( ) == false)
+			mSink (mFound);
+		mFound.clear ( );
+	}
+
+	/* Returns the share of the records swept, all of whose pairs have been reported */
+	double Run (QueryBudget *budget) {
+
+		unsigned int swept = SweepAndPrune (mBoxA, mBoxB, *this, budget);
+		unsigned int total = mBoxA.size ( ) + mBoxB.size ( );
+
+		Flush ( );
+		return total ? (double) swept / total : 1;
+	}
+};
+
+/*
+ * Joins the records of two files: the inputs at the top, the runs of a
+ * partition below it. The records are spilled to partitions, and every
+ * partition that fits the memory budget is joined in memory. One that
+ * does not, because its records crowd a small area, is partitioned
+ * again over just its own tiles, with the new tiles dealt out by their
+ * records so that the crowded ones are cut finer. A partition that kept
+ * all the records is cut again too, as long as the tiles get finer.
+ * Records that no cut spreads out, like ones all overlapping a single
+ * point, fail the join.
+ *
+ * The budget, if any, is looked at every BUDGET_RECORDS records read,
+ * before every partition and while it is swept. share receives the
+ * share of the work done before it ran out: for every partition, of
+ * its records, those swept, weighted by how many records it has.
+ */
+template <class Sink>
+bool JoinRuns (const char *pathA, const char *pathB, const std::string& prefixA, const std::string& prefixB,
+		unsigned long long memoryBudget, OwnerChain& owners, Sink& sink, QueryBudget *budget,
+		double *share) {
+
+	BoundingBox worldA, worldB;
+	unsigned long long countA, countB;
+
+	*share = 0;
+
+	if (ScanRecords (pathA, worldA, &countA, budget) == false ||
+			ScanRecords (pathB, worldB, &countB, budget) == false)
+		return false;
+
+	if (BudgetExpired (budget))
+		return true;
+
+	if (countA == 0 || countB == 0) {
+		*share = 1;
+		return true;
+	}
+
+	BoundingBox world;
+	world.xmin = std::min (worldA.xmin, worldB.xmin);
+	world.ymin = std::min (worldA.ymin, worldB.ymin);
+	world.xmax = std::max (worldA.xmax, worldB.xmax);
+	world.ymax = std::max (worldA.ymax, worldB.ymax);
+	owners.Clip (world);
+
+	PartitionPlan plan = PlanPartitions (world, countA + countB, memoryBudget, SpillFanout (memoryBudget),
+			owners.Levels ( ));
+	std::vector<unsigned long long> runsA, runsB;
+
+	bool ok = (owners.Levels ( ) == 0 || PlanCurvePartitions (plan, pathA, pathB, budget)) &&
+			SpillRecords (pathA, plan, prefixA, &runsA, budget) &&
+			SpillRecords (pathB, plan, prefixB, &runsB, budget);
+
+	double records = 0, done = 0;
+
+	for (unsigned int p = 0; ok && p < plan.partitions; p++)
+		records += runsA[p] + runsB[p];
+
+	for (unsigned int p = 0; ok && p < plan.partitions && BudgetExpired (budget) == false; p++) {
+
+		double part = 0;
+
+		if (runsA[p] == 0 || runsB[p] == 0) {
+			done += runsA[p] + runsB[p];
+			continue;
+		}
+
+		std::string runA = RunName (prefixA, p);
+		std::string runB = RunName (prefixB, p);
+
+		owners.Push (plan, p);
+
+		if ((runsA[p] + runsB[p]) * RECORD_MEMORY <= memoryBudget) {
+
+			std::vector<ShapeRecord> recA, recB;
+
+			ok = LoadRecords (runA.c_str ( ), recA) && LoadRecords (runB.c_str ( ), recB);
+
+			if (ok) {
+				PartitionRefine<Sink> refine (owners, recA, recB, sink);
+				part = refine.Run (budget);
+			}
+		}
+
+		else if ((runsA[p] + runsB[p] < countA + countB || plan.CanCutFiner ( )) &&
+				owners.Levels ( ) <= PARTITION_LEVELS) {
+
+			ok = JoinRuns (runA.c_str ( ), runB.c_str ( ), runA, runB, memoryBudget, owners, sink,
+					budget, &part);
+
+		}
+
+		else {
+			std::cerr << "Cannot cut the records down to the memory budget" << std::endl;
+			ok = false;
+		}
+
+		owners.Pop ( );
+		done += (runsA[p] + runsB[p]) * part;
+	}
+
+	RemoveRuns (plan, prefixA);
+	RemoveRuns (plan, prefixB);
+
+	*share = records > 0 ? done / records : 1;
+	return ok;
+}
+
+/*
+ * Joins the two record files. Every pair of a record from A and a record
+ * from B that is not apart is reported once, with first and second being
+ * the record ids. The sink is called with up to PARTITION_BATCH pairs at
+ * a time as sink (const std::vector<PairResult>&). Run files are written
+ * next to tempPrefix and removed afterwards. The records in memory, and
+ * the buffers of the run files being written, stay within memoryBudget
+ * bytes. Returns false on an I/O error, or when the budget cannot be met.
+ *
+ * The budget, if any, is looked at before every partition, while the
+ * records are read and spilled, and while a partition is swept. Once
+ * it runs out the join stops with the pairs found so far, and complete
+ * receives the share of the records of the partitions that were swept,
+ * all of whose pairs have been reported.
+ */
+template <class Sink>
+bool PartitionJoin (const char *pathA, const char *pathB, const std::string& tempPrefix,
+		unsigned long long memoryBudget, Sink& sink, QueryBudget *budget = NULL, float *complete = NULL) {
+
+	ReportComplete (complete, 0, 1);
+
+	if (SpillFanout (memoryBudget) < 2) {
+		std::cerr << "The memory budget is too small to spill the records" << std::endl;
+		return false;
+	}
+
+	OwnerChain owners;
+	double share;
+
+	bool ok = JoinRuns (pathA, pathB, tempPrefix + ".a", tempPrefix + ".b", memoryBudget, owners, sink,
+			budget, &share);
+
+	if (ok && complete != NULL)
+		*complete = (float) share;
+
+	return ok;
+}
+
+#endif /* PARTITIONJOIN_H */
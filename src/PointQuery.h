@@ -0,0 +1,241 @@
+/*============================================================================
+ Name        : PointQuery.h
+ Author      : Nitin Puranik
+ Description : Answers which objects of a set contain a point, for large
+ 	 	 	   batches of points at a time. The set is indexed once; each
+ 	 	 	   batch is put in curve order so that neighbouring points walk
+ 	 	 	   the same part of the index, and is split over threads.
+ ============================================================================*/
+
+#ifndef POINTQUERY_H
+#define POINTQUERY_H
+
+#include <mutex>
+#include <thread>
+#include "SpatialIndex.h"
+#include "BroadPhase.h"
+#include "SpatialOrder.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* A point and an object containing it: the id of the point, the position of the object */
+typedef std::pair<unsigned int, unsigned int> PointHit;
+
+/* Number of hits a worker gathers before handing them to the sink */
+#define POINT_BATCH 4096
+
+/* Passes the boxes that hold the point, edges included */
+struct HoldsPoint {
+	float mX, mY;
+
+	HoldsPoint (float x, float y) : mX (x), mY (y) { }
+
+	bool operator() (const BoundingBox& b) const {
+		return b.xmin <= mX && mX <= b.xmax && b.ymin <= mY && mY <= b.ymax;
+	}
+};
+
+/*
+ * An indexed set of objects to locate points in. For every object with
+ * four sides, the four half-planes of its edges are packed side by side
+ * as a * x + b * y + c, so that one point is tested against all four in
+ * one go. The point is inside when all four agree in sign.
+ */
+class PointLocator {
+private:
+	const std::vector<Shape*>& mShapes;
+	SpatialIndex mIndex;
+	std::vector<float> mPlanes;
+
+	PointLocator (const PointLocator&);
+	PointLocator& operator= (const PointLocator&);
+
+public:
+	PointLocator (const std::vector<Shape*>& shapes) : mShapes (shapes) {
+
+		std::vector<BoundingBox> boxes;
+		CollectBounds (shapes, boxes);
+		mIndex.Build (boxes);
+
+		mPlanes.assign (12 * shapes.size ( ), 0);
+
+		for (unsigned int k = 0; k < shapes.size ( ); k++) {
+
+			if (shapes[k]->NumSides ( ) != 4)
+				continue;
+
+			const float *p = shapes[k]->Points ( );
+			const float *n = shapes[k]->Normals ( );
+			float *plane = &mPlanes[12 * k];
+
+			for (unsigned int i = 0; i < 4; i++) {
+				plane[i] = n[2 * i];
+				plane[4 + i] = n[2 * i + 1];
+				plane[8 + i] = -(n[2 * i] * p[2 * i] + n[2 * i + 1] * p[2 * i + 1]);
+			}
+		}
+	}
+
+	/* Tells if the object at position k contains the point, edges included */
+	bool Contains (unsigned int k, float x, float y) const {
+
+		if (mShapes[k]->NumSides ( ) != 4)
+			return mShapes[k]->ContainsPoint (x, y);
+
+		const float *plane = &mPlanes[12 * k];
+
+#ifdef __SSE2__
+		__m128 f = _mm_add_ps (_mm_add_ps (_mm_mul_ps (_mm_loadu_ps (plane), _mm_set1_ps (x)),
+				_mm_mul_ps (_mm_loadu_ps (plane + 4), _mm_set1_ps (y))), _mm_loadu_ps (plane + 8));
+
+		return _mm_movemask_ps (_mm_cmpge_ps (f, _mm_setzero_ps ( ))) == 0xF ||
+				_mm_movemask_ps (_mm_cmple_ps (f, _mm_setzero_ps ( ))) == 0xF;
+#else
+		bool below = false, above = false;
+
+		for (unsigned int i = 0; i < 4; i++) {
+			float f = plane[i] * x + plane[4 + i] * y + plane[8 + i];
+
+			if (f < 0) below = true;
+			if (f > 0) above = true;
+		}
+
+		return (below && above) == false;
+#endif
+	}
+
+	/* Reports every object containing the point as visit (k) */
+	template <class Visitor>
+	void Locate (float x, float y, Visitor& visit) const {
+
+		struct Filter {
+			const PointLocator& mLocator;
+			float mX, mY;
+			Visitor& mVisit;
+
+			Filter (const PointLocator& locator, float x, float y, Visitor& visit)
+				: mLocator (locator), mX (x), mY (y), mVisit (visit) { }
+
+			void operator() (unsigned int k) {
+				if (mLocator.Contains (k, mX, mY))
+					mVisit (k);
+			}
+		} filter (*this, x, y, visit);
+
+		HoldsPoint test (x, y);
+		mIndex.Search (test, filter);
+	}
+
+	/* counts[i] receives the number of objects containing point i */
+	void Count (const float *xy, unsigned int n, unsigned int *counts, unsigned int threads = 0) const {
+
+		if (threads == 0)
+			threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+		struct Counter {
+			unsigned int count;
+			Counter ( ) : count (0) { }
+			void operator() (unsigned int) { count++; }
+		};
+
+		struct Worker {
+			static void Run (const PointLocator *locator, const float *xy, const unsigned int *order,
+					unsigned int begin, unsigned int end, unsigned int *counts) {
+
+				for (unsigned int k = begin; k < end; k++) {
+					unsigned int i = order[k];
+					Counter counter;
+					locator->Locate (xy[2 * i], xy[2 * i + 1], counter);
+					counts[i] = counter.count;
+				}
+			}
+		};
+
+		std::vector<unsigned int> order;
+		std::vector<std::thread> pool;
+
+		CurveOrderPoints (xy, n, order, threads);
+
+		for (unsigned int t = 0; t < threads; t++)
+			pool.push_back (std::thread (Worker::Run, this, xy, order.data ( ),
+					RangeStart (n, threads, t), RangeStart (n, threads, t + 1), counts));
+
+		for (unsigned int t = 0; t < threads; t++)
+			pool[t].join ( );
+	}
+
+	/*
+	 * Reports a hit for every point of xy and every object containing it.
+	 * Point i of the batch has the id firstId + i, so that a stream can be
+	 * fed in batches. The sink is called with batches of hits as
+	 * sink (const std::vector<PointHit>&), one call at a time.
+	 */
+	template <class Sink>
+	void Hits (const float *xy, unsigned int n, unsigned int firstId, Sink& sink,
+			unsigned int threads = 0) const {
+
+		if (threads == 0)
+			threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+		struct Gatherer {
+			Sink& mSink;
+			std::mutex& mLock;
+			std::vector<PointHit> mFound;
+			unsigned int mId;
+
+			Gatherer (Sink& sink, std::mutex& lock) : mSink (sink), mLock (lock), mId (0) { }
+
+			void Flush ( ) {
+				if (mFound.empty ( ))
+					return;
+
+				std::lock_guard<std::mutex> guard (mLock);
+				mSink (mFound);
+				mFound.clear ( );
+			}
+
+			void operator() (unsigned int k) {
+				mFound.push_back (PointHit (mId, k));
+
+				if (mFound.size ( ) >= POINT_BATCH)
+					Flush ( );
+			}
+		};
+
+		struct Worker {
+			static void Run (const PointLocator *locator, const float *xy, const unsigned int *order,
+					unsigned int begin, unsigned int end, unsigned int firstId, Gatherer *gather) {
+
+				for (unsigned int k = begin; k < end; k++) {
+					unsigned int i = order[k];
+					gather->mId = firstId + i;
+					locator->Locate (xy[2 * i], xy[2 * i + 1], *gather);
+				}
+
+				gather->Flush ( );
+			}
+		};
+
+		std::mutex lock;
+		std::vector<unsigned int> order;
+		std::vector<Gatherer*> gatherers;
+		std::vector<std::thread> pool;
+
+		CurveOrderPoints (xy, n, order, threads);
+
+		for (unsigned int t = 0; t < threads; t++) {
+			gatherers.push_back (new Gatherer (sink, lock));
+			pool.push_back (std::thread (Worker::Run, this, xy, order.data ( ),
+					RangeStart (n, threads, t), RangeStart (n, threads, t + 1), firstId, gatherers.back ( )));
+		}
+
+		for (unsigned int t = 0; t < threads; t++) {
+			pool[t].join ( );
+			delete gatherers[t];
+		}
+	}
+};
+
+#endif /* POINTQUERY_H */
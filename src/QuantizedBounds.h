@@ -0,0 +1,422 @@
+/*============================================================================
+ Name        : QuantizedBounds.h
+ Author      : Nitin Puranik
+ Description : A compact store of bounding boxes for very large sets of
+ 	 	 	   objects inside a known world. Each box is kept as four
+ 	 	 	   16-bit integers relative to the origin of its tile, which
+ 	 	 	   quarters the memory the broad phase has to scan compared
+ 	 	 	   to double boxes and halves it compared to float boxes.
+ ============================================================================*/
+
+#ifndef QUANTIZEDBOUNDS_H
+#define QUANTIZEDBOUNDS_H
+
+#include <cmath>
+#include "BroadPhase.h"
+
+/*
+ * Number of grid cells from one tile origin to the next. A quantized
+ * coordinate can run up to 65535 cells, so a box may start anywhere
+ * in its tile and still reach a whole tile into the neighbouring one.
+ */
+#define QUANT_STEP 32768u
+#define QUANT_RANGE 65535u
+
+class QuantizedBoxSet {
+private:
+
+	/* A box in grid cells, relative to the origin of its tile */
+	struct QuantizedBox {
+		unsigned short xmin, ymin, xmax, ymax;
+	};
+
+	/* A box in grid cells, relative to the origin of the world */
+	struct GridBox {
+		unsigned int xmin, ymin, xmax, ymax;
+	};
+
+	/* The world, the tiling and the size of one grid cell */
+	BoundingBox mWorld;
+	unsigned int mTilesX, mTilesY;
+	double mCellX, mCellY;
+
+	/* The boxes grouped by tile, mTileStart[t] is where tile t begins */
+	std::vector<unsigned int> mTileStart;
+	std::vector<QuantizedBox> mBoxes;
+	std::vector<unsigned int> mIds;
+
+	/*
+	 * Boxes that do not fit the quantized range, either because they
+	 * are very wide or because they lie outside the world. These are
+	 * few and are kept at full precision.
+	 */
+	std::vector<BoundingBox> mWide;
+	std::vector<unsigned int> mWideIds;
+
+	/* The world coordinate of grid line g along the x or the y-axis */
+	double Grid (unsigned int g, bool yAxis) const {
+		return yAxis ? mWorld.ymin + g * mCellY : mWorld.xmin + g * mCellX;
+	}
+
+	unsigned int FloorCell (double v, bool yAxis) const;
+	unsigned int CeilCell (double v, bool yAxis) const;
+
+	bool Encode (const BoundingBox& box, unsigned int *tile, QuantizedBox *q) const;
+	GridBox Expand (unsigned int tile, unsigned int slot) const;
+
+	template <class Visitor>
+	void SweepTiles (unsigned int a, unsigned int b, Visitor& visit) const;
+
+public:
+	QuantizedBoxSet (const BoundingBox& world, unsigned int tilesX, unsigned int tilesY);
+
+	/* Quantizes the boxes. The position in the vector is the id of the box. */
+	void Build (const std::vector<BoundingBox>& boxes);
+
+	/* A conservative full precision box for the given slot */
+	BoundingBox Decode (unsigned int tile, unsigned int slot) const;
+
+	/*
+	 * Hands every pair of possibly overlapping boxes to the visitor.
+	 * Returns the number of boxes whose pairs have all been handed out.
+	 */
+	template <class Visitor>
+	unsigned int CandidatePairs (Visitor& visit, QueryBudget *budget = NULL) const;
+};
+
+/*
+ * The world is divided into tilesX by tilesY tiles, and every tile
+ * step is divided into QUANT_STEP grid cells along each axis.
+ */
+QuantizedBoxSet::QuantizedBoxSet (const BoundingBox& world, unsigned int tilesX, unsigned int tilesY)
+	: mWorld (world), mTilesX (tilesX ? tilesX : 1), mTilesY (tilesY ? tilesY : 1) {
+
+	mCellX = ((double) world.xmax - world.xmin) / ((double) mTilesX * QUANT_STEP);
+	mCellY = ((double) world.ymax - world.ymin) / ((double) mTilesY * QUANT_STEP);
+
+	/* A world that is flat along an axis still needs a non-zero cell */
+	if (mCellX <= 0) mCellX = 1;
+	if (mCellY <= 0) mCellY = 1;
+}
+
+/*
+ * Returns the grid line at or below v. The estimate is corrected
+ * against the very grid function used for decoding, so that the
+ * rounding is conservative no matter how the doubles round.
+ */
+unsigned int QuantizedBoxSet::FloorCell (double v, bool yAxis) const {
+
+	double est = yAxis ? (v - mWorld.ymin) / mCellY : (v - mWorld.xmin) / mCellX;
+	est = std::floor (est);
+
+	unsigned int g = est < 0 ? 0 : (unsigned int) est;
+
+	while (g > 0 && Grid (g, yAxis) > v)
+		g--;
+
+	return g;
+}
+
+/* Returns the grid line at or above v, corrected in the same way */
+unsigned int QuantizedBoxSet::CeilCell (double v, bool yAxis) const {
+
+	double est = yAxis ? (v - mWorld.ymin) / mCellY : (v - mWorld.xmin) / mCellX;
+	est = std::ceil (est);
+
+	unsigned int g = est < 0 ? 0 : (unsigned int) est;
+
+	while (Grid (g, yAxis) < v)
+		g++;
+
+	return g;
+}
+
+/*
+ * Quantizes one box into the tile holding its lower left corner.
+ * Returns false when the box cannot be represented, in which
+ * case it has to be kept at full precision.
+ */
+bool QuantizedBoxSet::Encode (const BoundingBox& box, unsigned int *tile, QuantizedBox *q) const {
+
+	/* Boxes outside the world are never quantized */
+	if (box.xmin < mWorld.xmin || box.ymin < mWorld.ymin ||
+			box.xmax > mWorld.xmax || box.ymax > mWorld.ymax)
+		return false;
+
+	unsigned int gxmin = FloorCell (box.xmin, false);
+	unsigned int gymin = FloorCell (box.ymin, true);
+	unsigned int gxmax = CeilCell (box.xmax, false);
+	unsigned int gymax = CeilCell (box.ymax, true);
+
+	/* Boxes touching the upper edge of the world belong to the last tile */
+	unsigned int tx = std::min (gxmin / QUANT_STEP, mTilesX - 1);
+	unsigned int ty = std::min (gymin / QUANT_STEP, mTilesY - 1);
+
+	unsigned int ox = tx * QUANT_STEP;
+	unsigned int oy = ty * QUANT_STEP;
+
+	/* Too wide for the 16-bit range of its tile */
+	if (gxmax - ox > QUANT_RANGE || gymax - oy > QUANT_RANGE)
+		return false;
+
+	q->xmin = (unsigned short) (gxmin - ox);
+	q->ymin = (unsigned short) (gymin - oy);
+	q->xmax = (unsigned short) (gxmax - ox);
+	q->ymax = (unsigned short) (gymax - oy);
+
+	*tile = ty * mTilesX + tx;
+	return true;
+}
+
+/*
+ * Quantizes all the boxes and groups them by tile. Within a tile
+ * the boxes are sorted by their left edge, ready to be swept.
+ */
+void QuantizedBoxSet::Build (const std::vector<BoundingBox>& boxes) {
+
+	unsigned int numTiles = mTilesX * mTilesY;
+
+	std::vector<unsigned int> tiles (boxes.size ( ));
+	std::vector<QuantizedBox> quant (boxes.size ( ));
+	std::vector<std::pair<unsigned long long, unsigned int> > order;
+
+	mWide.clear ( );
+	mWideIds.clear ( );
+
+	for (unsigned int i = 0; i < boxes.size ( ); i++) {
+
+		if (Encode (boxes[i], &tiles[i], &quant[i]) == false) {
+			mWide.push_back (boxes[i]);
+			mWideIds.push_back (i);
+			continue;
+		}
+
+		/* Sort key: the tile first, then the left edge within the tile */
+		unsigned long long key = ((unsigned long long) tiles[i] << 16) | quant[i].xmin;
+		order.push_back (std::make_pair (key, i));
+	}
+
+	std::sort (order.begin ( ), order.end ( ));
+
+	mTileStart.assign (numTiles + 1, 0);
+	mBoxes.resize (order.size ( ));
+	mIds.resize (order.size ( ));
+
+	for (unsigned int k = 0; k < order.size ( ); k++) {
+
+		unsigned int i = order[k].second;
+
+		mBoxes[k] = quant[i];
+		mIds[k] = i;
+		mTileStart[tiles[i] + 1]++;
+	}
+
+	for (unsigned int t = 0; t < numTiles; t++)
+		mTileStart[t + 1] += mTileStart[t];
+
+	mBoxes.shrink_to_fit ( );
+	mIds.shrink_to_fit ( );
+}
+
+/* Moves a quantized box from its tile origin to the world origin */
+QuantizedBoxSet::GridBox QuantizedBoxSet::Expand (unsigned int tile, unsigned int slot) const {
+
+	unsigned int ox = (tile % mTilesX) * QUANT_STEP;
+	unsigned int oy = (tile / mTilesX) * QUANT_STEP;
+
+	const QuantizedBox& q = mBoxes[slot];
+	GridBox g;
+
+	g.xmin = ox + q.xmin;
+	g.ymin = oy + q.ymin;
+	g.xmax = ox + q.xmax;
+	g.ymax = oy + q.ymax;
+
+	return g;
+}
+
+/*
+ * Decodes a quantized box. The decoded box is never smaller than
+ * the original one, but it may be a little larger. The float is
+ * nudged outwards where the conversion from double rounded inwards.
+ */
+BoundingBox QuantizedBoxSet::Decode (unsigned int tile, unsigned int slot) const {
+
+	GridBox g = Expand (tile, slot);
+	BoundingBox box;
+
+	double xmin = Grid (g.xmin, false), ymin = Grid (g.ymin, true);
+	double xmax = Grid (g.xmax, false), ymax = Grid (g.ymax, true);
+
+	box.xmin = (float) xmin;
+	box.ymin = (float) ymin;
+	box.xmax = (float) xmax;
+	box.ymax = (float) ymax;
+
+	if (box.xmin > xmin) box.xmin = std::nextafter (box.xmin, -HUGE_VALF);
+	if (box.ymin > ymin) box.ymin = std::nextafter (box.ymin, -HUGE_VALF);
+	if (box.xmax < xmax) box.xmax = std::nextafter (box.xmax, HUGE_VALF);
+	if (box.ymax < ymax) box.ymax = std::nextafter (box.ymax, HUGE_VALF);
+
+	return box;
+}
+
+/*
+ * Sweeps the boxes of tile a against the boxes of tile b along the
+ * x-axis. Both the tiles are already sorted by their left edges and
+ * share the same world grid, so the comparisons are exact integer
+ * comparisons. When a and b are the same tile this is the usual
+ * sweep and prune within the tile.
+ */
+template <class Visitor>
+void QuantizedBoxSet::SweepTiles (unsigned int a, unsigned int b, Visitor& visit) const {
+
+	unsigned int ia = mTileStart[a], ea = mTileStart[a + 1];
+	unsigned int ib = mTileStart[b], eb = mTileStart[b + 1];
+
+	if (a == b) {
+		for (; ia < ea; ia++) {
+
+			GridBox p = Expand (a, ia);
+
+			for (unsigned int j = ia + 1; j < ea; j++) {
+
+				GridBox q = Expand (a, j);
+
+				if (q.xmin > p.xmax)
+					break;
+
+				if (p.ymin <= q.ymax && q.ymin <= p.ymax)
+					visit (mIds[ia], mIds[j]);
+			}
+		}
+		return;
+	}
+
+	/* Merge the two sorted lists, always advancing the box that starts first */
+	while (ia < ea && ib < eb) {
+
+		GridBox p = Expand (a, ia);
+		GridBox q = Expand (b, ib);
+
+		if (p.xmin <= q.xmin) {
+			for (unsigned int j = ib; j < eb; j++) {
+
+				GridBox r = Expand (b, j);
+
+				if (r.xmin > p.xmax)
+					break;
+
+				if (p.ymin <= r.ymax && r.ymin <= p.ymax)
+					visit (mIds[ia], mIds[j]);
+			}
+			ia++;
+		}
+
+		else {
+			for (unsigned int j = ia; j < ea; j++) {
+
+				GridBox r = Expand (a, j);
+
+				if (r.xmin > q.xmax)
+					break;
+
+				if (q.ymin <= r.ymax && r.ymin <= q.ymax)
+					visit (mIds[j], mIds[ib]);
+			}
+			ib++;
+		}
+	}
+}
+
+/*
+ * Reports every candidate pair exactly once. A quantized box reaches
+ * at most one tile beyond its own, so each tile only needs to be swept
+ * against itself and four of its eight neighbours. The few full
+ * precision boxes are compared against the decoded quantized boxes.
+ * Once the budget, if any, runs out, it stops before the next tile or
+ * full precision box.
+ */
+template <class Visitor>
+unsigned int QuantizedBoxSet::CandidatePairs (Visitor& visit, QueryBudget *budget) const {
+
+	for (unsigned int ty = 0; ty < mTilesY; ty++) {
+		for (unsigned int tx = 0; tx < mTilesX; tx++) {
+
+			unsigned int t = ty * mTilesX + tx;
+
+			/* The tiles before this one have had all the pairs of their boxes visited */
+			if (BudgetExpired (budget))
+				return mTileStart[t];
+
+			SweepTiles (t, t, visit);
+
+			if (tx + 1 < mTilesX)
+				SweepTiles (t, t + 1, visit);
+
+			if (ty + 1 < mTilesY) {
+
+				SweepTiles (t, t + mTilesX, visit);
+
+				if (tx + 1 < mTilesX)
+					SweepTiles (t, t + mTilesX + 1, visit);
+
+				if (tx > 0)
+					SweepTiles (t, t + mTilesX - 1, visit);
+			}
+		}
+	}
+
+	for (unsigned int w = 0; w < mWide.size ( ); w++) {
+
+		if (BudgetExpired (budget))
+			return mIds.size ( ) + w;
+
+		const BoundingBox& a = mWide[w];
+
+		for (unsigned int t = 0; t + 1 < mTileStart.size ( ); t++) {
+			for (unsigned int k = mTileStart[t]; k < mTileStart[t + 1]; k++) {
+
+				BoundingBox b = Decode (t, k);
+
+				if (a.xmin <= b.xmax && b.xmin <= a.xmax && OverlapY (a, b))
+					visit (mWideIds[w], mIds[k]);
+			}
+		}
+
+		for (unsigned int v = w + 1; v < mWide.size ( ); v++) {
+
+			const BoundingBox& b = mWide[v];
+
+			if (a.xmin <= b.xmax && b.xmin <= a.xmax && OverlapY (a, b))
+				visit (mWideIds[w], mWideIds[v]);
+		}
+	}
+
+	return mIds.size ( ) + mWide.size ( );
+}
+
+/*
+ * Analyzes every pair of objects in the set, running the broad phase
+ * over quantized boxes. Only the candidate pairs go back to the full
+ * precision objects for ProcessData. Once the budget, if any, runs out
+ * the analysis stops before the next tile with the pairs found so far,
+ * and complete receives the share of the objects swept.
+ */
+void AnalyzeSetQuantized (std::vector<Shape*>& shapes, const BoundingBox& world,
+		unsigned int tilesX, unsigned int tilesY, std::vector<PairResult>& results,
+		QueryBudget *budget = NULL, float *complete = NULL) {
+
+	QuantizedBoxSet quant (world, tilesX, tilesY);
+
+	{
+		std::vector<BoundingBox> boxes;
+		CollectBounds (shapes, boxes);
+		quant.Build (boxes);
+	}
+
+	PairCollector collect (shapes, results);
+	ReportComplete (complete, quant.CandidatePairs (collect, budget), shapes.size ( ));
+}
+
+#endif /* QUANTIZEDBOUNDS_H */
@@ -0,0 +1,67 @@
+/*============================================================================
+ Name        : QueryBudget.h
+ Author      : Nitin Puranik
+ Description : Lets the caller of a long query stop it early, either by
+ 	 	 	   cancelling it from another thread or by giving it a deadline.
+ 	 	 	   The joins look at the budget between partitions, chunks or
+ 	 	 	   strips and every so many records or boxes within their
+ 	 	 	   longer loops, hand out what they have found so far and
+ 	 	 	   report how much of the work they got through.
+ ============================================================================*/
+
+#ifndef QUERYBUDGET_H
+#define QUERYBUDGET_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+
+class QueryBudget {
+private:
+	std::atomic<bool> mStopped;
+	bool mTimed;
+	std::chrono::steady_clock::time_point mDeadline;
+
+	QueryBudget (const QueryBudget&);
+	QueryBudget& operator= (const QueryBudget&);
+
+public:
+	/* A budget without a deadline, that only ends when cancelled */
+	QueryBudget ( ) : mStopped (false), mTimed (false) { }
+
+	/* A budget that ends the given number of milliseconds from now */
+	QueryBudget (unsigned int milliseconds) : mStopped (false), mTimed (true),
+		mDeadline (std::chrono::steady_clock::now ( ) + std::chrono::milliseconds (milliseconds)) { }
+
+	/* Stops the query at its next check. Safe to call from any thread. */
+	void Cancel ( ) {
+		mStopped.store (true, std::memory_order_relaxed);
+	}
+
+	/* Tells if the query should stop: it was cancelled or its deadline has passed */
+	bool Expired ( ) {
+
+		if (mStopped.load (std::memory_order_relaxed))
+			return true;
+
+		if (mTimed && std::chrono::steady_clock::now ( ) >= mDeadline) {
+			Cancel ( );
+			return true;
+		}
+
+		return false;
+	}
+};
+
+/* Tells if a query with the budget, if any, should stop */
+inline bool BudgetExpired (QueryBudget *budget) {
+	return budget != NULL && budget->Expired ( );
+}
+
+/* Reports the share of the work done, from 0 to 1, if the caller asked for it */
+inline void ReportComplete (float *complete, unsigned long long done, unsigned long long total) {
+	if (complete != NULL)
+		*complete = total ? (float) ((double) done / total) : 1;
+}
+
+#endif /* QUERYBUDGET_H */
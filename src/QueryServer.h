@@ -0,0 +1,985 @@
+/*============================================================================
+ Name        : QueryServer.h
+ Author      : Nitin Puranik
+ Description : A long running server that loads a set of objects once,
+ 	 	 	   indexes it and answers queries against it over a Unix
+ 	 	 	   domain socket or a localhost TCP port. Requests and answers
+ 	 	 	   are compact binary frames, a client may send many requests
+ 	 	 	   without waiting, and one epoll loop serves all the clients.
+ 	 	 	   Joins, which can run long, are run a slice at a time in
+ 	 	 	   between, as C++20 coroutines where the compiler has them,
+ 	 	 	   so that short queries never wait for one to finish.
+ 	 	 	   The server needs Linux.
+ ============================================================================*/
+
+#ifndef QUERYSERVER_H
+#define QUERYSERVER_H
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <deque>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "SpatialIndex.h"
+#include "BroadPhase.h"
+#include "PointQuery.h"
+
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#endif
+
+/* Connections waiting to be accepted, and events taken per wait */
+#define SERVER_BACKLOG 128
+#define SERVER_EVENTS 64
+
+/* Bytes read from a client at a time */
+#define SERVER_READ_CHUNK 65536
+
+/* The largest request accepted. A client that sends more is cut off. */
+#define SERVER_MAX_FRAME (1 << 20)
+
+/*
+ * Answers a client may have waiting before the server stops reading its
+ * requests and pauses its joins. A client that sends without reading is
+ * slowed down, not the rest of them.
+ */
+#define SERVER_OUTPUT_LIMIT (4 << 20)
+
+/* Microseconds a join runs before it lets the loop see to the clients */
+#define JOIN_SLICE 200
+
+/* Pairs a join gathers before it hands them out as one frame */
+#define JOIN_FRAME 4096
+
+/*
+ * The protocol. Every request is a RequestHeader followed by length
+ * bytes of payload, and is answered by a ResponseHeader followed by
+ * length bytes. The tag of a request is handed back as is. Queries are
+ * answered in the order they came in; a join is answered whenever it is
+ * done, which may be after later queries, so answers go by their tag.
+ * All numbers are in native byte order.
+ *
+ * queryPing       no payload. Answered with nothing.
+ * queryOverlap    8 floats, a rectangle. Answered with an OverlapRecord
+ *                 for every object that is not apart from it.
+ * queryPoint      2 floats, a point. Answered with the position of every
+ *                 object holding it, edges included, as unsigned ints.
+ * queryIntersect  8 floats, a rectangle. For every object whose edges
+ *                 cross its edges: the position of the object, the number
+ *                 of points, and the points, two floats each.
+ * queryJoin       4 floats, a window: xmin, ymin, xmax, ymax. Answered
+ *                 with a JoinRecord for every pair of objects whose boxes
+ *                 overlap the window and that are not apart. The records
+ *                 come in frames of up to about JOIN_FRAME as they are
+ *                 found, all with the tag of the request. Every frame but
+ *                 the last has status statusMore.
+ */
+enum QueryOp { queryPing = 0, queryOverlap = 1, queryPoint = 2, queryIntersect = 3, queryJoin = 4 };
+
+enum QueryStatus { statusOk = 0, statusBadRequest = 1, statusUnknownOp = 2, statusMore = 3 };
+
+struct RequestHeader {
+	unsigned int length;
+	unsigned int tag;
+	unsigned short op;
+	unsigned short reserved;
+};
+
+struct ResponseHeader {
+	unsigned int length;
+	unsigned int tag;
+	unsigned short op;
+	unsigned short status;
+};
+
+/*
+ * An object that is not apart from the query rectangle. For contain,
+ * which is 0 if the query contains the object, 1 if the object
+ * contains the query.
+ */
+struct OverlapRecord {
+	unsigned int object;
+	unsigned short type;
+	unsigned short which;
+};
+
+/* A pair found by a join, first below second, with the results of Classify */
+struct JoinRecord {
+	unsigned int first, second;
+	unsigned short type;
+	unsigned short which;
+};
+
+/*
+ * A join in progress. Advance picks up where the last call stopped and
+ * goes through the objects in the window one by one, each against the
+ * later objects its box overlaps, for one slice of time or until a
+ * frame of pairs is found, whichever comes first.
+ */
+struct JoinCursor {
+	const std::vector<Shape*>& mShapes;
+	const SpatialIndex& mIndex;
+	BoundingBox mWindow;
+	std::vector<unsigned int> mObjects;
+	std::vector<char> mFound;
+	unsigned int mNext;
+
+	JoinCursor (const std::vector<Shape*>& shapes, const SpatialIndex& index, const BoundingBox& window)
+		: mShapes (shapes), mIndex (index), mWindow (window), mNext (0) {
+
+		struct Gather {
+			std::vector<unsigned int>& mObjects;
+
+			Gather (std::vector<unsigned int>& objects) : mObjects (objects) { }
+
+			void operator() (unsigned int k) { mObjects.push_back (k); }
+		} gather (mObjects);
+
+		mIndex.Query (mWindow, gather);
+		std::sort (mObjects.begin ( ), mObjects.end ( ));
+	}
+
+	/* Returns false once every pair is done */
+	bool Advance ( ) {
+
+		std::chrono::steady_clock::time_point until =
+				std::chrono::steady_clock::now ( ) + std::chrono::microseconds (JOIN_SLICE);
+
+		struct Partner {
+			JoinCursor& mCursor;
+			unsigned int mFirst;
+
+			Partner (JoinCursor& cursor, unsigned int first) : mCursor (cursor), mFirst (first) { }
+
+			void operator() (unsigned int k) {
+
+				const BoundingBox& b = mCursor.mIndex.Box (k);
+				const BoundingBox& w = mCursor.mWindow;
+
+				if (k <= mFirst || b.xmin > w.xmax || w.xmin > b.xmax || b.ymin > w.ymax || w.ymin > b.ymax)
+					return;
+
+				int which;
+				CollisionType type = Classify (*mCursor.mShapes[mFirst], *mCursor.mShapes[k], &which);
+
+				if (type == apart)
+					return;
+
+				JoinRecord rec = { mFirst, k, (unsigned short) type, (unsigned short) which };
+				const char *p = (const char *) &rec;
+				mCursor.mFound.insert (mCursor.mFound.end ( ), p, p + sizeof (rec));
+			}
+		};
+
+		/* The clock is read once per object, which has a handful of partners at most */
+		while (mNext < mObjects.size ( )) {
+
+			Partner partner (*this, mObjects[mNext++]);
+			mIndex.Query (mIndex.Box (partner.mFirst), partner);
+
+			if (mFound.size ( ) >= JOIN_FRAME * sizeof (JoinRecord) || std::chrono::steady_clock::now ( ) >= until)
+				break;
+		}
+
+		return mNext < mObjects.size ( );
+	}
+};
+
+#ifdef __cpp_impl_coroutine
+
+/*
+ * A join as a coroutine. It starts suspended, and each resume runs one
+ * slice of the join, up to the next co_await, where control goes back
+ * to the loop.
+ */
+struct JoinRoutine {
+	struct promise_type {
+		JoinRoutine get_return_object ( ) {
+			return JoinRoutine (std::coroutine_handle<promise_type>::from_promise (*this));
+		}
+
+		std::suspend_always initial_suspend ( ) noexcept { return std::suspend_always ( ); }
+		std::suspend_always final_suspend ( ) noexcept { return std::suspend_always ( ); }
+		void return_void ( ) { }
+		void unhandled_exception ( ) { std::terminate ( ); }
+	};
+
+	std::coroutine_handle<promise_type> mHandle;
+
+	explicit JoinRoutine (std::coroutine_handle<promise_type> handle) : mHandle (handle) { }
+};
+
+JoinRoutine RunJoin (JoinCursor *cursor) {
+
+	while (cursor->Advance ( ))
+		co_await std::suspend_always ( );
+}
+
+#endif
+
+/* Builds an object from the points of a request, or returns NULL if they are ill formed */
+typedef Shape *(*ShapeMaker) (const float *points);
+
+/* Set from the signal handler to stop the loop */
+static volatile sig_atomic_t ServerStopping = 0;
+
+inline void StopServer (int) {
+	ServerStopping = 1;
+}
+
+/*
+ * Fills in a TCP address: "tcp:<port>" for a port on the loopback
+ * address, "tcp:<host>:<port>" for a port on the given IPv4 address.
+ */
+bool TcpAddress (const char *address, sockaddr_in& addr) {
+
+	const char *host = address + 4;
+	const char *port = strrchr (host, ':');
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+
+	if (port == NULL) {
+		addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+		port = host;
+	}
+
+	else {
+		if (inet_pton (AF_INET, std::string (host, port).c_str ( ), &addr.sin_addr) != 1) {
+			std::cerr << "Bad address " << address << std::endl;
+			return false;
+		}
+
+		port++;
+	}
+
+	addr.sin_port = htons ((unsigned short) atoi (port));
+	return true;
+}
+
+/* Fills in the address of a Unix socket at the path */
+bool UnixAddress (const char *address, sockaddr_un& addr) {
+
+	if (strlen (address) >= sizeof (addr.sun_path)) {
+		std::cerr << "Socket path too long: " << address << std::endl;
+		return false;
+	}
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, address);
+	return true;
+}
+
+/*
+ * Opens a listening socket: "tcp:..." for a TCP port as for TcpAddress,
+ * anything else for the path of a Unix socket. A socket left over at the
+ * path by an earlier run is replaced. Returns the socket, or -1 after
+ * reporting why.
+ */
+int ListenSocket (const char *address) {
+
+	int fd;
+
+	if (strncmp (address, "tcp:", 4) == 0) {
+
+		sockaddr_in addr;
+		int one = 1;
+
+		if (TcpAddress (address, addr) == false)
+			return -1;
+
+		fd = socket (AF_INET, SOCK_STREAM, 0);
+
+		if (fd >= 0 && (setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one)) != 0 ||
+				bind (fd, (sockaddr *) &addr, sizeof (addr)) != 0)) {
+			close (fd);
+			fd = -1;
+		}
+	}
+
+	else {
+		sockaddr_un addr;
+		struct stat st;
+
+		if (UnixAddress (address, addr) == false)
+			return -1;
+
+		/* Only ever a socket is removed, never a file that happens to be there */
+		if (stat (address, &st) == 0 && S_ISSOCK (st.st_mode))
+			unlink (address);
+
+		fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+		if (fd >= 0 && bind (fd, (sockaddr *) &addr, sizeof (addr)) != 0) {
+			close (fd);
+			fd = -1;
+		}
+	}
+
+	if (fd < 0) {
+		std::cerr << "Cannot bind " << address << ": " << strerror (errno) << std::endl;
+		return -1;
+	}
+
+	if (listen (fd, SERVER_BACKLOG) != 0) {
+		std::cerr << "Cannot listen on " << address << ": " << strerror (errno) << std::endl;
+		close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Connects to a socket listening at an address of the same form. Returns it, or -1 after reporting why. */
+int ConnectSocket (const char *address) {
+
+	int fd = -1;
+
+	if (strncmp (address, "tcp:", 4) == 0) {
+
+		sockaddr_in addr;
+
+		if (TcpAddress (address, addr) == false)
+			return -1;
+
+		fd = socket (AF_INET, SOCK_STREAM, 0);
+
+		if (fd >= 0 && connect (fd, (sockaddr *) &addr, sizeof (addr)) != 0) {
+			close (fd);
+			fd = -1;
+		}
+	}
+
+	else {
+		sockaddr_un addr;
+
+		if (UnixAddress (address, addr) == false)
+			return -1;
+
+		fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+		if (fd >= 0 && connect (fd, (sockaddr *) &addr, sizeof (addr)) != 0) {
+			close (fd);
+			fd = -1;
+		}
+	}
+
+	if (fd < 0)
+		std::cerr << "Cannot connect to " << address << ": " << strerror (errno) << std::endl;
+
+	return fd;
+}
+
+class QueryServer {
+private:
+
+	/*
+	 * A connected client, with the bytes it sent and those still to go
+	 * back. A client that is done sending still gets all its answers.
+	 * A client that goes away while joins of its own still run is kept,
+	 * closed, until the last of them is done.
+	 */
+	struct Client {
+		int fd;
+		std::vector<char> in, out;
+		size_t read, sent;
+		unsigned int events;
+		unsigned int joins;
+		bool ended, closed;
+
+		Client (int f) : fd (f), read (0), sent (0), events (EPOLLIN), joins (0), ended (false), closed (false) { }
+	};
+
+	/* A join waiting for its next slice, and whom it answers */
+	struct Join {
+		Client *client;
+		unsigned int tag;
+		JoinCursor cursor;
+#ifdef __cpp_impl_coroutine
+		JoinRoutine routine;
+#endif
+
+		Join (Client *c, unsigned int t, const std::vector<Shape*>& shapes, const SpatialIndex& index,
+				const BoundingBox& window)
+			: client (c), tag (t), cursor (shapes, index, window)
+#ifdef __cpp_impl_coroutine
+			  , routine (RunJoin (&cursor))
+#endif
+		{ }
+
+#ifdef __cpp_impl_coroutine
+		~Join ( ) { routine.mHandle.destroy ( ); }
+
+		/* Runs one slice, returns true once the join is done */
+		bool Step ( ) {
+			routine.mHandle.resume ( );
+			return routine.mHandle.done ( );
+		}
+#else
+		bool Step ( ) { return cursor.Advance ( ) == false; }
+#endif
+	};
+
+	const std::vector<Shape*>& mShapes;
+	ShapeMaker mMake;
+	SpatialIndex mIndex;
+
+	int mListen, mEpoll;
+	std::string mPath;
+	std::unordered_map<int, Client*> mClients;
+	std::deque<Join*> mJoins;
+
+	QueryServer (const QueryServer&);
+	QueryServer& operator= (const QueryServer&);
+
+	static bool NonBlocking (int fd) {
+		int flags = fcntl (fd, F_GETFL, 0);
+		return flags >= 0 && fcntl (fd, F_SETFL, flags | O_NONBLOCK) == 0;
+	}
+
+	/* Appends the raw bytes of a value to an answer */
+	template <class T>
+	static void Put (std::vector<char>& out, const T& value) {
+		const char *p = (const char *) &value;
+		out.insert (out.end ( ), p, p + sizeof (T));
+	}
+
+	/* The bytes of answers the client has yet to take */
+	static size_t Waiting (const Client *client) {
+		return client->out.size ( ) - client->sent;
+	}
+
+	void Accept ( );
+	void Close (Client *client);
+	void Watch (Client *client);
+	bool Receive (Client *client);
+	bool Send (Client *client);
+	bool Serve (Client *client);
+	bool JoinsReady ( ) const;
+	void RunJoins ( );
+
+	void Answer (const RequestHeader& request, const char *payload, Client *client);
+	QueryStatus Overlap (const float *points, std::vector<char>& out);
+	QueryStatus Point (const float *xy, std::vector<char>& out);
+	QueryStatus Intersect (const float *points, std::vector<char>& out);
+
+public:
+	QueryServer (const std::vector<Shape*>& shapes, ShapeMaker make)
+		: mShapes (shapes), mMake (make), mListen (-1), mEpoll (-1) {
+
+		std::vector<BoundingBox> boxes;
+		CollectBounds (shapes, boxes);
+		mIndex.Build (boxes);
+	}
+
+	~QueryServer ( );
+
+	/* Opens the listening socket at an address as for ListenSocket */
+	bool Listen (const char *address);
+
+	/* Serves clients until SIGINT or SIGTERM */
+	void Run ( );
+};
+
+QueryServer::~QueryServer ( ) {
+
+	for (unsigned int k = 0; k < mJoins.size ( ); k++) {
+		if (mJoins[k]->client->closed && --mJoins[k]->client->joins == 0)
+			delete mJoins[k]->client;
+
+		delete mJoins[k];
+	}
+
+	std::unordered_map<int, Client*>::iterator it;
+
+	for (it = mClients.begin ( ); it != mClients.end ( ); it++) {
+		close (it->first);
+		delete it->second;
+	}
+
+	if (mListen >= 0)
+		close (mListen);
+
+	if (mEpoll >= 0)
+		close (mEpoll);
+
+	if (mPath.empty ( ) == false)
+		unlink (mPath.c_str ( ));
+}
+
+bool QueryServer::Listen (const char *address) {
+
+	mListen = ListenSocket (address);
+
+	if (mListen < 0)
+		return false;
+
+	if (strncmp (address, "tcp:", 4) != 0)
+		mPath = address;
+
+	if (NonBlocking (mListen) == false) {
+		std::cerr << "Cannot listen on " << address << ": " << strerror (errno) << std::endl;
+		return false;
+	}
+
+	mEpoll = epoll_create1 (0);
+
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = mListen;
+
+	if (mEpoll < 0 || epoll_ctl (mEpoll, EPOLL_CTL_ADD, mListen, &ev) != 0) {
+		std::cerr << "Cannot set up epoll: " << strerror (errno) << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void QueryServer::Accept ( ) {
+
+	while (true) {
+
+		int fd = accept (mListen, NULL, NULL);
+
+		if (fd < 0)
+			return;
+
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+
+		if (NonBlocking (fd) == false || epoll_ctl (mEpoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			close (fd);
+			continue;
+		}
+
+		mClients[fd] = new Client (fd);
+	}
+}
+
+void QueryServer::Close (Client *client) {
+
+	epoll_ctl (mEpoll, EPOLL_CTL_DEL, client->fd, NULL);
+	close (client->fd);
+	mClients.erase (client->fd);
+
+	if (client->joins > 0)
+		client->closed = true;
+	else
+		delete client;
+}
+
+/*
+ * Listens for what the client can do next: send more requests while
+ * its answers stay under the limit, take more answers while any wait.
+ */
+void QueryServer::Watch (Client *client) {
+
+	size_t waiting = Waiting (client);
+	unsigned int events = (client->ended == false && waiting < SERVER_OUTPUT_LIMIT ? (unsigned int) EPOLLIN : 0u) |
+			(waiting > 0 ? (unsigned int) EPOLLOUT : 0u);
+
+	if (events == client->events)
+		return;
+
+	epoll_event ev;
+	ev.events = events;
+	ev.data.fd = client->fd;
+
+	epoll_ctl (mEpoll, EPOLL_CTL_MOD, client->fd, &ev);
+	client->events = events;
+}
+
+/* Reads what the client sent. Returns false on an error. */
+bool QueryServer::Receive (Client *client) {
+
+	/* Drop the requests already answered before taking in more */
+	if (client->read > 0) {
+		client->in.erase (client->in.begin ( ), client->in.begin ( ) + client->read);
+		client->read = 0;
+	}
+
+	size_t size = client->in.size ( );
+	client->in.resize (size + SERVER_READ_CHUNK);
+
+	ssize_t got = recv (client->fd, &client->in[size], SERVER_READ_CHUNK, 0);
+
+	client->in.resize (size + std::max ((ssize_t) 0, got));
+
+	if (got < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+	if (got == 0)
+		client->ended = true;
+
+	return true;
+}
+
+/* Sends what it can of the answers. Returns false once the client is gone. */
+bool QueryServer::Send (Client *client) {
+
+	while (client->sent < client->out.size ( )) {
+
+		ssize_t put = send (client->fd, &client->out[client->sent], client->out.size ( ) - client->sent,
+				MSG_NOSIGNAL);
+
+		if (put < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+		client->sent += put;
+	}
+
+	client->out.clear ( );
+	client->sent = 0;
+	return true;
+}
+
+/*
+ * Answers every whole request the client has sent, as long as its
+ * answers are taken. Returns false once the client is closed.
+ */
+bool QueryServer::Serve (Client *client) {
+
+	while (Waiting (client) < SERVER_OUTPUT_LIMIT) {
+
+		size_t left = client->in.size ( ) - client->read;
+		RequestHeader request;
+
+		if (left < sizeof (request))
+			break;
+
+		memcpy (&request, &client->in[client->read], sizeof (request));
+
+		if (request.length > SERVER_MAX_FRAME) {
+			Close (client);
+			return false;
+		}
+
+		if (left < sizeof (request) + request.length)
+			break;
+
+		Answer (request, &client->in[client->read + sizeof (request)], client);
+		client->read += sizeof (request) + request.length;
+	}
+
+	if (Send (client) == false) {
+		Close (client);
+		return false;
+	}
+
+	/* A client done sending goes once the last answer is out */
+	if (client->ended && client->out.empty ( ) && client->joins == 0) {
+		Close (client);
+		return false;
+	}
+
+	Watch (client);
+	return true;
+}
+
+void QueryServer::Answer (const RequestHeader& request, const char *payload, Client *client) {
+
+	/* A join is answered once it is done */
+	if (request.op == queryJoin && request.length == 4 * sizeof (float)) {
+
+		BoundingBox window;
+		memcpy (&window, payload, sizeof (window));
+
+		mJoins.push_back (new Join (client, request.tag, mShapes, mIndex, window));
+		client->joins++;
+		return;
+	}
+
+	std::vector<char>& out = client->out;
+	ResponseHeader response;
+	size_t start = out.size ( );
+
+	response.length = 0;
+	response.tag = request.tag;
+	response.op = request.op;
+	response.status = statusOk;
+
+	Put (out, response);
+
+	/* The payload may sit anywhere in the buffer, so it is copied out as floats */
+	float numbers[8];
+	unsigned int wanted = request.op == queryPoint ? 2 : 8;
+
+	if (request.op != queryPing && request.op != queryOverlap && request.op != queryPoint &&
+			request.op != queryIntersect && request.op != queryJoin)
+		response.status = statusUnknownOp;
+
+	else if (request.op == queryJoin || (request.op != queryPing && request.length != wanted * sizeof (float)))
+		response.status = statusBadRequest;
+
+	else if (request.op != queryPing) {
+
+		memcpy (numbers, payload, wanted * sizeof (float));
+
+		if (request.op == queryOverlap)
+			response.status = Overlap (numbers, out);
+
+		else if (request.op == queryPoint)
+			response.status = Point (numbers, out);
+
+		else
+			response.status = Intersect (numbers, out);
+	}
+
+	/* A failed request is answered with its status alone */
+	if (response.status != statusOk)
+		out.resize (start + sizeof (response));
+
+	response.length = out.size ( ) - start - sizeof (response);
+	memcpy (&out[start], &response, sizeof (response));
+}
+
+QueryStatus QueryServer::Overlap (const float *points, std::vector<char>& out) {
+
+	Shape *query = mMake (points);
+
+	if (query == NULL)
+		return statusBadRequest;
+
+	struct Collector {
+		const std::vector<Shape*>& mShapes;
+		const Shape& mQuery;
+		std::vector<char>& mOut;
+
+		Collector (const std::vector<Shape*>& shapes, const Shape& query, std::vector<char>& out)
+			: mShapes (shapes), mQuery (query), mOut (out) { }
+
+		void operator() (unsigned int k) {
+
+			int which;
+			CollisionType type = Classify (mQuery, *mShapes[k], &which);
+
+			if (type == apart)
+				return;
+
+			OverlapRecord rec = { k, (unsigned short) type, (unsigned short) which };
+			Put (mOut, rec);
+		}
+	} collect (mShapes, *query, out);
+
+	mIndex.Query (query->Bounds ( ), collect);
+
+	delete query;
+	return statusOk;
+}
+
+QueryStatus QueryServer::Point (const float *xy, std::vector<char>& out) {
+
+	struct Collector {
+		const std::vector<Shape*>& mShapes;
+		float mX, mY;
+		std::vector<char>& mOut;
+
+		Collector (const std::vector<Shape*>& shapes, float x, float y, std::vector<char>& out)
+			: mShapes (shapes), mX (x), mY (y), mOut (out) { }
+
+		void operator() (unsigned int k) {
+			if (mShapes[k]->ContainsPoint (mX, mY))
+				Put (mOut, k);
+		}
+	} collect (mShapes, xy[0], xy[1], out);
+
+	HoldsPoint test (xy[0], xy[1]);
+	mIndex.Search (test, collect);
+
+	return statusOk;
+}
+
+QueryStatus QueryServer::Intersect (const float *points, std::vector<char>& out) {
+
+	Shape *query = mMake (points);
+
+	if (query == NULL)
+		return statusBadRequest;
+
+	struct Collector {
+		const std::vector<Shape*>& mShapes;
+		const Shape& mQuery;
+		std::vector<char>& mOut;
+		std::vector<float> mPoints;
+
+		Collector (const std::vector<Shape*>& shapes, const Shape& query, std::vector<char>& out)
+			: mShapes (shapes), mQuery (query), mOut (out) { }
+
+		void operator() (unsigned int k) {
+
+			int which;
+
+			if (Classify (mQuery, *mShapes[k], &which) != none)
+				return;
+
+			IntersectionPoints (mQuery, *mShapes[k], mPoints);
+
+			Put (mOut, k);
+			Put (mOut, (unsigned int) (mPoints.size ( ) / 2));
+
+			for (unsigned int i = 0; i < mPoints.size ( ); i++)
+				Put (mOut, mPoints[i]);
+		}
+	} collect (mShapes, *query, out);
+
+	mIndex.Query (query->Bounds ( ), collect);
+
+	delete query;
+	return statusOk;
+}
+
+/*
+ * Tells if any join can run: one whose client has room for more answers,
+ * or is gone so that the join only has to be dropped.
+ */
+bool QueryServer::JoinsReady ( ) const {
+
+	for (unsigned int k = 0; k < mJoins.size ( ); k++)
+		if (mJoins[k]->client->closed || Waiting (mJoins[k]->client) < SERVER_OUTPUT_LIMIT)
+			return true;
+
+	return false;
+}
+
+/*
+ * Runs one slice of the join at the front and puts it at the back, so
+ * that joins take turns. Once a join has found a frame of pairs, or is
+ * done, what it found goes out to its client. A join whose client has
+ * not taken the answers it already has waits its turn without running.
+ */
+void QueryServer::RunJoins ( ) {
+
+	if (mJoins.empty ( ))
+		return;
+
+	Join *join = mJoins.front ( );
+	Client *client = join->client;
+
+	mJoins.pop_front ( );
+
+	if (client->closed == false && Waiting (client) >= SERVER_OUTPUT_LIMIT) {
+		mJoins.push_back (join);
+		return;
+	}
+
+	bool done = client->closed || join->Step ( );
+	std::vector<char>& found = join->cursor.mFound;
+
+	if (done == false && found.size ( ) < JOIN_FRAME * sizeof (JoinRecord)) {
+		mJoins.push_back (join);
+		return;
+	}
+
+	if (client->closed == false) {
+		ResponseHeader response = { (unsigned int) found.size ( ), join->tag, queryJoin,
+				(unsigned short) (done ? statusOk : statusMore) };
+
+		Put (client->out, response);
+		client->out.insert (client->out.end ( ), found.begin ( ), found.end ( ));
+		found.clear ( );
+	}
+
+	if (done == false) {
+		mJoins.push_back (join);
+		Serve (client);
+		return;
+	}
+
+	client->joins--;
+
+	if (client->closed) {
+		if (client->joins == 0)
+			delete client;
+	}
+
+	else
+		Serve (client);
+
+	delete join;
+}
+
+void QueryServer::Run ( ) {
+
+	/*
+	 * The stop signals are only let through while the loop waits, so
+	 * that one arriving in between cannot be missed.
+	 */
+	sigset_t stops, waiting;
+	struct sigaction action;
+
+	memset (&action, 0, sizeof (action));
+	action.sa_handler = StopServer;
+	sigaction (SIGINT, &action, NULL);
+	sigaction (SIGTERM, &action, NULL);
+
+	sigemptyset (&stops);
+	sigaddset (&stops, SIGINT);
+	sigaddset (&stops, SIGTERM);
+	sigprocmask (SIG_BLOCK, &stops, &waiting);
+	sigdelset (&waiting, SIGINT);
+	sigdelset (&waiting, SIGTERM);
+
+	epoll_event events[SERVER_EVENTS];
+
+	while (ServerStopping == 0) {
+
+		/* While a join can run, the loop only looks for events in between its slices */
+		int count = epoll_pwait (mEpoll, events, SERVER_EVENTS, JoinsReady ( ) ? 0 : -1, &waiting);
+
+		for (int e = 0; e < count; e++) {
+
+			int fd = events[e].data.fd;
+
+			if (fd == mListen) {
+				Accept ( );
+				continue;
+			}
+
+			std::unordered_map<int, Client*>::iterator it = mClients.find (fd);
+
+			if (it == mClients.end ( ))
+				continue;
+
+			Client *client = it->second;
+
+			/* Gone both ways: nothing can reach it, so its joins are dropped too */
+			if ((events[e].events & EPOLLERR) || ((events[e].events & EPOLLHUP) && client->ended)) {
+				Close (client);
+				continue;
+			}
+
+			/* A hang up may leave requests to read, so it is read like any input */
+			if ((events[e].events & (EPOLLIN | EPOLLHUP)) && client->ended == false &&
+					Receive (client) == false) {
+				Close (client);
+				continue;
+			}
+
+			Serve (client);
+		}
+
+		RunJoins ( );
+	}
+
+	sigprocmask (SIG_UNBLOCK, &stops, NULL);
+}
+
+#endif /* __linux__ */
+
+#endif /* QUERYSERVER_H */
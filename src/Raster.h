@@ -0,0 +1,366 @@
+/*============================================================================
+ Name        : Raster.h
+ Author      : Nitin Puranik
+ Description : Renders a set of objects into a grid of counts: for every
+ 	 	 	   cell, the number of objects that cover it. The grid serves
+ 	 	 	   as a density map, for quick approximate overlap answers,
+ 	 	 	   and, when rendered conservatively, as a mask that rejects
+ 	 	 	   pairs before Analyze. Objects are scan converted with edge
+ 	 	 	   functions, four cells at a time where SSE2 is available,
+ 	 	 	   and the grid is split into tiles rendered in parallel.
+ ============================================================================*/
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <atomic>
+#include <cfloat>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include "SpatialIndex.h"
+#include "BroadPhase.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Cells along each side of a tile. A tile is rendered by one thread. */
+#define RASTER_TILE 64
+
+/* The first bytes of a raster file, and the version of its layout */
+#define RASTER_MAGIC "RGRD"
+#define RASTER_VERSION 1
+
+/*
+ * How cells are counted. A sampled cell counts the objects that hold
+ * its centre. A conservative cell counts every object that touches it
+ * at all, edges included, so two objects can only touch where some cell
+ * counts both of them.
+ */
+enum RasterMode { sampled, conservative };
+
+/* The grid of counts, row by row from the bottom of the world */
+struct RasterGrid {
+	BoundingBox world;
+	unsigned int width, height;
+	std::vector<unsigned int> counts;
+
+	float CellWidth ( ) const { return (world.xmax - world.xmin) / width; }
+
+	float CellHeight ( ) const { return (world.ymax - world.ymin) / height; }
+
+	/* The range of cells the box overlaps along one axis, clamped to the grid */
+	void CellRange (float lo, float hi, bool yAxis, unsigned int *first, unsigned int *last) const {
+
+		float origin = yAxis ? world.ymin : world.xmin;
+		float size = yAxis ? CellHeight ( ) : CellWidth ( );
+		unsigned int cells = yAxis ? height : width;
+
+		float a = std::floor ((lo - origin) / size);
+		float b = std::floor ((hi - origin) / size);
+
+		/* An empty range when the box misses the grid */
+		if (b < 0 || a >= cells) {
+			*first = 1;
+			*last = 0;
+			return;
+		}
+
+		*first = a < 0 ? 0 : (unsigned int) a;
+		*last = b >= cells ? cells - 1 : (unsigned int) b;
+	}
+
+	/* Grows a range of cells by one cell on every side, clamped to the grid */
+	void Dilate (unsigned int *x0, unsigned int *x1, unsigned int *y0, unsigned int *y1) const {
+		*x0 = *x0 > 0 ? *x0 - 1 : 0;
+		*y0 = *y0 > 0 ? *y0 - 1 : 0;
+		*x1 = std::min (*x1 + 1, width - 1);
+		*y1 = std::min (*y1 + 1, height - 1);
+	}
+};
+
+/*
+ * The edge functions of an object. For every edge, a * x + b * y + c is
+ * positive on the inner side of the edge, whichever way the object winds.
+ * slack is how far the function can grow across half a cell, rounded
+ * outward: by a share of itself, and by the rounding of the function at
+ * coordinates as large as reach, so that a boundary lying right on a
+ * cell line still passes.
+ */
+struct EdgeFunctions {
+	unsigned int count;
+	std::vector<float> a, b, c, slack;
+
+	void Setup (const Shape& S, float halfW, float halfH, float reachX, float reachY) {
+
+		const float *p = S.Points ( );
+		const float *n = S.Normals ( );
+
+		/* The prepared normals point outward for a counter-clockwise object */
+		float area = 0;
+
+		for (unsigned int i = 0; i < S.NumSides ( ); i++) {
+			unsigned int k = (i + 1) % S.NumSides ( );
+			area += p[2 * i] * p[2 * k + 1] - p[2 * k] * p[2 * i + 1];
+		}
+
+		float sign = area > 0 ? -1 : 1;
+
+		count = S.NumSides ( );
+		a.resize (count);
+		b.resize (count);
+		c.resize (count);
+		slack.resize (count);
+
+		for (unsigned int i = 0; i < count; i++) {
+			a[i] = sign * n[2 * i];
+			b[i] = sign * n[2 * i + 1];
+			c[i] = -(a[i] * p[2 * i] + b[i] * p[2 * i + 1]);
+			slack[i] = (std::fabs (a[i]) * halfW + std::fabs (b[i]) * halfH) * (1 + 1.0f / 16) +
+					8 * FLT_EPSILON * (std::fabs (a[i]) * reachX + std::fabs (b[i]) * reachY + std::fabs (c[i]));
+		}
+	}
+};
+
+/*
+ * Adds one to the cells from first to last of a row that pass every
+ * edge function at their centres. y is the centre of the row, x0 that
+ * of the first cell and dx the cell width. With conservative set, the
+ * functions are given the slack of half a cell and zero passes.
+ */
+void RasterRow (const EdgeFunctions& edges, bool conservative, float x0, float dx, float y,
+		unsigned int *row, unsigned int first, unsigned int last) {
+
+	unsigned int i = first;
+
+#ifdef __SSE2__
+	const __m128 steps = _mm_set_ps (3, 2, 1, 0);
+
+	for (; i + 3 <= last; i += 4) {
+
+		__m128 x = _mm_add_ps (_mm_set1_ps (x0 + (i - first) * dx), _mm_mul_ps (steps, _mm_set1_ps (dx)));
+		__m128 inside = _mm_castsi128_ps (_mm_set1_epi32 (-1));
+
+		for (unsigned int e = 0; e < edges.count; e++) {
+
+			__m128 f = _mm_add_ps (_mm_mul_ps (_mm_set1_ps (edges.a[e]), x),
+					_mm_set1_ps (edges.b[e] * y + edges.c[e]));
+
+			if (conservative)
+				inside = _mm_and_ps (inside, _mm_cmpge_ps (_mm_add_ps (f, _mm_set1_ps (edges.slack[e])),
+						_mm_setzero_ps ( )));
+			else
+				inside = _mm_and_ps (inside, _mm_cmpgt_ps (f, _mm_setzero_ps ( )));
+		}
+
+		/* A passing lane is all ones, that is -1, so subtracting adds one */
+		__m128i counts = _mm_loadu_si128 ((const __m128i *) (row + i));
+		counts = _mm_sub_epi32 (counts, _mm_castps_si128 (inside));
+		_mm_storeu_si128 ((__m128i *) (row + i), counts);
+	}
+#endif
+
+	for (; i <= last; i++) {
+
+		float x = x0 + (i - first) * dx;
+		bool inside = true;
+
+		for (unsigned int e = 0; inside && e < edges.count; e++) {
+			float f = edges.a[e] * x + edges.b[e] * y + edges.c[e];
+			inside = conservative ? f + edges.slack[e] >= 0 : f > 0;
+		}
+
+		if (inside)
+			row[i]++;
+	}
+}
+
+/*
+ * Renders the tiles of the grid, taking them one at a time from a
+ * shared counter. The objects of a tile are looked up in the index.
+ */
+struct TileRenderer {
+	const std::vector<Shape*>& mShapes;
+	const SpatialIndex& mIndex;
+	RasterMode mMode;
+	RasterGrid& mGrid;
+	std::atomic<unsigned int>& mNext;
+
+	unsigned int mX0, mX1, mY0, mY1;
+	EdgeFunctions mEdges;
+
+	TileRenderer (const std::vector<Shape*>& shapes, const SpatialIndex& index, RasterMode mode,
+			RasterGrid& grid, std::atomic<unsigned int>& next)
+		: mShapes (shapes), mIndex (index), mMode (mode), mGrid (grid), mNext (next),
+		  mX0 (0), mX1 (0), mY0 (0), mY1 (0) { }
+
+	/* Renders one object into the current tile */
+	void operator() (unsigned int k) {
+
+		const BoundingBox& box = mShapes[k]->Bounds ( );
+		float dx = mGrid.CellWidth ( ), dy = mGrid.CellHeight ( );
+		unsigned int cx0, cx1, cy0, cy1;
+
+		mGrid.CellRange (box.xmin, box.xmax, false, &cx0, &cx1);
+		mGrid.CellRange (box.ymin, box.ymax, true, &cy0, &cy1);
+
+		/* A box edge on a cell line may round into either cell; the edge functions decide */
+		if (mMode == conservative && cx0 <= cx1 && cy0 <= cy1)
+			mGrid.Dilate (&cx0, &cx1, &cy0, &cy1);
+
+		cx0 = std::max (cx0, mX0);
+		cx1 = std::min (cx1, mX1);
+		cy0 = std::max (cy0, mY0);
+		cy1 = std::min (cy1, mY1);
+
+		if (cx0 > cx1 || cy0 > cy1)
+			return;
+
+		float reachX = std::max (std::fabs (mGrid.world.xmin), std::fabs (mGrid.world.xmax)) + dx;
+		float reachY = std::max (std::fabs (mGrid.world.ymin), std::fabs (mGrid.world.ymax)) + dy;
+
+		mEdges.Setup (*mShapes[k], 0.5f * dx, 0.5f * dy, reachX, reachY);
+
+		for (unsigned int cy = cy0; cy <= cy1; cy++)
+			RasterRow (mEdges, mMode == conservative, mGrid.world.xmin + (cx0 + 0.5f) * dx, dx,
+					mGrid.world.ymin + (cy + 0.5f) * dy, &mGrid.counts[cy * mGrid.width], cx0, cx1);
+	}
+
+	void Run ( ) {
+
+		unsigned int tilesX = (mGrid.width + RASTER_TILE - 1) / RASTER_TILE;
+		unsigned int tilesY = (mGrid.height + RASTER_TILE - 1) / RASTER_TILE;
+		float dx = mGrid.CellWidth ( ), dy = mGrid.CellHeight ( );
+
+		for (unsigned int t = mNext++; t < tilesX * tilesY; t = mNext++) {
+
+			mX0 = (t % tilesX) * RASTER_TILE;
+			mY0 = (t / tilesX) * RASTER_TILE;
+			mX1 = std::min (mGrid.width, mX0 + RASTER_TILE) - 1;
+			mY1 = std::min (mGrid.height, mY0 + RASTER_TILE) - 1;
+
+			BoundingBox area;
+
+			area.xmin = mGrid.world.xmin + mX0 * dx;
+			area.ymin = mGrid.world.ymin + mY0 * dy;
+			area.xmax = mGrid.world.xmin + (mX1 + 1) * dx;
+			area.ymax = mGrid.world.ymin + (mY1 + 1) * dy;
+
+			mIndex.Query (area, *this);
+		}
+	}
+};
+
+/* Renders the objects into a width x height grid laid over the world */
+void Rasterize (const std::vector<Shape*>& shapes, const BoundingBox& world, unsigned int width,
+		unsigned int height, RasterMode mode, RasterGrid& grid, unsigned int threads = 0) {
+
+	if (threads == 0)
+		threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+	grid.world = world;
+	grid.width = width;
+	grid.height = height;
+	grid.counts.assign ((size_t) width * height, 0);
+
+	if (width == 0 || height == 0 || world.xmax <= world.xmin || world.ymax <= world.ymin)
+		return;
+
+	std::vector<BoundingBox> boxes;
+	CollectBounds (shapes, boxes);
+
+	SpatialIndex index (boxes);
+
+	struct Worker {
+		static void Run (TileRenderer *renderer) {
+			renderer->Run ( );
+		}
+	};
+
+	std::atomic<unsigned int> next (0);
+	std::vector<TileRenderer*> renderers;
+	std::vector<std::thread> pool;
+
+	for (unsigned int t = 0; t < threads; t++) {
+		renderers.push_back (new TileRenderer (shapes, index, mode, grid, next));
+		pool.push_back (std::thread (Worker::Run, renderers.back ( )));
+	}
+
+	for (unsigned int t = 0; t < threads; t++) {
+		pool[t].join ( );
+		delete renderers[t];
+	}
+}
+
+/*
+ * Tells if two objects with the given boxes may touch according to a
+ * conservative grid: only if some cell in the overlap of their boxes,
+ * or next to it, is touched by two objects or more. The cells next to
+ * it are looked at too, as an overlap on a cell line may round into the
+ * cell on either side.
+ */
+bool MaskAllows (const RasterGrid& grid, const BoundingBox& a, const BoundingBox& b) {
+
+	unsigned int cx0, cx1, cy0, cy1;
+
+	grid.CellRange (std::max (a.xmin, b.xmin), std::min (a.xmax, b.xmax), false, &cx0, &cx1);
+	grid.CellRange (std::max (a.ymin, b.ymin), std::min (a.ymax, b.ymax), true, &cy0, &cy1);
+
+	if (cx0 > cx1 || cy0 > cy1)
+		return false;
+
+	grid.Dilate (&cx0, &cx1, &cy0, &cy1);
+
+	for (unsigned int cy = cy0; cy <= cy1; cy++)
+		for (unsigned int cx = cx0; cx <= cx1; cx++)
+			if (grid.counts[cy * grid.width + cx] >= 2)
+				return true;
+
+	return false;
+}
+
+/*
+ * The header of a raster file. The counts follow right after it as
+ * width x height unsigned 32-bit integers in native byte order, row by
+ * row, so that a mapped file can be read in place.
+ */
+struct RasterHeader {
+	char magic[4];
+	unsigned int version;
+	unsigned int width, height;
+	float xmin, ymin, xmax, ymax;
+};
+
+bool WriteRaster (const char *path, const RasterGrid& grid) {
+
+	FILE *out = fopen (path, "wb");
+
+	if (out == NULL) {
+		std::cerr << "Cannot open " << path << std::endl;
+		return false;
+	}
+
+	RasterHeader header;
+
+	memcpy (header.magic, RASTER_MAGIC, 4);
+	header.version = RASTER_VERSION;
+	header.width = grid.width;
+	header.height = grid.height;
+	header.xmin = grid.world.xmin;
+	header.ymin = grid.world.ymin;
+	header.xmax = grid.world.xmax;
+	header.ymax = grid.world.ymax;
+
+	bool ok = fwrite (&header, sizeof (header), 1, out) == 1 &&
+			fwrite (grid.counts.data ( ), sizeof (unsigned int), grid.counts.size ( ), out) == grid.counts.size ( );
+
+	ok = (fclose (out) == 0) && ok;
+
+	if (ok == false)
+		std::cerr << "Cannot write " << path << std::endl;
+
+	return ok;
+}
+
+#endif /* RASTER_H */
@@ -0,0 +1,503 @@
+/*============================================================================
+ Name        : RayQuery.h
+ Author      : Nitin Puranik
+ Description : Casts rays and segments through an indexed set of objects:
+ 	 	 	   the first object a ray hits, and every object a segment or
+ 	 	 	   a polyline crosses. Boxes are cut with slab tests, objects
+ 	 	 	   with the half-planes of their edges, and batches of rays
+ 	 	 	   walk the index together in packets of four.
+ ============================================================================*/
+
+#ifndef RAYQUERY_H
+#define RAYQUERY_H
+
+#include <cfloat>
+#include <thread>
+#include "SpatialIndex.h"
+#include "BroadPhase.h"
+#include "SpatialOrder.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Rays that walk the index together */
+#define RAY_PACKET 4
+
+/* The object of a ray that hits nothing */
+#define NO_HIT ((unsigned int) -1)
+
+/*
+ * A ray from (x, y) along (dx, dy), up to the parameter tmax. A segment
+ * from a to b is the ray from a along b - a with tmax 1, a ray without
+ * end has tmax FLT_MAX. Points on the ray are (x + t * dx, y + t * dy).
+ */
+struct Ray {
+	float x, y, dx, dy, tmax;
+};
+
+/* Where a ray first meets an object. x and y are the point of entry. */
+struct RayHit {
+	unsigned int object;
+	float t, x, y;
+};
+
+/*
+ * Cuts [*lo, *hi] down to the part of the ray within the slab from
+ * min to max along one axis, edges included. A ray parallel to the
+ * slab is either within it all along or nowhere.
+ */
+inline bool ClipSlab (float min, float max, float o, float d, float *lo, float *hi) {
+
+	if (d == 0)
+		return min <= o && o <= max;
+
+	float t1 = (min - o) / d, t2 = (max - o) / d;
+
+	if (t1 > t2)
+		std::swap (t1, t2);
+
+	*lo = std::max (*lo, t1);
+	*hi = std::min (*hi, t2);
+
+	return *lo <= *hi;
+}
+
+/* Tells if the ray meets the box before tmax, and if so from which t on */
+inline bool RayMeetsBox (const Ray& r, const BoundingBox& b, float tmax, float *tnear) {
+
+	float lo = 0, hi = tmax;
+
+	if (ClipSlab (b.xmin, b.xmax, r.x, r.dx, &lo, &hi) == false ||
+			ClipSlab (b.ymin, b.ymax, r.y, r.dy, &lo, &hi) == false)
+		return false;
+
+	*tnear = lo;
+	return true;
+}
+
+/*
+ * Clips the ray against the object, edges included: the slab test of
+ * a box, with the half-planes of the object's edges for slabs. Gives
+ * the part [*tin, *tout] of the ray inside the object and the edge it
+ * enters through, or -1 if the ray starts inside.
+ */
+bool ClipRay (const Shape& S, const Ray& r, float *tin, float *tout, int *edge) {
+
+	const float *p = S.Points ( );
+	const float *n = S.Normals ( );
+	unsigned int sides = S.NumSides ( );
+	float lo = 0, hi = r.tmax;
+
+	*edge = -1;
+
+	for (unsigned int i = 0; i < sides; i++) {
+
+		/* The side of the edge the far vertices lie on is the inner one */
+		unsigned int k = (i + 2) % sides;
+		float inner = n[2 * i] * (p[2 * k] - p[2 * i]) + n[2 * i + 1] * (p[2 * k + 1] - p[2 * i + 1]);
+		float sign = inner < 0 ? -1 : 1;
+
+		/* How far inside the edge the origin is, and how fast the ray goes in */
+		float at = sign * (n[2 * i] * (r.x - p[2 * i]) + n[2 * i + 1] * (r.y - p[2 * i + 1]));
+		float rate = sign * (n[2 * i] * r.dx + n[2 * i + 1] * r.dy);
+
+		if (rate == 0) {
+			if (at < 0)
+				return false;
+			continue;
+		}
+
+		float t = -at / rate;
+
+		if (rate > 0 && t > lo) {
+			lo = t;
+			*edge = i;
+		}
+
+		else if (rate < 0 && t < hi)
+			hi = t;
+
+		if (lo > hi)
+			return false;
+	}
+
+	*tin = lo;
+	*tout = hi;
+	return true;
+}
+
+/*
+ * The point where the ray enters the object through the edge. It is
+ * worked out as in FindIntersection, which puts it exactly on edges
+ * along the axes.
+ */
+void EntryPoint (const Shape& S, const Ray& r, float t, int edge, float *x, float *y) {
+
+	*x = r.x + t * r.dx;
+	*y = r.y + t * r.dy;
+
+	if (edge < 0)
+		return;
+
+	const float *p = S.Points ( );
+	unsigned int sides = S.NumSides ( );
+
+	float x1 = p[2 * edge], y1 = p[2 * edge + 1];
+	float x2 = p[(2 * edge + 2) % (2 * sides)], y2 = p[(2 * edge + 3) % (2 * sides)];
+	float ex, ey;
+
+	if (EdgeLineIntersection (r.x, r.y, r.x + r.dx, r.y + r.dy, x1, y1, x2, y2, &ex, &ey)) {
+		*x = ex;
+		*y = ey;
+	}
+}
+
+/*
+ * Up to four rays walking the index together, laid out lane by lane.
+ * best holds how far each ray still has to look: the t of its nearest
+ * hit so far. Lanes without a ray have a best below zero and never pass.
+ */
+struct RayPacket {
+	unsigned int count;
+	float x[RAY_PACKET], y[RAY_PACKET];
+	float dx[RAY_PACKET], dy[RAY_PACKET];
+	float best[RAY_PACKET];
+	const Ray *rays[RAY_PACKET];
+
+	RayPacket (const Ray *const *r, unsigned int n) : count (n) {
+
+		for (unsigned int l = 0; l < RAY_PACKET; l++) {
+
+			rays[l] = l < n ? r[l] : r[0];
+			x[l] = rays[l]->x;
+			y[l] = rays[l]->y;
+			dx[l] = rays[l]->dx;
+			dy[l] = rays[l]->dy;
+			best[l] = l < n ? rays[l]->tmax : -1;
+		}
+	}
+
+	/*
+	 * The rays that meet the box before their best, as a bit per lane,
+	 * and the least t at which any of them does.
+	 */
+	unsigned int Meets (const BoundingBox& b, float *tnear) const {
+
+		unsigned int mask = 0;
+
+#ifdef __SSE2__
+		const __m128 big = _mm_set1_ps (FLT_MAX);
+		__m128 lo = _mm_setzero_ps ( ), hi = _mm_loadu_ps (best);
+
+		for (unsigned int axis = 0; axis < 2; axis++) {
+
+			__m128 o = _mm_loadu_ps (axis ? y : x);
+			__m128 d = _mm_loadu_ps (axis ? dy : dx);
+			__m128 min = _mm_set1_ps (axis ? b.ymin : b.xmin);
+			__m128 max = _mm_set1_ps (axis ? b.ymax : b.xmax);
+
+			/*
+			 * Divided as in ClipSlab, so that both agree to the last bit. A
+			 * ray parallel to the slab is let through all along or not at all.
+			 */
+			__m128 t1 = _mm_div_ps (_mm_sub_ps (min, o), d);
+			__m128 t2 = _mm_div_ps (_mm_sub_ps (max, o), d);
+			__m128 enter = _mm_min_ps (t1, t2), leave = _mm_max_ps (t1, t2);
+
+			__m128 flat = _mm_cmpeq_ps (d, _mm_setzero_ps ( ));
+			__m128 within = _mm_and_ps (_mm_cmple_ps (min, o), _mm_cmple_ps (o, max));
+			__m128 open = _mm_or_ps (_mm_and_ps (within, _mm_sub_ps (_mm_setzero_ps ( ), big)),
+					_mm_andnot_ps (within, big));
+
+			enter = _mm_or_ps (_mm_and_ps (flat, open), _mm_andnot_ps (flat, enter));
+			leave = _mm_or_ps (_mm_and_ps (flat, _mm_sub_ps (_mm_setzero_ps ( ), open)), _mm_andnot_ps (flat, leave));
+
+			lo = _mm_max_ps (lo, enter);
+			hi = _mm_min_ps (hi, leave);
+		}
+
+		mask = _mm_movemask_ps (_mm_cmple_ps (lo, hi));
+
+		float from[RAY_PACKET];
+		_mm_storeu_ps (from, lo);
+		*tnear = FLT_MAX;
+
+		for (unsigned int l = 0; l < RAY_PACKET; l++)
+			if (mask & (1 << l))
+				*tnear = std::min (*tnear, from[l]);
+#else
+		*tnear = FLT_MAX;
+
+		for (unsigned int l = 0; l < RAY_PACKET; l++) {
+
+			float t;
+
+			if (best[l] >= 0 && RayMeetsBox (*rays[l], b, best[l], &t)) {
+				mask |= 1 << l;
+				*tnear = std::min (*tnear, t);
+			}
+		}
+#endif
+
+		return mask;
+	}
+};
+
+/*
+ * An indexed set of objects to cast rays into. The index holds on to
+ * the boxes of the set, so the set must not change while it is in use.
+ */
+class RayCaster {
+private:
+	const std::vector<Shape*>& mShapes;
+	SpatialIndex mIndex;
+
+	RayCaster (const RayCaster&);
+	RayCaster& operator= (const RayCaster&);
+
+	/* A node waiting to be walked, and the t from which a ray is in its box */
+	struct Waiting {
+		unsigned int node;
+		float t;
+
+		/* Farthest first, so that the nearest is pushed last */
+		bool operator< (const Waiting& w) const { return t > w.t; }
+	};
+
+	/* Keeps the hit if it is nearer than the best, or as near and of a lower object */
+	static void Consider (const Shape& S, unsigned int k, const Ray& r, RayHit *best) {
+
+		float tin, tout;
+		int edge;
+
+		if (ClipRay (S, r, &tin, &tout, &edge) == false)
+			return;
+
+		if (tin < best->t || (tin == best->t && k < best->object)) {
+			best->object = k;
+			best->t = tin;
+			EntryPoint (S, r, tin, edge, &best->x, &best->y);
+		}
+	}
+
+	/* Casts one packet of rays, leaving the hit of ray l in *hits[l] */
+	void CastPacket (const Ray *const *rays, unsigned int n, RayHit *const *hits) const {
+
+		RayPacket packet (rays, n);
+		RayHit found[RAY_PACKET];
+
+		for (unsigned int l = 0; l < n; l++) {
+			found[l].object = NO_HIT;
+			found[l].t = rays[l]->tmax;
+		}
+
+		unsigned int stack[INDEX_STACK];
+		unsigned int top = 0;
+		float t;
+
+		if (mIndex.Empty ( ) == false)
+			stack[top++] = mIndex.RootNode ( );
+
+		while (top > 0) {
+
+			const IndexNode& node = mIndex.Node (stack[--top]);
+
+			if (packet.Meets (node.box, &t) == 0)
+				continue;
+
+			if (node.leaf) {
+				for (unsigned int c = node.first; c < node.first + node.count; c++) {
+
+					unsigned int k = mIndex.Entry (c);
+					unsigned int mask = packet.Meets (mIndex.Box (k), &t);
+
+					for (unsigned int l = 0; l < n; l++) {
+						if ((mask & (1 << l)) == 0)
+							continue;
+
+						Consider (*mShapes[k], k, *rays[l], &found[l]);
+
+						/*
+						 * Boxes and objects are clipped with different sums, so
+						 * boxes are kept a little past the best. An object hit
+						 * at the same t then still gets its say in a tie.
+						 */
+						packet.best[l] = found[l].t + 4 * FLT_EPSILON * std::fabs (found[l].t);
+					}
+				}
+
+				continue;
+			}
+
+			/* The nearest child goes on top, to be walked first */
+			Waiting children[INDEX_FANOUT];
+			unsigned int count = 0;
+
+			for (unsigned int c = node.first; c < node.first + node.count; c++) {
+				if (packet.Meets (mIndex.Node (c).box, &t)) {
+					children[count].node = c;
+					children[count++].t = t;
+				}
+			}
+
+			std::sort (children, children + count);
+
+			for (unsigned int c = 0; c < count; c++)
+				stack[top++] = children[c].node;
+		}
+
+		for (unsigned int l = 0; l < n; l++)
+			*hits[l] = found[l];
+	}
+
+public:
+	RayCaster (const std::vector<Shape*>& shapes) : mShapes (shapes) {
+
+		std::vector<BoundingBox> boxes;
+		CollectBounds (shapes, boxes);
+		mIndex.Build (boxes);
+	}
+
+	/* The first object the ray hits; an object it starts in is hit at t = 0 */
+	RayHit FirstHit (const Ray& ray) const {
+
+		const Ray *rays[1] = { &ray };
+		RayHit hit, *hits[1] = { &hit };
+
+		CastPacket (rays, 1, hits);
+		return hit;
+	}
+
+	/*
+	 * The first hits of a batch of rays, hits[i] for rays[i]. The rays
+	 * are put in curve order by their origins and cast in packets of
+	 * neighbours, which mostly walk the same nodes. Each thread takes
+	 * an equal run of packets.
+	 */
+	void FirstHits (const std::vector<Ray>& rays, std::vector<RayHit>& hits, unsigned int threads = 0) const {
+
+		if (threads == 0)
+			threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+		hits.resize (rays.size ( ));
+
+		if (rays.empty ( ))
+			return;
+
+		std::vector<float> origins (2 * rays.size ( ));
+		std::vector<unsigned int> order;
+
+		for (unsigned int i = 0; i < rays.size ( ); i++) {
+			origins[2 * i] = rays[i].x;
+			origins[2 * i + 1] = rays[i].y;
+		}
+
+		CurveOrderPoints (&origins[0], rays.size ( ), order, threads);
+
+		struct Worker {
+			static void Run (const RayCaster *caster, const Ray *rays, const unsigned int *order,
+					unsigned int begin, unsigned int end, RayHit *hits) {
+
+				for (unsigned int k = begin; k < end; k += RAY_PACKET) {
+
+					unsigned int n = std::min (end - k, (unsigned int) RAY_PACKET);
+					const Ray *packet[RAY_PACKET];
+					RayHit *found[RAY_PACKET];
+
+					for (unsigned int l = 0; l < n; l++) {
+						packet[l] = &rays[order[k + l]];
+						found[l] = &hits[order[k + l]];
+					}
+
+					caster->CastPacket (packet, n, found);
+				}
+			}
+		};
+
+		/* Runs start on a packet boundary */
+		unsigned int packets = (rays.size ( ) + RAY_PACKET - 1) / RAY_PACKET;
+		std::vector<std::thread> pool;
+
+		for (unsigned int t = 0; t < threads; t++) {
+
+			unsigned int begin = RAY_PACKET * RangeStart (packets, threads, t);
+			unsigned int end = std::min ((unsigned int) rays.size ( ), RAY_PACKET * RangeStart (packets, threads, t + 1));
+
+			pool.push_back (std::thread (Worker::Run, this, rays.data ( ), order.data ( ), begin, end, hits.data ( )));
+		}
+
+		for (unsigned int t = 0; t < threads; t++)
+			pool[t].join ( );
+	}
+
+	/* Reports every object the ray crosses or touches before tmax as visit (k) */
+	template <class Visitor>
+	void Crossed (const Ray& ray, Visitor& visit) const {
+
+		struct Filter {
+			const std::vector<Shape*>& mShapes;
+			const Ray& mRay;
+			Visitor& mVisit;
+
+			Filter (const std::vector<Shape*>& shapes, const Ray& ray, Visitor& visit)
+				: mShapes (shapes), mRay (ray), mVisit (visit) { }
+
+			void operator() (unsigned int k) {
+				float tin, tout;
+				int edge;
+
+				if (ClipRay (*mShapes[k], mRay, &tin, &tout, &edge))
+					mVisit (k);
+			}
+		} filter (mShapes, ray, visit);
+
+		struct Meets {
+			const Ray& mRay;
+
+			Meets (const Ray& ray) : mRay (ray) { }
+
+			bool operator() (const BoundingBox& b) const {
+				float t;
+				return RayMeetsBox (mRay, b, mRay.tmax, &t);
+			}
+		} test (ray);
+
+		mIndex.Search (test, filter);
+	}
+
+	/*
+	 * Every object crossed or touched by the polyline through the n
+	 * points of xy (two floats each), sorted and each once. A single
+	 * point gives the objects holding it.
+	 */
+	void CrossedByPolyline (const float *xy, unsigned int n, std::vector<unsigned int>& objects) const {
+
+		struct Gather {
+			std::vector<unsigned int>& mObjects;
+
+			Gather (std::vector<unsigned int>& objects) : mObjects (objects) { }
+
+			void operator() (unsigned int k) { mObjects.push_back (k); }
+		} gather (objects);
+
+		objects.clear ( );
+
+		for (unsigned int k = 0; k < n; k++) {
+
+			/* The last point only ends the segment before it, unless it is alone */
+			if (k + 1 == n && n > 1)
+				break;
+
+			unsigned int e = (k + 1 < n) ? k + 1 : k;
+			Ray segment = { xy[2 * k], xy[2 * k + 1], xy[2 * e] - xy[2 * k], xy[2 * e + 1] - xy[2 * k + 1], 1 };
+
+			Crossed (segment, gather);
+		}
+
+		std::sort (objects.begin ( ), objects.end ( ));
+		objects.erase (std::unique (objects.begin ( ), objects.end ( )), objects.end ( ));
+	}
+};
+
+#endif /* RAYQUERY_H */
@@ -0,0 +1,93 @@
+/*============================================================================
+ Name        : SeparatingAxisCache.h
+ Author      : Nitin Puranik
+ Description : Remembers the edge that separated a pair of objects the last
+ 	 	 	   time they were analyzed. Objects that move a little between
+ 	 	 	   two queries are almost always still separated by that very
+ 	 	 	   edge, so a repeat query is settled with a single projection.
+ ============================================================================*/
+
+#ifndef SEPARATINGAXISCACHE_H
+#define SEPARATINGAXISCACHE_H
+
+#include "BaseClassShape.h"
+
+/*
+ * A fixed size, direct mapped table from a pair of ids to the edge
+ * that last separated the pair. A newer pair simply overwrites an
+ * older one in the same slot, so the memory use never grows. A stale
+ * or overwritten entry costs one projection, never a wrong answer,
+ * because the cached edge is always tested before it is trusted.
+ */
+class SeparatingAxisCache {
+private:
+
+	struct Slot {
+		unsigned long long key;
+
+		/* Whose edge separated the pair (0 or 1) and which edge, -1 if empty */
+		int which;
+		int edge;
+	};
+
+	std::vector<Slot> mSlots;
+
+	static unsigned long long PairKey (unsigned int a, unsigned int b) {
+		return ((unsigned long long) a << 32) | b;
+	}
+
+	Slot& Lookup (unsigned long long key) {
+
+		/* A 64-bit multiplicative hash spreads neighbouring ids */
+		unsigned long long h = key * 0x9E3779B97F4A7C15ULL;
+		return mSlots[(h >> 32) % mSlots.size ( )];
+	}
+
+public:
+	SeparatingAxisCache (unsigned int slots = 1 << 16) {
+		Slot empty = { 0, 0, -1 };
+		mSlots.assign (slots ? slots : 1, empty);
+	}
+
+	/*
+	 * ProcessData for the objects A and B with the ids a and b.
+	 * The cached separating edge, if any, is tried first. Otherwise
+	 * ProcessData runs as usual and the separating edge it finds is
+	 * remembered for the next query of the same pair.
+	 */
+	CollisionType ProcessData (unsigned int a, Shape& A, unsigned int b, Shape& B, int *which);
+
+	void Clear ( ) {
+		for (unsigned int i = 0; i < mSlots.size ( ); i++)
+			mSlots[i].edge = -1;
+	}
+};
+
+CollisionType SeparatingAxisCache::ProcessData (unsigned int a, Shape& A,
+		unsigned int b, Shape& B, int *which) {
+
+	unsigned long long key = PairKey (a, b);
+	Slot& slot = Lookup (key);
+
+	if (slot.key == key && slot.edge >= 0) {
+
+		const Shape& S = slot.which == 0 ? A : B;
+		const Shape& T = slot.which == 0 ? B : A;
+
+		if ((unsigned int) slot.edge < S.NumSides ( ) && SeparatedByEdge (S, T, slot.edge)) {
+			*which = slot.which;
+			return apart;
+		}
+	}
+
+	int edge = -1;
+	CollisionType ret = ::ProcessData (A, B, which, &edge);
+
+	slot.key = key;
+	slot.which = *which;
+	slot.edge = ret == apart ? edge : -1;
+
+	return ret;
+}
+
+#endif /* SEPARATINGAXISCACHE_H */
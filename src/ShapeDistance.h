@@ -0,0 +1,216 @@
+/*============================================================================
+ Name        : ShapeDistance.h
+ Author      : Nitin Puranik
+ Description : Distance queries between convex objects. These answer how
+ 	 	 	   far apart two objects are once Analyze has found them to be
+ 	 	 	   apart, using the same prepared edge data as Analyze.
+ ============================================================================*/
+
+#ifndef SHAPEDISTANCE_H
+#define SHAPEDISTANCE_H
+
+#include <cmath>
+#include <cfloat>
+#include "BaseClassShape.h"
+
+/* Projects the vertices of the object onto the axis (nx, ny) */
+void ProjectOnto (const Shape& S, float nx, float ny, float *lo, float *hi) {
+
+	const float *p = S.Points ( );
+
+	*lo = *hi = nx * p[0] + ny * p[1];
+
+	for (unsigned int j = 1; j < S.NumSides ( ); j++) {
+
+		float d = nx * p[2 * j] + ny * p[2 * j + 1];
+
+		if (d < *lo) *lo = d;
+		if (d > *hi) *hi = d;
+	}
+}
+
+/*
+ * The largest gap between the projections of the two objects over
+ * the unit edge normals of both. A positive gap is a lower bound on
+ * the distance between the objects, a negative one means they overlap.
+ * Making the normals unit length rounds, so objects that touch can come
+ * out a hair apart. A gap that small is settled by the separating line
+ * test of Analyze instead, on the unscaled normals, and objects that it
+ * does not find apart have a gap of 0.
+ */
+float SeparationGap (const Shape& A, const Shape& B) {
+
+	float best = -HUGE_VALF;
+	float scale = 0;
+
+	for (int s = 0; s < 2; s++) {
+
+		const Shape& S = s == 0 ? A : B;
+
+		for (unsigned int i = 0; i < S.NumSides ( ); i++) {
+
+			/* The rotated edge, as in Analyze, made unit length */
+			float nx = S.Normals ( )[2 * i];
+			float ny = S.Normals ( )[2 * i + 1];
+			float len = S.EdgeLengths ( )[i];
+
+			if (len == 0)
+				continue;
+
+			float a_lo, a_hi, b_lo, b_hi;
+
+			ProjectOnto (A, nx / len, ny / len, &a_lo, &a_hi);
+			ProjectOnto (B, nx / len, ny / len, &b_lo, &b_hi);
+
+			best = std::max (best, std::max (b_lo - a_hi, a_lo - b_hi));
+			scale = std::max (scale, std::max (std::max (std::fabs (a_lo), std::fabs (a_hi)),
+					std::max (std::fabs (b_lo), std::fabs (b_hi))));
+		}
+	}
+
+	int which;
+
+	if (best > 0 && best <= 16 * FLT_EPSILON * scale && Classify (A, B, &which) != apart)
+		return 0;
+
+	return best;
+}
+
+/*
+ * The squared distance from the point (px, py) to the edge of S whose
+ * start point is identified by index. The closest point on the edge
+ * is written to (cx, cy).
+ */
+float EdgeDistanceSq (const Shape& S, unsigned int index, float px, float py,
+		float *cx, float *cy) {
+
+	const float *p = S.Points ( );
+	unsigned int n = S.NumSides ( );
+
+	float x1 = p[2 * index], y1 = p[2 * index + 1];
+	float ex = p[(2 * index + 2) % (2 * n)] - x1;
+	float ey = p[(2 * index + 3) % (2 * n)] - y1;
+
+	float len = S.EdgeLengths ( )[index];
+	float t = len > 0 ? ((px - x1) * ex + (py - y1) * ey) / (len * len) : 0;
+
+	/* Clamp to the end points of the edge */
+	t = std::max (0.0f, std::min (1.0f, t));
+
+	*cx = x1 + t * ex;
+	*cy = y1 + t * ey;
+
+	return (px - *cx) * (px - *cx) + (py - *cy) * (py - *cy);
+}
+
+/* The distance from the point to the object, 0 for a point inside it or on an edge */
+float PointDistance (const Shape& S, float x, float y) {
+
+	if (S.ContainsPoint (x, y))
+		return 0;
+
+	float best = HUGE_VALF;
+
+	for (unsigned int i = 0; i < S.NumSides ( ); i++) {
+		float cx, cy;
+		best = std::min (best, EdgeDistanceSq (S, i, x, y, &cx, &cy));
+	}
+
+	return std::sqrt (best);
+}
+
+/*
+ * The Euclidean distance between two convex objects. For objects that
+ * are apart, the closest pair of points is always a vertex of one of
+ * them against an edge of the other. The closest points are written to
+ * pa and pb (two floats each) if given. Objects that touch or overlap
+ * are at distance 0 and the points are left alone.
+ */
+float Distance (const Shape& A, const Shape& B, float *pa = NULL, float *pb = NULL) {
+
+	if (SeparationGap (A, B) <= 0)
+		return 0;
+
+	float best = HUGE_VALF;
+
+	for (int s = 0; s < 2; s++) {
+
+		const Shape& V = s == 0 ? A : B;
+		const Shape& E = s == 0 ? B : A;
+		const float *p = V.Points ( );
+
+		for (unsigned int j = 0; j < V.NumSides ( ); j++) {
+			for (unsigned int i = 0; i < E.NumSides ( ); i++) {
+
+				float cx, cy;
+				float d = EdgeDistanceSq (E, i, p[2 * j], p[2 * j + 1], &cx, &cy);
+
+				if (d >= best)
+					continue;
+
+				best = d;
+
+				/* The vertex belongs to A on the first pass, to B on the second */
+				float *pv = s == 0 ? pa : pb;
+				float *pe = s == 0 ? pb : pa;
+
+				if (pv != NULL) {
+					pv[0] = p[2 * j];
+					pv[1] = p[2 * j + 1];
+				}
+
+				if (pe != NULL) {
+					pe[0] = cx;
+					pe[1] = cy;
+				}
+			}
+		}
+	}
+
+	return std::sqrt (best);
+}
+
+/*
+ * Tells if the two objects are within eps of each other, touching and
+ * overlapping objects included. Far apart pairs are rejected by their
+ * boxes or by a single separating gap, and close pairs are accepted as
+ * soon as one vertex is found close enough to an edge.
+ */
+bool WithinDistance (const Shape& A, const Shape& B, float eps) {
+
+	const BoundingBox& a = A.Bounds ( );
+	const BoundingBox& b = B.Bounds ( );
+
+	if (b.xmin - a.xmax > eps || a.xmin - b.xmax > eps ||
+			b.ymin - a.ymax > eps || a.ymin - b.ymax > eps)
+		return false;
+
+	float gap = SeparationGap (A, B);
+
+	if (gap > eps)
+		return false;
+
+	if (gap <= 0)
+		return true;
+
+	for (int s = 0; s < 2; s++) {
+
+		const Shape& V = s == 0 ? A : B;
+		const Shape& E = s == 0 ? B : A;
+		const float *p = V.Points ( );
+
+		for (unsigned int j = 0; j < V.NumSides ( ); j++) {
+			for (unsigned int i = 0; i < E.NumSides ( ); i++) {
+
+				float cx, cy;
+
+				if (EdgeDistanceSq (E, i, p[2 * j], p[2 * j + 1], &cx, &cy) <= eps * eps)
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+#endif /* SHAPEDISTANCE_H */
@@ -0,0 +1,118 @@
+/*============================================================================
+ Name        : ShapeFile.h
+ Author      : Nitin Puranik
+ Description : A plain binary file of rectangles, for sets too large to be
+ 	 	 	   typed in or kept as text. Each record is an id followed by
+ 	 	 	   the 8 coordinates in the same sequence as the user input.
+ 	 	 	   The files are always read and written sequentially.
+ ============================================================================*/
+
+#ifndef SHAPEFILE_H
+#define SHAPEFILE_H
+
+#include <cstdio>
+#include "BaseClassShape.h"
+
+/* Number of sides of every object stored in a record */
+#define RECORD_SIDES 4
+
+/* Size of the stdio buffer of every open record file */
+#define RECORD_BUFFER (1 << 16)
+
+struct ShapeRecord {
+	unsigned int id;
+	float points[2 * RECORD_SIDES];
+};
+
+/* The bounding box of the object in a record */
+BoundingBox RecordBounds (const ShapeRecord& rec) {
+
+	BoundingBox box;
+
+	box.xmin = box.xmax = rec.points[0];
+	box.ymin = box.ymax = rec.points[1];
+
+	for (unsigned int i = 1; i < RECORD_SIDES; i++) {
+		box.xmin = std::min (box.xmin, rec.points[2 * i]);
+		box.xmax = std::max (box.xmax, rec.points[2 * i]);
+		box.ymin = std::min (box.ymin, rec.points[2 * i + 1]);
+		box.ymax = std::max (box.ymax, rec.points[2 * i + 1]);
+	}
+
+	return box;
+}
+
+/*
+ * A file of records opened for sequential reading or writing.
+ * Open reports the reason on failure, the rest simply return false.
+ */
+class RecordFile {
+private:
+	FILE *mFile;
+	char *mBuffer;
+
+	RecordFile (const RecordFile&);
+	RecordFile& operator= (const RecordFile&);
+
+public:
+	RecordFile ( ) : mFile (NULL), mBuffer (NULL) { }
+
+	~RecordFile ( ) { Close ( ); }
+
+	/* mode is "rb", "wb" or "ab", as for fopen */
+	bool Open (const char *path, const char *mode) {
+
+		Close ( );
+		mFile = fopen (path, mode);
+
+		if (mFile == NULL) {
+			std::cerr << "Cannot open " << path << std::endl;
+			return false;
+		}
+
+		mBuffer = new char [RECORD_BUFFER];
+		setvbuf (mFile, mBuffer, _IOFBF, RECORD_BUFFER);
+		return true;
+	}
+
+	void Close ( ) {
+		if (mFile != NULL)
+			fclose (mFile);
+
+		delete[] mBuffer;
+		mFile = NULL;
+		mBuffer = NULL;
+	}
+
+	bool IsOpen ( ) const { return mFile != NULL; }
+
+	bool Read (ShapeRecord& rec) {
+		return fread (&rec, sizeof (rec), 1, mFile) == 1;
+	}
+
+	/* Reads up to max records, returns how many were read */
+	unsigned int Read (ShapeRecord *recs, unsigned int max) {
+		return fread (recs, sizeof (ShapeRecord), max, mFile);
+	}
+
+	bool Write (const ShapeRecord& rec) {
+		return fwrite (&rec, sizeof (rec), 1, mFile) == 1;
+	}
+};
+
+/* Reads a whole record file into memory */
+bool LoadRecords (const char *path, std::vector<ShapeRecord>& recs) {
+
+	RecordFile file;
+	ShapeRecord rec;
+
+	if (file.Open (path, "rb") == false)
+		return false;
+
+	while (file.Read (rec))
+		recs.push_back (rec);
+
+	return true;
+}
+
+#endif /* SHAPEFILE_H */
@@ -0,0 +1,630 @@
+/*============================================================================
+ Name        : ShardedAnalyze.h
+ Author      : Nitin Puranik
+ Description : Analyzes every pair of a record file across worker
+ 	 	 	   processes. A coordinator cuts the world into vertical
+ 	 	 	   shards, streams every shard with its halo of records to a
+ 	 	 	   worker over a socket and merges the pairs that come back.
+ 	 	 	   The workers are either forked on the spot or already
+ 	 	 	   running and listening, possibly on other machines, and
+ 	 	 	   the shard of a worker that fails is run again on a fresh
+ 	 	 	   local one. Needs Linux, like the query server.
+ ============================================================================*/
+
+#ifndef SHARDEDANALYZE_H
+#define SHARDEDANALYZE_H
+
+#ifdef __linux__
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "QueryServer.h"
+#include "PartitionJoin.h"
+
+/* Marks the start of a shard, so that a stray connection is told apart */
+#define SHARD_MAGIC 0x44524853
+
+/* Records or pairs sent in one frame */
+#define SHARD_BATCH 4096
+
+/*
+ * Milliseconds the coordinator waits on a worker, in any one send or
+ * receive, before it takes the worker for failed. A worker at work
+ * sends a heartbeat every SHARD_HEARTBEAT milliseconds, however large
+ * its shard, so this only has to cover a worker that has stopped.
+ */
+#define SHARD_TIMEOUT 60000
+
+/* Milliseconds between two heartbeats of a worker */
+#define SHARD_HEARTBEAT 250
+
+/* The count of a frame that carries nothing and is only a heartbeat */
+#define SHARD_ALIVE 0xFFFFFFFFu
+
+/*
+ * The protocol. The coordinator sends a ShardHeader, then the records
+ * of the shard in frames: a count followed by that many ShapeRecords,
+ * with a count of 0 at the end. The worker answers with the pairs it
+ * owns in frames of ShardPairs as it finds them, ended the same way.
+ * In between it sends a count of SHARD_ALIVE, with nothing after it,
+ * every SHARD_HEARTBEAT milliseconds. All numbers are in native byte
+ * order.
+ *
+ * The records of a shard are all those whose boxes reach into the
+ * strip [lo, hi): those inside it and the halo of those crossing its
+ * edges. A pair is owned by the shard whose strip holds the left edge
+ * of the overlap of the two boxes, so that a pair seen by two shards
+ * is only reported once.
+ */
+struct ShardHeader {
+	unsigned int magic;
+	unsigned int shard;
+	float lo, hi;
+};
+
+struct ShardPair {
+	unsigned int first, second;
+	unsigned short type, which;
+};
+
+/*
+ * Makes every send and receive on the socket give up once it has waited
+ * for the given number of milliseconds.
+ */
+bool SocketTimeout (int fd, unsigned int milliseconds) {
+
+	timeval tv;
+
+	tv.tv_sec = milliseconds / 1000;
+	tv.tv_usec = (milliseconds % 1000) * 1000;
+
+	return setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv)) == 0 &&
+			setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv)) == 0;
+}
+
+/*
+ * Sends all the bytes, returns false if the other end went away or,
+ * with a timeout on the socket, stalled.
+ */
+bool SendAll (int fd, const void *data, size_t size) {
+
+	const char *p = (const char *) data;
+
+	while (size > 0) {
+
+		ssize_t n = send (fd, p, size, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return false;
+
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+/*
+ * Receives exactly size bytes, returns false if the stream ends first
+ * or, with a timeout on the socket, stalls.
+ */
+bool ReceiveAll (int fd, void *data, size_t size) {
+
+	char *p = (char *) data;
+
+	while (size > 0) {
+
+		ssize_t n = recv (fd, p, size, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return false;
+
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+/* Sends a frame of items, an empty one ends the stream */
+template <class T>
+bool SendFrame (int fd, const std::vector<T>& items) {
+
+	unsigned int count = items.size ( );
+
+	return SendAll (fd, &count, sizeof (count)) &&
+			(count == 0 || SendAll (fd, items.data ( ), count * sizeof (T)));
+}
+
+/* Receives frames of items up to the empty one that ends the stream, skipping heartbeats */
+template <class T>
+bool ReceiveFrames (int fd, std::vector<T>& items) {
+
+	while (true) {
+
+		unsigned int count;
+
+		if (ReceiveAll (fd, &count, sizeof (count)) == false)
+			return false;
+
+		if (count == SHARD_ALIVE)
+			continue;
+
+		if (count > SHARD_BATCH)
+			return false;
+
+		if (count == 0)
+			return true;
+
+		size_t size = items.size ( );
+		items.resize (size + count);
+
+		if (ReceiveAll (fd, &items[size], count * sizeof (T)) == false)
+			return false;
+	}
+}
+
+/*
+ * The answering end of a worker. While the worker is at work, a thread
+ * sends a heartbeat every SHARD_HEARTBEAT milliseconds, so that the
+ * coordinator can tell a worker busy with a large shard from one that
+ * has stopped. Frames of pairs go out in between, under the same lock.
+ * Once a send fails the budget is cancelled, which stops the analysis.
+ */
+class ShardSender {
+private:
+	int mFd;
+	QueryBudget& mBudget;
+	bool mOk, mDone;
+	std::mutex mLock;
+	std::condition_variable mWake;
+	std::thread mBeat;
+
+	ShardSender (const ShardSender&);
+	ShardSender& operator= (const ShardSender&);
+
+	void Beat ( ) {
+
+		std::unique_lock<std::mutex> lock (mLock);
+		unsigned int alive = SHARD_ALIVE;
+
+		while (mDone == false) {
+
+			mWake.wait_for (lock, std::chrono::milliseconds (SHARD_HEARTBEAT));
+
+			if (mDone == false && mOk && SendAll (mFd, &alive, sizeof (alive)) == false)
+				Fail ( );
+		}
+	}
+
+	/* With the lock held */
+	void Fail ( ) {
+		mOk = false;
+		mBudget.Cancel ( );
+	}
+
+public:
+	ShardSender (int fd, QueryBudget& budget) : mFd (fd), mBudget (budget), mOk (true), mDone (false) {
+		mBeat = std::thread (&ShardSender::Beat, this);
+	}
+
+	~ShardSender ( ) { Stop ( ); }
+
+	/* Stops the heartbeats. Frames sent after this are the last ones. */
+	void Stop ( ) {
+		{
+			std::lock_guard<std::mutex> guard (mLock);
+			mDone = true;
+		}
+
+		mWake.notify_all ( );
+
+		if (mBeat.joinable ( ))
+			mBeat.join ( );
+	}
+
+	bool Send (const std::vector<ShardPair>& pairs) {
+
+		std::lock_guard<std::mutex> guard (mLock);
+
+		if (mOk && SendFrame (mFd, pairs) == false)
+			Fail ( );
+
+		return mOk;
+	}
+};
+
+/* The analysis of one shard, sending on the pairs the shard owns as they are found */
+struct ShardRefine {
+	float mLo, mHi;
+	ShardSender& mSender;
+
+	const std::vector<ShapeRecord>& mRecs;
+	std::vector<Shape*> mShapes;
+	std::vector<BoundingBox> mBoxes;
+	std::vector<ShardPair> mFound;
+
+	ShardRefine (float lo, float hi, const std::vector<ShapeRecord>& recs, ShardSender& sender)
+		: mLo (lo), mHi (hi), mSender (sender), mRecs (recs) {
+		BuildShapes (recs, mShapes, mBoxes);
+	}
+
+	~ShardRefine ( ) {
+		FreeShapes (mShapes);
+	}
+
+	void operator() (unsigned int i, unsigned int j) {
+
+		float ref = std::max (mBoxes[i].xmin, mBoxes[j].xmin);
+
+		if (ref < mLo || ref >= mHi)
+			return;
+
+		/* Report each pair with the smaller record id first */
+		if (mRecs[i].id > mRecs[j].id)
+			std::swap (i, j);
+
+		int which;
+		CollisionType type = ProcessData (*mShapes[i], *mShapes[j], &which);
+
+		if (type == apart)
+			return;
+
+		ShardPair pair = { mRecs[i].id, mRecs[j].id, (unsigned short) type, (unsigned short) which };
+		mFound.push_back (pair);
+
+		if (mFound.size ( ) == SHARD_BATCH)
+			Flush ( );
+	}
+
+	bool Flush ( ) {
+		bool ok = mFound.empty ( ) || mSender.Send (mFound);
+		mFound.clear ( );
+		return ok;
+	}
+
+	/* Returns false if the pairs could not all be sent */
+	bool Run (QueryBudget *budget) {
+		SweepAndPrune (mBoxes, *this, budget);
+		return Flush ( ) && BudgetExpired (budget) == false;
+	}
+};
+
+/* Serves one shard on the connection: reads it, analyzes it and sends back the pairs it owns */
+bool ServeShard (int fd) {
+
+	ShardHeader header;
+	std::vector<ShapeRecord> recs;
+
+	if (ReceiveAll (fd, &header, sizeof (header)) == false || header.magic != SHARD_MAGIC ||
+			ReceiveFrames (fd, recs) == false)
+		return false;
+
+	QueryBudget budget;
+	ShardSender sender (fd, budget);
+	bool ok;
+
+	{
+		ShardRefine refine (header.lo, header.hi, recs, sender);
+		ok = refine.Run (&budget);
+	}
+
+	sender.Stop ( );
+	return ok && sender.Send (std::vector<ShardPair> ( ));
+}
+
+/*
+ * Runs a worker that listens at the address, as for ListenSocket, and
+ * serves every connection in a process of its own until SIGINT or
+ * SIGTERM. Returns false if it cannot listen.
+ */
+bool RunShardWorker (const char *address) {
+
+	int listener = ListenSocket (address);
+
+	if (listener < 0)
+		return false;
+
+	/* No restart, so that a stop signal breaks out of accept */
+	struct sigaction action;
+	memset (&action, 0, sizeof (action));
+	action.sa_handler = StopServer;
+	sigaction (SIGINT, &action, NULL);
+	sigaction (SIGTERM, &action, NULL);
+
+	/* The children are never waited for */
+	signal (SIGCHLD, SIG_IGN);
+
+	while (ServerStopping == 0) {
+
+		int fd = accept (listener, NULL, NULL);
+
+		if (fd < 0)
+			continue;
+
+		pid_t pid = fork ( );
+
+		if (pid == 0) {
+			close (listener);
+			_exit (ServeShard (fd) ? 0 : 1);
+		}
+
+		if (pid < 0)
+			std::cerr << "Cannot fork a worker: " << strerror (errno) << std::endl;
+
+		close (fd);
+	}
+
+	close (listener);
+
+	if (strncmp (address, "tcp:", 4) != 0)
+		unlink (address);
+
+	return true;
+}
+
+/*
+ * Forks a worker serving one shard over a socket pair. Returns the
+ * coordinator's end, or -1, and the process of the worker in pid. The
+ * worker closes its copies of the other open sockets, so that none of
+ * them is held open by a worker it is not for.
+ */
+int SpawnShardWorker (const std::vector<int>& others, pid_t *pid) {
+
+	int ends[2];
+
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, ends) != 0) {
+		std::cerr << "Cannot make a socket pair: " << strerror (errno) << std::endl;
+		return -1;
+	}
+
+	*pid = fork ( );
+
+	if (*pid == 0) {
+		close (ends[0]);
+
+		for (unsigned int k = 0; k < others.size ( ); k++)
+			if (others[k] >= 0)
+				close (others[k]);
+
+		_exit (ServeShard (ends[1]) ? 0 : 1);
+	}
+
+	close (ends[1]);
+
+	if (*pid < 0) {
+		std::cerr << "Cannot fork a worker: " << strerror (errno) << std::endl;
+		close (ends[0]);
+		return -1;
+	}
+
+	return ends[0];
+}
+
+/* Cuts the world into strips holding about the same number of box left edges */
+bool ShardBounds (const char *path, unsigned int shards, std::vector<float>& bounds) {
+
+	RecordFile file;
+	ShapeRecord rec;
+	std::vector<float> edges;
+
+	if (file.Open (path, "rb") == false)
+		return false;
+
+	while (file.Read (rec))
+		edges.push_back (RecordBounds (rec).xmin);
+
+	std::sort (edges.begin ( ), edges.end ( ));
+
+	bounds.assign (1, -HUGE_VALF);
+
+	for (unsigned int s = 1; s < shards && edges.empty ( ) == false; s++)
+		bounds.push_back (edges[edges.size ( ) * s / shards]);
+
+	bounds.push_back (HUGE_VALF);
+	return true;
+}
+
+/*
+ * Streams the shards to their workers, worker k taking shard shards[k],
+ * then gathers the pairs they send back. ok[k] is cleared for a worker
+ * that failed, or that kept the coordinator waiting for longer than the
+ * timeout in milliseconds; the pairs of the others are added to found.
+ */
+bool RunShards (const char *path, const std::vector<float>& bounds, const std::vector<unsigned int>& shards,
+		const std::vector<int>& workers, unsigned int timeout, std::vector<bool>& ok,
+		std::vector<ShardPair>& found) {
+
+	RecordFile file;
+	ShapeRecord rec;
+	std::vector<std::vector<ShapeRecord> > batches (workers.size ( ));
+
+	ok.assign (workers.size ( ), false);
+
+	if (file.Open (path, "rb") == false)
+		return false;
+
+	for (unsigned int k = 0; k < workers.size ( ); k++) {
+
+		ShardHeader header = { SHARD_MAGIC, shards[k], bounds[shards[k]], bounds[shards[k] + 1] };
+
+		ok[k] = workers[k] >= 0 && SocketTimeout (workers[k], timeout) &&
+				SendAll (workers[k], &header, sizeof (header));
+	}
+
+	while (file.Read (rec)) {
+
+		BoundingBox box = RecordBounds (rec);
+
+		for (unsigned int k = 0; k < workers.size ( ); k++) {
+
+			if (ok[k] == false || box.xmax < bounds[shards[k]] || box.xmin >= bounds[shards[k] + 1])
+				continue;
+
+			batches[k].push_back (rec);
+
+			if (batches[k].size ( ) == SHARD_BATCH) {
+				ok[k] = SendFrame (workers[k], batches[k]);
+				batches[k].clear ( );
+			}
+		}
+	}
+
+	for (unsigned int k = 0; k < workers.size ( ); k++) {
+
+		if (ok[k] && batches[k].empty ( ) == false)
+			ok[k] = SendFrame (workers[k], batches[k]);
+
+		batches[k].clear ( );
+
+		if (ok[k])
+			ok[k] = SendFrame (workers[k], batches[k]);
+	}
+
+	/* Each worker has all of its shard by now and works on its own */
+	for (unsigned int k = 0; k < workers.size ( ); k++) {
+
+		std::vector<ShardPair> pairs;
+
+		if (ok[k])
+			ok[k] = ReceiveFrames (workers[k], pairs);
+
+		if (ok[k])
+			found.insert (found.end ( ), pairs.begin ( ), pairs.end ( ));
+	}
+
+	return true;
+}
+
+/* Orders the pairs by record ids */
+inline bool ShardPairLess (const ShardPair& a, const ShardPair& b) {
+	return a.first != b.first ? a.first < b.first : a.second < b.second;
+}
+
+inline bool ShardPairSame (const ShardPair& a, const ShardPair& b) {
+	return a.first == b.first && a.second == b.second;
+}
+
+/*
+ * Analyzes every pair of records in the file and reports the pairs that
+ * are not apart, by record id, ordered by id. With addresses, there is
+ * one shard per worker listening at them; otherwise the given number of
+ * workers is forked. A shard whose worker cannot be reached, fails or
+ * stays silent for longer than the timeout in milliseconds is run once
+ * more on a forked worker; the timeout is never taken shorter than four
+ * heartbeats. A forked worker whose shard failed is killed. Returns
+ * false on an I/O error or if a shard still fails.
+ */
+bool ShardedAnalyze (const char *path, const std::vector<std::string>& addresses,
+		unsigned int workers, std::vector<PairResult>& results, unsigned int timeout = SHARD_TIMEOUT) {
+
+	unsigned int shards = addresses.empty ( ) ? std::max (1u, workers) : addresses.size ( );
+	std::vector<float> bounds;
+
+	if (ShardBounds (path, shards, bounds) == false)
+		return false;
+
+	shards = bounds.size ( ) - 1;
+	timeout = std::max (timeout, 4u * SHARD_HEARTBEAT);
+
+	/* The process of every worker, or -1 for one listening elsewhere */
+	std::vector<pid_t> children, pids;
+	std::vector<unsigned int> todo;
+	std::vector<int> fds;
+	std::vector<bool> ok;
+	std::vector<ShardPair> found;
+	bool done = true;
+
+	for (unsigned int s = 0; s < shards; s++) {
+
+		pid_t pid = -1;
+
+		todo.push_back (s);
+		fds.push_back (s < addresses.size ( ) ? ConnectSocket (addresses[s].c_str ( )) : SpawnShardWorker (fds, &pid));
+		pids.push_back (pid);
+	}
+
+	for (unsigned int attempt = 0; attempt < 2 && todo.empty ( ) == false; attempt++) {
+
+		done = RunShards (path, bounds, todo, fds, timeout, ok, found);
+
+		if (done == false)
+			break;
+
+		std::vector<unsigned int> failed;
+
+		for (unsigned int k = 0; k < fds.size ( ); k++) {
+
+			if (fds[k] >= 0)
+				close (fds[k]);
+
+			/* A worker that failed may be stuck, and would keep the wait below from ending */
+			if (ok[k] == false && pids[k] > 0)
+				kill (pids[k], SIGKILL);
+
+			if (ok[k] == false)
+				failed.push_back (todo[k]);
+
+			if (pids[k] > 0)
+				children.push_back (pids[k]);
+		}
+
+		for (unsigned int k = 0; k < failed.size ( ); k++)
+			std::cerr << "Shard " << failed[k] << " failed" << (attempt == 0 ? ", running it again" : "") << std::endl;
+
+		todo.swap (failed);
+		fds.clear ( );
+		pids.clear ( );
+
+		for (unsigned int k = 0; k < todo.size ( ) && attempt == 0; k++) {
+
+			pid_t pid = -1;
+
+			fds.push_back (SpawnShardWorker (fds, &pid));
+			pids.push_back (pid);
+		}
+	}
+
+	/* Workers left over when RunShards could not read the file are killed, then waited on */
+	for (unsigned int k = 0; k < fds.size ( ); k++) {
+
+		if (fds[k] >= 0)
+			close (fds[k]);
+
+		if (pids[k] > 0) {
+			kill (pids[k], SIGKILL);
+			children.push_back (pids[k]);
+		}
+	}
+
+	for (unsigned int k = 0; k < children.size ( ); k++)
+		waitpid (children[k], NULL, 0);
+
+	/* The owner rule already keeps a pair to one shard; this also drops any sent twice */
+	std::sort (found.begin ( ), found.end ( ), ShardPairLess);
+	found.erase (std::unique (found.begin ( ), found.end ( ), ShardPairSame), found.end ( ));
+
+	results.resize (found.size ( ));
+
+	for (size_t k = 0; k < found.size ( ); k++) {
+		results[k].first = found[k].first;
+		results[k].second = found[k].second;
+		results[k].type = (CollisionType) found[k].type;
+		results[k].which = found[k].which;
+	}
+
+	return done && todo.empty ( );
+}
+
+#endif /* __linux__ */
+
+#endif /* SHARDEDANALYZE_H */
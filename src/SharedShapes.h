@@ -0,0 +1,347 @@
+/*============================================================================
+ Name        : SharedShapes.h
+ Author      : Nitin Puranik
+ Description : Publishes a set of objects into named POSIX shared memory,
+ 	 	 	   points together with their prepared normals, edge lengths
+ 	 	 	   and boxes, so that any number of other processes can attach
+ 	 	 	   to it read only and analyze it in place, with nothing copied
+ 	 	 	   or parsed. Every publication is a new generation in a
+ 	 	 	   segment of its own; a small control segment names the
+ 	 	 	   current one, so a writer can swap in new data while readers
+ 	 	 	   keep working on the generation they attached to.
+ 	 	 	   Needs Linux, like the query server.
+ ============================================================================*/
+
+#ifndef SHAREDSHAPES_H
+#define SHAREDSHAPES_H
+
+#ifdef __linux__
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "BaseClassShape.h"
+
+/* Marks a segment as ours, and the layout of its contents */
+#define SHARED_MAGIC 0x53504853
+#define SHARED_LAYOUT 1
+
+/* Times a reader looks again when a generation is swapped out under it */
+#define SHARED_RETRIES 8
+
+/*
+ * The control segment, at the name itself. The generation is 0 until
+ * the first one is published, and only ever grows. It is stored once
+ * the data of the generation is complete, so a reader that sees it can
+ * use the data at once.
+ */
+struct SharedControl {
+	unsigned int magic;
+	unsigned int layout;
+	std::atomic<unsigned long long> generation;
+};
+
+/*
+ * A generation, at the name followed by .<generation>. The header is
+ * followed by the arrays of all the objects, one after another: the
+ * points, two floats per vertex, the normals, two floats per edge, the
+ * edge lengths, one float per edge, and the boxes.
+ */
+struct SharedHeader {
+	unsigned int magic;
+	unsigned int layout;
+	unsigned long long generation;
+	unsigned int count;
+	unsigned int sides;
+};
+
+/* The bytes of a generation of count objects of the given sides */
+inline size_t SharedSize (unsigned int count, unsigned int sides) {
+	return sizeof (SharedHeader) + (size_t) count * (5 * sides * sizeof (float) + sizeof (BoundingBox));
+}
+
+/* The name of the control segment, or of a generation of it when generation is not 0 */
+std::string SharedName (const char *name, unsigned long long generation = 0) {
+
+	std::stringstream full;
+
+	if (name[0] != '/')
+		full << '/';
+
+	full << name;
+
+	if (generation != 0)
+		full << '.' << generation;
+
+	return full.str ( );
+}
+
+/*
+ * Publishes the objects under the name as its next generation, and
+ * drops the one before. Readers attached to that one keep it until
+ * they let go. All the objects must have the same number of sides.
+ * There is one writer for a name at a time; a second one publishing
+ * the same generation fails. Returns false after reporting why.
+ */
+bool PublishShapes (const char *name, const std::vector<Shape*>& shapes,
+		unsigned long long *published = NULL) {
+
+	unsigned int sides = shapes.empty ( ) ? 0 : shapes[0]->NumSides ( );
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++) {
+		if (shapes[i]->NumSides ( ) != sides) {
+			std::cerr << "Cannot publish objects with different numbers of sides" << std::endl;
+			return false;
+		}
+	}
+
+	std::string controlName = SharedName (name);
+	int fd = shm_open (controlName.c_str ( ), O_RDWR | O_CREAT, 0644);
+	struct stat st;
+
+	if (fd < 0 || fstat (fd, &st) != 0 ||
+			(st.st_size == 0 && ftruncate (fd, sizeof (SharedControl)) != 0)) {
+		std::cerr << "Cannot open " << controlName << ": " << strerror (errno) << std::endl;
+		if (fd >= 0)
+			close (fd);
+		return false;
+	}
+
+	void *mapped = mmap (NULL, sizeof (SharedControl), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if (mapped == MAP_FAILED) {
+		std::cerr << "Cannot map " << controlName << ": " << strerror (errno) << std::endl;
+		return false;
+	}
+
+	/* A new segment comes zeroed, that is with no generation yet */
+	SharedControl *control = (SharedControl *) mapped;
+
+	if (control->magic != SHARED_MAGIC) {
+		control->magic = SHARED_MAGIC;
+		control->layout = SHARED_LAYOUT;
+	}
+
+	unsigned long long current = control->generation.load (std::memory_order_acquire);
+	unsigned long long next = current + 1;
+	std::string dataName = SharedName (name, next);
+	size_t size = SharedSize (shapes.size ( ), sides);
+
+	fd = shm_open (dataName.c_str ( ), O_RDWR | O_CREAT | O_EXCL, 0644);
+
+	if (fd < 0 || ftruncate (fd, size) != 0 ||
+			(mapped = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		std::cerr << "Cannot make " << dataName << ": " << strerror (errno) << std::endl;
+
+		if (fd >= 0) {
+			close (fd);
+			shm_unlink (dataName.c_str ( ));
+		}
+
+		munmap (control, sizeof (SharedControl));
+		return false;
+	}
+
+	close (fd);
+
+	SharedHeader *header = (SharedHeader *) mapped;
+	float *points = (float *) (header + 1);
+	float *normals = points + (size_t) shapes.size ( ) * 2 * sides;
+	float *edgeLen = normals + (size_t) shapes.size ( ) * 2 * sides;
+	BoundingBox *boxes = (BoundingBox *) (edgeLen + (size_t) shapes.size ( ) * sides);
+
+	header->magic = SHARED_MAGIC;
+	header->layout = SHARED_LAYOUT;
+	header->generation = next;
+	header->count = shapes.size ( );
+	header->sides = sides;
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++) {
+		std::copy (shapes[i]->Points ( ), shapes[i]->Points ( ) + 2 * sides, points + (size_t) i * 2 * sides);
+		std::copy (shapes[i]->Normals ( ), shapes[i]->Normals ( ) + 2 * sides, normals + (size_t) i * 2 * sides);
+		std::copy (shapes[i]->EdgeLengths ( ), shapes[i]->EdgeLengths ( ) + sides, edgeLen + (size_t) i * sides);
+		boxes[i] = shapes[i]->Bounds ( );
+	}
+
+	munmap (mapped, size);
+
+	/* The swap: readers that look from now on find the new generation */
+	control->generation.store (next, std::memory_order_release);
+	munmap (control, sizeof (SharedControl));
+
+	if (current != 0)
+		shm_unlink (SharedName (name, current).c_str ( ));
+
+	if (published != NULL)
+		*published = next;
+
+	return true;
+}
+
+/* Removes the name and its current generation. Attached readers keep what they have. */
+void UnpublishShapes (const char *name) {
+
+	std::string controlName = SharedName (name);
+	int fd = shm_open (controlName.c_str ( ), O_RDONLY, 0);
+
+	if (fd >= 0) {
+
+		void *mapped = mmap (NULL, sizeof (SharedControl), PROT_READ, MAP_SHARED, fd, 0);
+		close (fd);
+
+		if (mapped != MAP_FAILED) {
+			unsigned long long current = ((SharedControl *) mapped)->generation.load (std::memory_order_acquire);
+
+			if (current != 0)
+				shm_unlink (SharedName (name, current).c_str ( ));
+
+			munmap (mapped, sizeof (SharedControl));
+		}
+	}
+
+	shm_unlink (controlName.c_str ( ));
+}
+
+/*
+ * A generation of a published set, mapped read only. The objects are
+ * views straight into the mapping and can be handed to any analysis
+ * that only reads them. The generation stays as it is while attached,
+ * whatever the writer does; Stale tells when a newer one is out, and
+ * Attach again moves over to it.
+ */
+class SharedShapeSet {
+private:
+	const SharedControl *mControl;
+	const SharedHeader *mHeader;
+	size_t mSize;
+	std::vector<Shape*> mShapes;
+
+	SharedShapeSet (const SharedShapeSet&);
+	SharedShapeSet& operator= (const SharedShapeSet&);
+
+	/* Maps a whole segment read only, or returns NULL */
+	static const void *Map (const std::string& name, size_t *size) {
+
+		int fd = shm_open (name.c_str ( ), O_RDONLY, 0);
+		struct stat st;
+
+		if (fd < 0)
+			return NULL;
+
+		void *mapped = MAP_FAILED;
+
+		if (fstat (fd, &st) == 0 && st.st_size > 0) {
+			*size = st.st_size;
+			mapped = mmap (NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+		}
+
+		close (fd);
+		return mapped == MAP_FAILED ? NULL : mapped;
+	}
+
+public:
+	SharedShapeSet ( ) : mControl (NULL), mHeader (NULL), mSize (0) { }
+
+	~SharedShapeSet ( ) { Detach ( ); }
+
+	/*
+	 * Attaches to the current generation published under the name,
+	 * letting go of any attached before. Returns false after reporting
+	 * why if there is none.
+	 */
+	bool Attach (const char *name) {
+
+		Detach ( );
+
+		std::string controlName = SharedName (name);
+		size_t size;
+
+		mControl = (const SharedControl *) Map (controlName, &size);
+
+		if (mControl == NULL || size < sizeof (SharedControl) || mControl->magic != SHARED_MAGIC ||
+				mControl->layout != SHARED_LAYOUT) {
+			std::cerr << "Nothing published at " << controlName << std::endl;
+			Detach ( );
+			return false;
+		}
+
+		/* The writer may drop a generation between reading its number and opening it */
+		for (unsigned int attempt = 0; attempt < SHARED_RETRIES && mHeader == NULL; attempt++) {
+
+			unsigned long long generation = mControl->generation.load (std::memory_order_acquire);
+
+			if (generation == 0)
+				break;
+
+			mHeader = (const SharedHeader *) Map (SharedName (name, generation), &mSize);
+
+			if (mHeader != NULL && (mSize < sizeof (SharedHeader) || mHeader->magic != SHARED_MAGIC ||
+					mHeader->generation != generation ||
+					mSize < SharedSize (mHeader->count, mHeader->sides))) {
+				munmap ((void *) mHeader, mSize);
+				mHeader = NULL;
+			}
+		}
+
+		if (mHeader == NULL) {
+			std::cerr << "No generation of " << controlName << " to attach to" << std::endl;
+			Detach ( );
+			return false;
+		}
+
+		unsigned int count = mHeader->count, sides = mHeader->sides;
+		const float *points = (const float *) (mHeader + 1);
+		const float *normals = points + (size_t) count * 2 * sides;
+		const float *edgeLen = normals + (size_t) count * 2 * sides;
+		const BoundingBox *boxes = (const BoundingBox *) (edgeLen + (size_t) count * sides);
+
+		mShapes.resize (count);
+
+		for (unsigned int i = 0; i < count; i++)
+			mShapes[i] = new Shape (sides, points + (size_t) i * 2 * sides, normals + (size_t) i * 2 * sides,
+					edgeLen + (size_t) i * sides, boxes[i]);
+
+		return true;
+	}
+
+	/* Lets go of the generation. Its views go with it. */
+	void Detach ( ) {
+
+		for (unsigned int i = 0; i < mShapes.size ( ); i++)
+			delete mShapes[i];
+
+		mShapes.clear ( );
+
+		if (mHeader != NULL)
+			munmap ((void *) mHeader, mSize);
+
+		if (mControl != NULL)
+			munmap ((void *) mControl, sizeof (SharedControl));
+
+		mHeader = NULL;
+		mControl = NULL;
+		mSize = 0;
+	}
+
+	bool Attached ( ) const { return mHeader != NULL; }
+
+	unsigned long long Generation ( ) const { return mHeader ? mHeader->generation : 0; }
+
+	/* Tells if a newer generation has been published since this one */
+	bool Stale ( ) const {
+		return mControl != NULL && mControl->generation.load (std::memory_order_acquire) != Generation ( );
+	}
+
+	/* The objects of the generation, in the order they were published */
+	const std::vector<Shape*>& Shapes ( ) const { return mShapes; }
+};
+
+#endif /* __linux__ */
+
+#endif /* SHAREDSHAPES_H */
@@ -0,0 +1,239 @@
+/*============================================================================
+ Name        : SpatialIndex.h
+ Author      : Nitin Puranik
+ Description : A static R-tree over the bounding boxes of a set of objects,
+ 	 	 	   packed bottom up with the Sort-Tile-Recursive method. It is
+ 	 	 	   built once for a set that does not change and then answers
+ 	 	 	   any number of queries, from any number of threads.
+ ============================================================================*/
+
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "BaseClassShape.h"
+
+/* Number of children of every node, and of entries of every leaf */
+#define INDEX_FANOUT 16
+
+/*
+ * Room for the nodes waiting to be visited during a search. A tree over
+ * 2^32 entries has 8 levels, and each level leaves at most a node's
+ * worth of children waiting.
+ */
+#define INDEX_STACK (8 * INDEX_FANOUT)
+
+/*
+ * A node of the tree. The children of a node lie next to each other,
+ * so first and count are a range of nodes for an inner node and a
+ * range of entries for a leaf.
+ */
+struct IndexNode {
+	BoundingBox box;
+	unsigned int first, count;
+	bool leaf;
+};
+
+/* The box that encloses both the boxes */
+inline BoundingBox MergeBounds (const BoundingBox& a, const BoundingBox& b) {
+
+	BoundingBox box;
+
+	box.xmin = std::min (a.xmin, b.xmin);
+	box.ymin = std::min (a.ymin, b.ymin);
+	box.xmax = std::max (a.xmax, b.xmax);
+	box.ymax = std::max (a.ymax, b.ymax);
+
+	return box;
+}
+
+/* Orders box indices by the centre of their boxes along one axis */
+struct CentreLess {
+	const std::vector<BoundingBox>& mBoxes;
+	bool mY;
+
+	CentreLess (const std::vector<BoundingBox>& boxes, bool y) : mBoxes (boxes), mY (y) { }
+
+	bool operator() (unsigned int a, unsigned int b) const {
+		if (mY)
+			return mBoxes[a].ymin + mBoxes[a].ymax < mBoxes[b].ymin + mBoxes[b].ymax;
+
+		return mBoxes[a].xmin + mBoxes[a].xmax < mBoxes[b].xmin + mBoxes[b].xmax;
+	}
+};
+
+/*
+ * Puts the indices in Sort-Tile-Recursive order: sorted by x into
+ * vertical slices of whole groups, then by y within each slice. Every
+ * run of INDEX_FANOUT indices is then a compact group.
+ */
+void TileOrder (const std::vector<BoundingBox>& boxes, std::vector<unsigned int>& order) {
+
+	unsigned int groups = (order.size ( ) + INDEX_FANOUT - 1) / INDEX_FANOUT;
+	unsigned int slices = (unsigned int) std::ceil (std::sqrt ((double) groups));
+	unsigned int slice = std::max (1u, (groups + slices - 1) / slices) * INDEX_FANOUT;
+
+	std::sort (order.begin ( ), order.end ( ), CentreLess (boxes, false));
+
+	for (unsigned int s = 0; s < order.size ( ); s += slice)
+		std::sort (order.begin ( ) + s, order.begin ( ) + std::min ((unsigned int) order.size ( ), s + slice),
+				CentreLess (boxes, true));
+}
+
+/*
+ * The index. Search walks the tree with a test on boxes: a node is
+ * entered and an entry is reported only if the test passes for its box,
+ * so the test must pass for a box whenever it passes for a box inside it.
+ */
+class SpatialIndex {
+private:
+	std::vector<BoundingBox> mBoxes;
+	std::vector<unsigned int> mEntries;
+	std::vector<IndexNode> mNodes;
+
+	/* Packs the nodes in [begin, end) under new parents, returns the parents' end */
+	unsigned int PackLevel (unsigned int begin, unsigned int end) {
+
+		std::vector<BoundingBox> boxes (end - begin);
+		std::vector<unsigned int> order (end - begin);
+		std::vector<IndexNode> level (mNodes.begin ( ) + begin, mNodes.begin ( ) + end);
+
+		for (unsigned int k = 0; k < order.size ( ); k++) {
+			boxes[k] = level[k].box;
+			order[k] = k;
+		}
+
+		/* The nodes move, but nothing points at them yet */
+		TileOrder (boxes, order);
+
+		for (unsigned int k = 0; k < order.size ( ); k++)
+			mNodes[begin + k] = level[order[k]];
+
+		for (unsigned int k = begin; k < end; k += INDEX_FANOUT) {
+
+			IndexNode parent;
+
+			parent.first = k;
+			parent.count = std::min (end - k, (unsigned int) INDEX_FANOUT);
+			parent.leaf = false;
+			parent.box = mNodes[k].box;
+
+			for (unsigned int c = 1; c < parent.count; c++)
+				parent.box = MergeBounds (parent.box, mNodes[k + c].box);
+
+			mNodes.push_back (parent);
+		}
+
+		return mNodes.size ( );
+	}
+
+public:
+	SpatialIndex ( ) { }
+
+	SpatialIndex (const std::vector<BoundingBox>& boxes) {
+		Build (boxes);
+	}
+
+	/* Builds the tree over the boxes. Entries are positions in the vector. */
+	void Build (const std::vector<BoundingBox>& boxes) {
+
+		mBoxes = boxes;
+		mNodes.clear ( );
+		mEntries.resize (boxes.size ( ));
+
+		for (unsigned int i = 0; i < mEntries.size ( ); i++)
+			mEntries[i] = i;
+
+		TileOrder (mBoxes, mEntries);
+
+		for (unsigned int k = 0; k < mEntries.size ( ); k += INDEX_FANOUT) {
+
+			IndexNode leaf;
+
+			leaf.first = k;
+			leaf.count = std::min ((unsigned int) mEntries.size ( ) - k, (unsigned int) INDEX_FANOUT);
+			leaf.leaf = true;
+			leaf.box = mBoxes[mEntries[k]];
+
+			for (unsigned int c = 1; c < leaf.count; c++)
+				leaf.box = MergeBounds (leaf.box, mBoxes[mEntries[k + c]]);
+
+			mNodes.push_back (leaf);
+		}
+
+		/* The root is the one node left at the top, the last one made */
+		unsigned int begin = 0, end = mNodes.size ( );
+
+		while (end - begin > 1) {
+			unsigned int next = PackLevel (begin, end);
+			begin = end;
+			end = next;
+		}
+	}
+
+	bool Empty ( ) const { return mNodes.empty ( ); }
+
+	unsigned int Size ( ) const { return mBoxes.size ( ); }
+
+	/* The tree itself, for queries that walk it in their own order */
+	const IndexNode& Root ( ) const { return mNodes.back ( ); }
+
+	unsigned int RootNode ( ) const { return mNodes.size ( ) - 1; }
+
+	const IndexNode& Node (unsigned int k) const { return mNodes[k]; }
+
+	unsigned int Entry (unsigned int k) const { return mEntries[k]; }
+
+	const BoundingBox& Box (unsigned int i) const { return mBoxes[i]; }
+
+	/* Reports every entry i whose box passes the test as visit (i) */
+	template <class Test, class Visitor>
+	void Search (Test& test, Visitor& visit) const {
+
+		if (mNodes.empty ( ))
+			return;
+
+		unsigned int stack[INDEX_STACK];
+		unsigned int top = 0;
+
+		stack[top++] = mNodes.size ( ) - 1;
+
+		while (top > 0) {
+
+			const IndexNode& node = mNodes[stack[--top]];
+
+			if (test (node.box) == false)
+				continue;
+
+			for (unsigned int c = node.first; c < node.first + node.count; c++) {
+				if (node.leaf == false)
+					stack[top++] = c;
+
+				else if (test (mBoxes[mEntries[c]]))
+					visit (mEntries[c]);
+			}
+		}
+	}
+
+	/* Reports every entry whose box overlaps the given box, edges included */
+	template <class Visitor>
+	void Query (const BoundingBox& box, Visitor& visit) const {
+
+		struct Overlaps {
+			const BoundingBox& mBox;
+
+			Overlaps (const BoundingBox& box) : mBox (box) { }
+
+			bool operator() (const BoundingBox& b) const {
+				return b.xmin <= mBox.xmax && mBox.xmin <= b.xmax &&
+						b.ymin <= mBox.ymax && mBox.ymin <= b.ymax;
+			}
+		} test (box);
+
+		Search (test, visit);
+	}
+};
+
+#endif /* SPATIALINDEX_H */
@@ -0,0 +1,343 @@
+/*============================================================================
+ Name        : SpatialOrder.h
+ Author      : Nitin Puranik
+ Description : Space filling curve keys. Objects whose keys are close are
+ 	 	 	   close in space as well, so processing objects in key order
+ 	 	 	   keeps neighbours close together in memory and on disk.
+ 	 	 	   Whole sets are put in curve order by a parallel radix sort.
+ ============================================================================*/
+
+#ifndef SPATIALORDER_H
+#define SPATIALORDER_H
+
+#include <thread>
+#include "BaseClassShape.h"
+#include "BroadPhase.h"
+
+/*
+ * The space filling curves on offer. The Hilbert curve never jumps,
+ * so it keeps neighbours a little closer than the Z-order curve, which
+ * in turn is cheaper to compute.
+ */
+enum SpaceCurve { zorder, hilbert };
+
+/* Spreads the 16 bits of v out to the even bits of the result */
+inline unsigned int SpreadBits (unsigned int v) {
+
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+
+	return v;
+}
+
+/* The Morton (Z-order) code of a cell of a 65536 x 65536 grid */
+inline unsigned int MortonCode (unsigned int x, unsigned int y) {
+	return SpreadBits (x) | (SpreadBits (y) << 1);
+}
+
+/* The distance along the Hilbert curve of a cell of a 65536 x 65536 grid */
+inline unsigned int HilbertCode (unsigned int x, unsigned int y) {
+
+	unsigned int d = 0;
+
+	for (unsigned int s = 1u << 15; s > 0; s >>= 1) {
+
+		unsigned int rx = (x & s) ? 1 : 0;
+		unsigned int ry = (y & s) ? 1 : 0;
+
+		d += s * s * ((3 * rx) ^ ry);
+
+		/* Rotate the quadrant so that the curve inside it lines up */
+		if (ry == 0) {
+			if (rx == 1) {
+				x = 0xFFFF - x;
+				y = 0xFFFF - y;
+			}
+			std::swap (x, y);
+		}
+	}
+
+	return d;
+}
+
+/* Maps v within [lo, hi] onto a 16-bit grid coordinate */
+inline unsigned int GridCoordinate (float v, float lo, float hi) {
+
+	if (hi <= lo || v <= lo)
+		return 0;
+
+	if (v >= hi)
+		return 0xFFFF;
+
+	return (unsigned int) ((v - lo) / (hi - lo) * 65535.0f);
+}
+
+/* The Morton code of the centre of a box within the world */
+inline unsigned int MortonKey (const BoundingBox& box, const BoundingBox& world) {
+
+	float cx = 0.5f * (box.xmin + box.xmax);
+	float cy = 0.5f * (box.ymin + box.ymax);
+
+	return MortonCode (GridCoordinate (cx, world.xmin, world.xmax),
+			GridCoordinate (cy, world.ymin, world.ymax));
+}
+
+/* The curve key of the centre of a box within the world */
+inline unsigned int CurveKey (const BoundingBox& box, const BoundingBox& world, SpaceCurve curve) {
+
+	if (curve == zorder)
+		return MortonKey (box, world);
+
+	float cx = 0.5f * (box.xmin + box.xmax);
+	float cy = 0.5f * (box.ymin + box.ymax);
+
+	return HilbertCode (GridCoordinate (cx, world.xmin, world.xmax),
+			GridCoordinate (cy, world.ymin, world.ymax));
+}
+
+/* Splits n items into the given number of nearly equal ranges */
+inline unsigned int RangeStart (unsigned int n, unsigned int parts, unsigned int k) {
+	return (unsigned int) ((unsigned long long) n * k / parts);
+}
+
+/*
+ * One pass of the parallel radix sort on the byte at the given shift.
+ * Every thread counts the digits of its own range, the counts are
+ * turned into the first output slot of each digit for each thread,
+ * and every thread then scatters its range. The scatter is stable, so
+ * four passes sort the keys by all 32 bits.
+ */
+void RadixPass (const std::vector<unsigned int>& keys, const std::vector<unsigned int>& in,
+		std::vector<unsigned int>& out, unsigned int shift, unsigned int threads) {
+
+	unsigned int n = in.size ( );
+	std::vector<unsigned int> count (threads * 256, 0);
+
+	struct Worker {
+		static void Count (const std::vector<unsigned int> *keys, const std::vector<unsigned int> *in,
+				unsigned int *count, unsigned int begin, unsigned int end, unsigned int shift) {
+			for (unsigned int i = begin; i < end; i++)
+				count[((*keys)[(*in)[i]] >> shift) & 0xFF]++;
+		}
+
+		static void Scatter (const std::vector<unsigned int> *keys, const std::vector<unsigned int> *in,
+				std::vector<unsigned int> *out, unsigned int *slot, unsigned int begin,
+				unsigned int end, unsigned int shift) {
+			for (unsigned int i = begin; i < end; i++)
+				(*out)[slot[((*keys)[(*in)[i]] >> shift) & 0xFF]++] = (*in)[i];
+		}
+	};
+
+	std::vector<std::thread> pool;
+
+	for (unsigned int t = 0; t < threads; t++)
+		pool.push_back (std::thread (Worker::Count, &keys, &in, &count[t * 256],
+				RangeStart (n, threads, t), RangeStart (n, threads, t + 1), shift));
+
+	for (unsigned int t = 0; t < threads; t++)
+		pool[t].join ( );
+
+	/* Digit by digit, then thread by thread, so the order stays stable */
+	unsigned int next = 0;
+
+	for (unsigned int d = 0; d < 256; d++) {
+		for (unsigned int t = 0; t < threads; t++) {
+			unsigned int c = count[t * 256 + d];
+			count[t * 256 + d] = next;
+			next += c;
+		}
+	}
+
+	pool.clear ( );
+
+	for (unsigned int t = 0; t < threads; t++)
+		pool.push_back (std::thread (Worker::Scatter, &keys, &in, &out, &count[t * 256],
+				RangeStart (n, threads, t), RangeStart (n, threads, t + 1), shift));
+
+	for (unsigned int t = 0; t < threads; t++)
+		pool[t].join ( );
+}
+
+/*
+ * Sorts by key with a parallel LSD radix sort. perm receives the
+ * positions of the keys in ascending key order, so that perm[k] is
+ * the original position of the k-th smallest key.
+ */
+void RadixSortPermutation (const std::vector<unsigned int>& keys, std::vector<unsigned int>& perm,
+		unsigned int threads = 0) {
+
+	if (threads == 0)
+		threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+	/* Small inputs are not worth more than one thread per few thousand keys */
+	threads = std::max (1u, std::min (threads, (unsigned int) keys.size ( ) / 4096));
+
+	std::vector<unsigned int> other (keys.size ( ));
+
+	perm.resize (keys.size ( ));
+
+	for (unsigned int i = 0; i < perm.size ( ); i++)
+		perm[i] = i;
+
+	for (unsigned int shift = 0; shift < 32; shift += 8) {
+		RadixPass (keys, perm, other, shift, threads);
+		perm.swap (other);
+	}
+}
+
+/* Puts items in the order given by perm, as produced by RadixSortPermutation */
+template <class T>
+void ApplyPermutation (std::vector<T>& items, const std::vector<unsigned int>& perm) {
+
+	std::vector<T> sorted (items.size ( ));
+
+	for (unsigned int k = 0; k < perm.size ( ); k++)
+		sorted[k] = items[perm[k]];
+
+	items.swap (sorted);
+}
+
+/*
+ * The order of a set of objects along the curve by the centres of
+ * their boxes: the object at position k in curve order is at position
+ * perm[k] of the set.
+ */
+void CurvePermutation (const std::vector<Shape*>& shapes, SpaceCurve curve, std::vector<unsigned int>& perm,
+		unsigned int threads = 0) {
+
+	std::vector<BoundingBox> boxes;
+
+	CollectBounds (shapes, boxes);
+
+	BoundingBox world = UnionBounds (boxes);
+	std::vector<unsigned int> keys (boxes.size ( ));
+
+	for (unsigned int i = 0; i < boxes.size ( ); i++)
+		keys[i] = CurveKey (boxes[i], world, curve);
+
+	RadixSortPermutation (keys, perm, threads);
+}
+
+/*
+ * Puts the n points of xy (two floats each) in Hilbert order: the point
+ * at position k in curve order is point order[k]. Queries run over the
+ * points in this order, so each thread taking an equal run of them
+ * stays in one area.
+ */
+void CurveOrderPoints (const float *xy, unsigned int n, std::vector<unsigned int>& order,
+		unsigned int threads = 0) {
+
+	if (threads == 0)
+		threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+	if (n == 0) {
+		order.clear ( );
+		return;
+	}
+
+	BoundingBox world = { xy[0], xy[1], xy[0], xy[1] };
+	std::vector<unsigned int> keys (n);
+
+	for (unsigned int i = 1; i < n; i++) {
+		world.xmin = std::min (world.xmin, xy[2 * i]);
+		world.ymin = std::min (world.ymin, xy[2 * i + 1]);
+		world.xmax = std::max (world.xmax, xy[2 * i]);
+		world.ymax = std::max (world.ymax, xy[2 * i + 1]);
+	}
+
+	for (unsigned int i = 0; i < n; i++) {
+		BoundingBox at = { xy[2 * i], xy[2 * i + 1], xy[2 * i], xy[2 * i + 1] };
+		keys[i] = CurveKey (at, world, hilbert);
+	}
+
+	RadixSortPermutation (keys, order, threads);
+}
+
+/*
+ * A copy of a set of objects laid out along the curve. The points and
+ * prepared data of all the objects are copied into shared arrays in
+ * curve order, and the objects of the copy are views into them, made
+ * one after another. An object and its neighbours in space are then
+ * neighbours in memory as well, for every pass that goes from one to
+ * the other. Perm is the way back to the set the copy was made from.
+ */
+class CurveOrderedSet {
+private:
+	std::vector<float> mPoints, mNormals, mEdgeLen;
+	std::vector<Shape*> mShapes;
+	std::vector<unsigned int> mPerm;
+
+	CurveOrderedSet (const CurveOrderedSet&);
+	CurveOrderedSet& operator= (const CurveOrderedSet&);
+
+public:
+	CurveOrderedSet ( ) { }
+
+	~CurveOrderedSet ( ) { Clear ( ); }
+
+	/* Copies the objects of the set in curve order, replacing any copied before */
+	void Build (const std::vector<Shape*>& shapes, SpaceCurve curve, unsigned int threads = 0) {
+
+		Clear ( );
+		CurvePermutation (shapes, curve, mPerm, threads);
+
+		size_t sides = 0;
+
+		for (unsigned int i = 0; i < shapes.size ( ); i++)
+			sides += shapes[i]->NumSides ( );
+
+		mPoints.resize (2 * sides);
+		mNormals.resize (2 * sides);
+		mEdgeLen.resize (sides);
+
+		/* The arrays are all in place before the first view points into them */
+		size_t at = 0;
+
+		for (unsigned int k = 0; k < mPerm.size ( ); k++) {
+
+			const Shape& S = *shapes[mPerm[k]];
+			unsigned int n = S.NumSides ( );
+
+			std::copy (S.Points ( ), S.Points ( ) + 2 * n, &mPoints[2 * at]);
+			std::copy (S.Normals ( ), S.Normals ( ) + 2 * n, &mNormals[2 * at]);
+			std::copy (S.EdgeLengths ( ), S.EdgeLengths ( ) + n, &mEdgeLen[at]);
+			at += n;
+		}
+
+		mShapes.resize (mPerm.size ( ));
+		at = 0;
+
+		for (unsigned int k = 0; k < mPerm.size ( ); k++) {
+
+			const Shape& S = *shapes[mPerm[k]];
+			unsigned int n = S.NumSides ( );
+
+			mShapes[k] = new Shape (n, &mPoints[2 * at], &mNormals[2 * at], &mEdgeLen[at], S.Bounds ( ));
+			at += n;
+		}
+	}
+
+	/* Lets go of the copy. Its views go with it. */
+	void Clear ( ) {
+
+		for (unsigned int i = 0; i < mShapes.size ( ); i++)
+			delete mShapes[i];
+
+		mShapes.clear ( );
+		mPerm.clear ( );
+		std::vector<float> ( ).swap (mPoints);
+		std::vector<float> ( ).swap (mNormals);
+		std::vector<float> ( ).swap (mEdgeLen);
+	}
+
+	/* The objects in curve order */
+	const std::vector<Shape*>& Shapes ( ) const { return mShapes; }
+
+	/* The object at position k was at position Perm ( )[k] of the set copied */
+	const std::vector<unsigned int>& Perm ( ) const { return mPerm; }
+};
+
+#endif /* SPATIALORDER_H */
@@ -0,0 +1,391 @@
+/*============================================================================
+ Name        : SweptCollision.h
+ Author      : Nitin Puranik
+ Description : Continuous collision detection for moving objects. Analyze
+ 	 	 	   only looks at a snapshot, so a fast object can pass through
+ 	 	 	   another one between two snapshots. These functions find the
+ 	 	 	   first time of contact over an interval instead.
+ ============================================================================*/
+
+#ifndef SWEPTCOLLISION_H
+#define SWEPTCOLLISION_H
+
+#include <cmath>
+#include <cfloat>
+#include <thread>
+#include "BroadPhase.h"
+#include "ShapeDistance.h"
+
+/*
+ * Steps conservative advancement takes before it gives up on objects
+ * that keep almost touching, and reports the query as unresolved.
+ */
+#define ADVANCE_STEPS (1 << 16)
+
+/*
+ * The motion of an object over the interval. The object translates
+ * with velocity (vx, vy) and rotates with angular velocity omega
+ * (radians per unit time) about the mean of its vertices.
+ */
+struct Motion {
+	float vx, vy;
+	float omega;
+};
+
+/*
+ * The outcome of a time of impact query. time is only valid when
+ * hit is set. type and which are the result of ProcessData for the
+ * two objects at the time of contact. resolved is false when the
+ * query gave up before it could tell a contact from a miss; hit is
+ * then false too, and time is how far the objects were followed.
+ */
+struct ImpactResult {
+	bool hit;
+	bool resolved;
+	float time;
+	CollisionType type;
+	int which;
+};
+
+/* Writes the points of the object as they are at time t */
+void PoseAt (const Shape& S, const Motion& m, float t, float *out) {
+
+	const float *p = S.Points ( );
+	unsigned int n = S.NumSides ( );
+	float cx = 0, cy = 0;
+
+	/* Without rotation the points move as they are, with no rounding through the centre */
+	if (m.omega == 0) {
+		for (unsigned int j = 0; j < n; j++) {
+			out[2 * j] = p[2 * j] + m.vx * t;
+			out[2 * j + 1] = p[2 * j + 1] + m.vy * t;
+		}
+		return;
+	}
+
+	for (unsigned int j = 0; j < n; j++) {
+		cx += p[2 * j];
+		cy += p[2 * j + 1];
+	}
+
+	cx /= n;
+	cy /= n;
+
+	float c = std::cos (m.omega * t);
+	float s = std::sin (m.omega * t);
+
+	for (unsigned int j = 0; j < n; j++) {
+
+		float x = p[2 * j] - cx;
+		float y = p[2 * j + 1] - cy;
+
+		out[2 * j] = cx + c * x - s * y + m.vx * t;
+		out[2 * j + 1] = cy + s * x + c * y + m.vy * t;
+	}
+}
+
+/*
+ * An upper bound on the speed of any point of the object: the speed
+ * of its centre plus the rotation speed of its farthest vertex.
+ */
+float SpeedBound (const Shape& S, const Motion& m) {
+
+	const float *p = S.Points ( );
+	unsigned int n = S.NumSides ( );
+	float cx = 0, cy = 0, r = 0;
+
+	for (unsigned int j = 0; j < n; j++) {
+		cx += p[2 * j];
+		cy += p[2 * j + 1];
+	}
+
+	cx /= n;
+	cy /= n;
+
+	for (unsigned int j = 0; j < n; j++) {
+		float dx = p[2 * j] - cx, dy = p[2 * j + 1] - cy;
+		r = std::max (r, std::sqrt (dx * dx + dy * dy));
+	}
+
+	return std::sqrt (m.vx * m.vx + m.vy * m.vy) + std::fabs (m.omega) * r;
+}
+
+/*
+ * The swept separating line test for objects that only translate.
+ * The edge normals do not change, so along each of them the projected
+ * intervals overlap during one closed time window. The objects touch
+ * during the intersection of all the windows, and the first contact
+ * is where that intersection begins.
+ */
+bool SweptSeparatingAxis (const Shape& A, const Motion& ma, const Shape& B,
+		const Motion& mb, float tmax, float *toi, float *until = NULL) {
+
+	float vx = mb.vx - ma.vx;
+	float vy = mb.vy - ma.vy;
+	float enter = 0, leave = tmax;
+
+	for (int s = 0; s < 2; s++) {
+
+		const Shape& S = s == 0 ? A : B;
+
+		for (unsigned int i = 0; i < S.NumSides ( ); i++) {
+
+			float nx = S.Normals ( )[2 * i];
+			float ny = S.Normals ( )[2 * i + 1];
+
+			float a_lo, a_hi, b_lo, b_hi;
+
+			ProjectOnto (A, nx, ny, &a_lo, &a_hi);
+			ProjectOnto (B, nx, ny, &b_lo, &b_hi);
+
+			/* The speed of B relative to A along this axis */
+			float speed = vx * nx + vy * ny;
+
+			if (speed == 0) {
+				if (b_hi < a_lo || b_lo > a_hi)
+					return false;
+				continue;
+			}
+
+			float t0 = (a_lo - b_hi) / speed;
+			float t1 = (a_hi - b_lo) / speed;
+
+			if (t0 > t1)
+				std::swap (t0, t1);
+
+			enter = std::max (enter, t0);
+			leave = std::min (leave, t1);
+
+			if (enter > leave)
+				return false;
+		}
+	}
+
+	*toi = enter;
+
+	if (until != NULL)
+		*until = leave;
+
+	return true;
+}
+
+/*
+ * The distance at which two moving objects are taken to be in contact:
+ * the given tolerance, but never less than the rounding of coordinates
+ * as large as any the objects reach over [0, tmax]. Rotation keeps an
+ * object about its centre, so only the translation makes them larger.
+ */
+float ContactTolerance (const Shape& A, const Motion& ma, const Shape& B,
+		const Motion& mb, float tmax, float tolerance) {
+
+	float scale = 0;
+
+	for (int s = 0; s < 2; s++) {
+
+		const BoundingBox& box = s == 0 ? A.Bounds ( ) : B.Bounds ( );
+		const Motion& m = s == 0 ? ma : mb;
+
+		float x = std::max (std::fabs (box.xmin), std::fabs (box.xmax)) + std::fabs (m.vx) * tmax;
+		float y = std::max (std::fabs (box.ymin), std::fabs (box.ymax)) + std::fabs (m.vy) * tmax;
+
+		scale = std::max (scale, std::max (x, y));
+	}
+
+	return std::max (tolerance, 8 * FLT_EPSILON * scale);
+}
+
+/* Runs ProcessData for the two objects as they are at time t */
+CollisionType ClassifyAt (const Shape& A, const Motion& ma, const Shape& B,
+		const Motion& mb, float t, int *which) {
+
+	std::vector<float> pa (2 * A.NumSides ( )), pb (2 * B.NumSides ( ));
+
+	PoseAt (A, ma, t, &pa[0]);
+	PoseAt (B, mb, t, &pb[0]);
+
+	Shape PA (A.NumSides ( ), &pa[0]);
+	Shape PB (B.NumSides ( ), &pb[0]);
+
+	return ProcessData (PA, PB, which);
+}
+
+/*
+ * Conservative advancement for objects that also rotate. At each step
+ * the separation gap is a lower bound on the distance, and no two points
+ * can approach faster than the sum of the speed bounds, so the objects
+ * are advanced by exactly as much time as is guaranteed to be safe.
+ * Once they are within tolerance, ProcessData tells if they touch. If
+ * not, they are moved on by the time it takes to close tolerance, so
+ * only a contact that stays shallower than that can be passed over,
+ * and a contact is found within that much of where it starts. Should they
+ * keep almost touching for ADVANCE_STEPS steps, the query is given up
+ * as unresolved, with toi set to how far it got.
+ */
+bool ConservativeAdvancement (const Shape& A, const Motion& ma, const Shape& B,
+		const Motion& mb, float tmax, float tolerance, float *toi,
+		CollisionType *type, int *which, bool *resolved) {
+
+	float speed = SpeedBound (A, ma) + SpeedBound (B, mb);
+	float t = 0;
+
+	Shape PA (A.NumSides ( ), A.Points ( ));
+	Shape PB (B.NumSides ( ), B.Points ( ));
+	std::vector<float> pts (2 * std::max (A.NumSides ( ), B.NumSides ( )));
+
+	*resolved = true;
+
+	for (int step = 0; step < ADVANCE_STEPS; step++) {
+
+		PoseAt (A, ma, t, &pts[0]);
+		PA.SetPoints (&pts[0]);
+
+		PoseAt (B, mb, t, &pts[0]);
+		PB.SetPoints (&pts[0]);
+
+		float gap = SeparationGap (PA, PB);
+
+		if (gap <= tolerance) {
+
+			*type = ProcessData (PA, PB, which);
+
+			if (*type != apart) {
+				*toi = t;
+				return true;
+			}
+		}
+
+		if (speed == 0)
+			return false;
+
+		t += std::max (gap, tolerance) / speed;
+
+		if (t > tmax)
+			return false;
+	}
+
+	*toi = t;
+	*resolved = false;
+	return false;
+}
+
+/*
+ * Finds the first time in [0, tmax] at which the two moving objects
+ * come into contact. Objects that are already touching at time 0 have
+ * a time of impact of 0. tolerance is the distance at which rotating
+ * objects are looked at closely for a contact; it is raised to the
+ * rounding of the coordinates where they are larger. A hit always
+ * comes with the type ProcessData finds for the contact, and objects
+ * that only come within tolerance of each other are a miss.
+ */
+ImpactResult TimeOfImpact (const Shape& A, const Motion& ma, const Shape& B,
+		const Motion& mb, float tmax, float tolerance = 1e-4f) {
+
+	ImpactResult res;
+	res.hit = false;
+	res.resolved = true;
+	res.time = 0;
+	res.type = apart;
+	res.which = 0;
+
+	tolerance = ContactTolerance (A, ma, B, mb, tmax, tolerance);
+
+	if (ma.omega != 0 || mb.omega != 0) {
+		res.hit = ConservativeAdvancement (A, ma, B, mb, tmax, tolerance, &res.time,
+				&res.type, &res.which, &res.resolved);
+		return res;
+	}
+
+	float until;
+
+	if (SweptSeparatingAxis (A, ma, B, mb, tmax, &res.time, &until) == false)
+		return res;
+
+	/*
+	 * The objects touch from res.time to until, to within rounding. At
+	 * the start of a grazing contact they can still come out apart, in
+	 * which case the type is taken from the middle of it instead.
+	 */
+	res.type = ClassifyAt (A, ma, B, mb, res.time, &res.which);
+
+	if (res.type == apart)
+		res.type = ClassifyAt (A, ma, B, mb, res.time + (until - res.time) / 2, &res.which);
+
+	res.hit = res.type != apart;
+	return res;
+}
+
+/*
+ * The bounding box of everything the object sweeps over [0, tmax].
+ * The box at time 0 is grown by the farthest any point can travel.
+ */
+BoundingBox SweptBounds (const Shape& S, const Motion& m, float tmax) {
+
+	BoundingBox box = S.Bounds ( );
+	float reach = SpeedBound (S, m) * tmax;
+
+	box.xmin -= reach;
+	box.ymin -= reach;
+	box.xmax += reach;
+	box.ymax += reach;
+
+	return box;
+}
+
+/* The pairs of objects whose swept boxes overlap */
+void SweptCandidates (const std::vector<Shape*>& shapes, const std::vector<Motion>& motions,
+		float tmax, std::vector<std::pair<unsigned int, unsigned int> >& pairs) {
+
+	struct Collect {
+		std::vector<std::pair<unsigned int, unsigned int> >& pairs;
+		void operator() (unsigned int a, unsigned int b) {
+			pairs.push_back (std::make_pair (std::min (a, b), std::max (a, b)));
+		}
+	} collect = { pairs };
+
+	std::vector<BoundingBox> boxes (shapes.size ( ));
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++)
+		boxes[i] = SweptBounds (*shapes[i], motions[i], tmax);
+
+	SweepAndPrune (boxes, collect);
+}
+
+/*
+ * Runs the time of impact query for many pairs at once, splitting the
+ * pairs evenly over the given number of threads. results[k] belongs
+ * to pairs[k].
+ */
+void TimeOfImpactBatch (const std::vector<Shape*>& shapes, const std::vector<Motion>& motions,
+		const std::vector<std::pair<unsigned int, unsigned int> >& pairs, float tmax,
+		std::vector<ImpactResult>& results, unsigned int threads = 0) {
+
+	if (threads == 0)
+		threads = std::max (1u, std::thread::hardware_concurrency ( ));
+
+	results.resize (pairs.size ( ));
+
+	struct Worker {
+		static void Run (const std::vector<Shape*> *shapes, const std::vector<Motion> *motions,
+				const std::vector<std::pair<unsigned int, unsigned int> > *pairs, float tmax,
+				std::vector<ImpactResult> *results, unsigned int begin, unsigned int end) {
+
+			for (unsigned int k = begin; k < end; k++) {
+				unsigned int a = (*pairs)[k].first, b = (*pairs)[k].second;
+				(*results)[k] = TimeOfImpact (*(*shapes)[a], (*motions)[a],
+						*(*shapes)[b], (*motions)[b], tmax);
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	unsigned int chunk = (pairs.size ( ) + threads - 1) / threads;
+
+	for (unsigned int begin = 0; begin < pairs.size ( ); begin += chunk)
+		pool.push_back (std::thread (Worker::Run, &shapes, &motions, &pairs, tmax, &results,
+				begin, std::min<unsigned int> (begin + chunk, pairs.size ( ))));
+
+	for (unsigned int i = 0; i < pool.size ( ); i++)
+		pool[i].join ( );
+}
+
+#endif /* SWEPTCOLLISION_H */
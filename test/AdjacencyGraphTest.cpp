@@ -0,0 +1,178 @@
+/*============================================================================
+ Name        : AdjacencyGraphTest.cpp
+ Author      : Nitin Puranik
+ Description : Regression checks for the region adjacency graph, against
+ 	 	 	   tilings whose neighbours are known. Build it on its own
+ 	 	 	   against the headers in src and run it; it prints every
+ 	 	 	   failed check and exits with 1 if there was any.
+ ============================================================================*/
+
+#include <cstdio>
+#include "../src/AdjacencyGraph.h"
+
+static int failures = 0;
+
+static void Check (bool ok, const char *what) {
+	if (ok == false) {
+		printf ("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+/* The length of the link from i to j, or 0 if there is none */
+static float LinkLength (const AdjacencyGraph& graph, unsigned int i, unsigned int j) {
+
+	for (unsigned int k = graph.offsets[i]; k < graph.offsets[i + 1]; k++)
+		if (graph.neighbours[k] == j)
+			return graph.lengths[k];
+
+	return 0;
+}
+
+/* Tells if the graph has exactly the expected links, each with about the expected length */
+static bool SameGraph (const AdjacencyGraph& graph, unsigned int n,
+		const std::vector<std::pair<unsigned int, unsigned int> >& links,
+		const std::vector<float>& lengths) {
+
+	if (graph.offsets.size ( ) != n + 1 || graph.neighbours.size ( ) != 2 * links.size ( ))
+		return false;
+
+	for (unsigned int k = 0; k < links.size ( ); k++) {
+
+		float ab = LinkLength (graph, links[k].first, links[k].second);
+		float ba = LinkLength (graph, links[k].second, links[k].first);
+
+		if (std::fabs (ab - lengths[k]) > 1e-3f || std::fabs (ba - lengths[k]) > 1e-3f)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * A side x side grid of unit squares, turned by angle about the origin
+ * and moved far from it. Every square is built from its own centre, so
+ * the corners it shares with its neighbours are rounded differently.
+ */
+static void TurnedGrid (unsigned int side, float angle, float offset, std::vector<Shape*>& shapes) {
+
+	float c = std::cos (angle), s = std::sin (angle);
+	float corners[8] = { -0.5f, -0.5f, 0.5f, -0.5f, 0.5f, 0.5f, -0.5f, 0.5f };
+
+	for (unsigned int j = 0; j < side; j++) {
+		for (unsigned int i = 0; i < side; i++) {
+
+			float cx = offset + c * (i + 0.5f) - s * (j + 0.5f);
+			float cy = offset + s * (i + 0.5f) + c * (j + 0.5f);
+			float points[8];
+
+			for (int k = 0; k < 4; k++) {
+				points[2 * k] = cx + c * corners[2 * k] - s * corners[2 * k + 1];
+				points[2 * k + 1] = cy + s * corners[2 * k] + c * corners[2 * k + 1];
+			}
+
+			shapes.push_back (new Shape (4, points));
+		}
+	}
+}
+
+static void FreeAll (std::vector<Shape*>& shapes) {
+	for (unsigned int i = 0; i < shapes.size ( ); i++)
+		delete shapes[i];
+	shapes.clear ( );
+}
+
+int main ( ) {
+
+	std::vector<Shape*> shapes;
+	std::vector<std::pair<unsigned int, unsigned int> > links;
+	std::vector<float> lengths;
+	AdjacencyGraph graph;
+
+	/* Squares that meet edge to edge are linked, and those that only meet at a corner are not */
+	const unsigned int side = 20;
+
+	for (unsigned int j = 0; j < side; j++) {
+		for (unsigned int i = 0; i < side; i++) {
+
+			if (i + 1 < side) {
+				links.push_back (std::make_pair (j * side + i, j * side + i + 1));
+				lengths.push_back (1);
+			}
+
+			if (j + 1 < side) {
+				links.push_back (std::make_pair (j * side + i, (j + 1) * side + i));
+				lengths.push_back (1);
+			}
+		}
+	}
+
+	TurnedGrid (side, 0, 0, shapes);
+	BuildAdjacencyGraph (shapes, graph);
+	Check (SameGraph (graph, shapes.size ( ), links, lengths), "axis aligned grid");
+	FreeAll (shapes);
+
+	TurnedGrid (side, 0.3f, 0, shapes);
+	BuildAdjacencyGraph (shapes, graph);
+	Check (SameGraph (graph, shapes.size ( ), links, lengths), "turned grid");
+	FreeAll (shapes);
+
+	TurnedGrid (side, 0.3f, 5000, shapes);
+	BuildAdjacencyGraph (shapes, graph);
+	Check (SameGraph (graph, shapes.size ( ), links, lengths), "turned grid far from the origin");
+	FreeAll (shapes);
+
+	/* Staggered bricks meet along half an edge each, and come out of Analyze as intersecting */
+	links.clear ( );
+	lengths.clear ( );
+
+	for (unsigned int row = 0; row < 10; row++) {
+		for (unsigned int k = 0; k < 10; k++) {
+
+			float x = 2.0f * k + (row % 2 ? 1 : 0), y = (float) row;
+			float points[8] = { x, y, x + 2, y, x + 2, y + 1, x, y + 1 };
+			unsigned int at = row * 10 + k;
+
+			shapes.push_back (new Shape (4, points));
+
+			if (k > 0) {
+				links.push_back (std::make_pair (at - 1, at));
+				lengths.push_back (1);
+			}
+
+			if (row > 0) {
+				links.push_back (std::make_pair (at - 10, at));
+				lengths.push_back (1);
+
+				unsigned int other = row % 2 ? at - 10 + 1 : at - 10 - 1;
+
+				if (row % 2 ? k < 9 : k > 0) {
+					links.push_back (std::make_pair (std::min (other, at), std::max (other, at)));
+					lengths.push_back (1);
+				}
+			}
+		}
+	}
+
+	BuildAdjacencyGraph (shapes, graph);
+	Check (SameGraph (graph, shapes.size ( ), links, lengths), "staggered bricks");
+	FreeAll (shapes);
+
+	/* Overlapping and nested objects are not adjacent */
+	float outer[8] = { 0, 0, 4, 0, 4, 4, 0, 4 };
+	float inner[8] = { 1, 1, 3, 1, 3, 3, 1, 3 };
+	float across[8] = { 2, 1.5f, 6, 1.5f, 6, 2.5f, 2, 2.5f };
+
+	shapes.push_back (new Shape (4, outer));
+	shapes.push_back (new Shape (4, inner));
+	shapes.push_back (new Shape (4, across));
+
+	BuildAdjacencyGraph (shapes, graph);
+	Check (graph.neighbours.empty ( ), "overlaps are not links");
+	FreeAll (shapes);
+
+	if (failures == 0)
+		printf ("All checks passed\n");
+
+	return failures ? 1 : 0;
+}
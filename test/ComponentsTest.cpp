@@ -0,0 +1,125 @@
+/*============================================================================
+ Name        : ComponentsTest.cpp
+ Author      : Nitin Puranik
+ Description : Regression checks for the islands of a set, against every
+ 	 	 	   pair analyzed one by one and merged by a plain union-find.
+ 	 	 	   Build it on its own against the headers in src, with
+ 	 	 	   -pthread, and run it; it prints every failed check and
+ 	 	 	   exits with 1 if there was any.
+ ============================================================================*/
+
+#include <cstdio>
+#include "../src/Components.h"
+
+static int failures = 0;
+
+static void Check (bool ok, const char *what) {
+	if (ok == false) {
+		printf ("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+/* n rectangles of up to size across over a square of side world, on a grid so that many share edges */
+static void MakeShapes (unsigned int n, float world, float size, unsigned int seed, std::vector<Shape*>& shapes) {
+
+	for (unsigned int i = 0; i < n; i++) {
+
+		float v[4];
+
+		for (int k = 0; k < 4; k++) {
+			seed = seed * 1103515245 + 12345;
+			v[k] = (seed >> 8) / 16777216.0f;
+		}
+
+		float x = floorf (v[0] * world), y = floorf (v[1] * world);
+		float w = ceilf (v[2] * size), h = ceilf (v[3] * size);
+		float points[8] = { x, y, x + w, y, x + w, y + h, x, y + h };
+
+		shapes.push_back (new Shape (4, points));
+	}
+}
+
+static unsigned int Root (std::vector<unsigned int>& parent, unsigned int i) {
+	while (parent[i] != i)
+		i = parent[i];
+	return i;
+}
+
+/* The islands by every pair, numbered as ConnectedComponents numbers them */
+static unsigned int AllPairs (const std::vector<Shape*>& shapes, unsigned int links,
+		std::vector<unsigned int>& component) {
+
+	std::vector<unsigned int> parent (shapes.size ( ));
+
+	for (unsigned int i = 0; i < parent.size ( ); i++)
+		parent[i] = i;
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++) {
+		for (unsigned int j = i + 1; j < shapes.size ( ); j++) {
+
+			int which;
+
+			if ((LinkOf (ProcessData (*shapes[i], *shapes[j], &which)) & links) == 0)
+				continue;
+
+			unsigned int a = Root (parent, i), b = Root (parent, j);
+			parent[std::max (a, b)] = std::min (a, b);
+		}
+	}
+
+	unsigned int count = 0;
+	component.resize (shapes.size ( ));
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++) {
+		unsigned int root = Root (parent, i);
+		component[i] = (root == i) ? count++ : component[root];
+	}
+
+	return count;
+}
+
+int main ( ) {
+
+	std::vector<Shape*> shapes;
+	MakeShapes (3000, 400, 6, 1, shapes);
+
+	unsigned int masks[] = { LINK_ALL, LINK_ADJACENT, LINK_CONTAIN, LINK_INTERSECT,
+			LINK_ADJACENT | LINK_INTERSECT };
+	const char *names[] = { "all links", "adjacent only", "contain only", "intersect only",
+			"adjacent and intersect" };
+
+	for (unsigned int m = 0; m < sizeof (masks) / sizeof (masks[0]); m++) {
+
+		std::vector<unsigned int> expected, one, many;
+		unsigned int count = AllPairs (shapes, masks[m], expected);
+
+		Check (count > 1 && count < shapes.size ( ), names[m]);
+		Check (ConnectedComponents (shapes, masks[m], one, 1) == count && one == expected, names[m]);
+		Check (ConnectedComponents (shapes, masks[m], many, 8) == count && many == expected, names[m]);
+	}
+
+	/* A chain of touching rectangles is one island, however it is split over threads */
+	std::vector<Shape*> chain;
+	std::vector<unsigned int> component;
+
+	for (unsigned int i = 0; i < 5000; i++) {
+		float x = (float) i;
+		float points[8] = { x, 0, x + 1, 0, x + 1, 1, x, 1 };
+		chain.push_back (new Shape (4, points));
+	}
+
+	Check (ConnectedComponents (chain, LINK_ADJACENT, component, 8) == 1, "chain is one island");
+	Check (ConnectedComponents (chain, LINK_INTERSECT, component, 8) == chain.size ( ), "chain has no intersections");
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++)
+		delete shapes[i];
+
+	for (unsigned int i = 0; i < chain.size ( ); i++)
+		delete chain[i];
+
+	if (failures == 0)
+		printf ("All checks passed\n");
+
+	return failures ? 1 : 0;
+}
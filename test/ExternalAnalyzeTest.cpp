@@ -0,0 +1,217 @@
+/*============================================================================
+ Name        : ExternalAnalyzeTest.cpp
+ Author      : Nitin Puranik
+ Description : Regression checks for the analysis of record files larger
+ 	 	 	   than memory, against every pair analyzed one by one. Build
+ 	 	 	   it on its own against the headers in src, with -pthread,
+ 	 	 	   and run it; it prints every failed check and exits with 1
+ 	 	 	   if there was any.
+ ============================================================================*/
+
+#include <cstdio>
+#include <unistd.h>
+#include "../src/ExternalAnalyze.h"
+
+static int failures = 0;
+
+static void Check (bool ok, const char *what) {
+	if (ok == false) {
+		printf ("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+/*
+ * Writes n rectangles of up to size across, scattered over a square of
+ * side world, except that every crowd-th one is a small one in a square
+ * of side 30 at the middle. The corners are snapped to a grid, so that
+ * many of the rectangles share edges and corners with each other and
+ * the tiles. The ids are shuffled, so that they do not follow the file.
+ */
+static bool WriteRecords (const char *path, unsigned int n, float world, float size,
+		unsigned int crowd, unsigned int seed) {
+
+	RecordFile file;
+
+	if (file.Open (path, "wb") == false)
+		return false;
+
+	for (unsigned int i = 0; i < n; i++) {
+
+		ShapeRecord rec;
+		float v[4];
+
+		for (int k = 0; k < 4; k++) {
+			seed = seed * 1103515245 + 12345;
+			v[k] = (seed >> 8) / 16777216.0f;
+		}
+
+		float x = v[0] * world, y = v[1] * world;
+		float w = 0.5f + v[2] * size, h = 0.5f + v[3] * size;
+
+		if (crowd > 0 && i % crowd == 0) {
+			x = world / 2 + v[0] * 30;
+			y = world / 2 + v[1] * 30;
+			w = 0.5f + v[2];
+			h = 0.5f + v[3];
+		}
+
+		x = floorf (x * 2) / 2;
+		y = floorf (y * 2) / 2;
+		w = ceilf (w * 2) / 2;
+		h = ceilf (h * 2) / 2;
+
+		float points[8] = { x, y, x + w, y, x + w, y + h, x, y + h };
+
+		rec.id = (unsigned int) ((unsigned long long) i * 7919 % n);
+		std::copy (points, points + 8, rec.points);
+
+		if (file.Write (rec) == false)
+			return false;
+	}
+
+	return true;
+}
+
+/* Every pair of records that is not apart, smaller id first */
+static void AllPairs (const char *path, std::vector<PairResult>& results) {
+
+	std::vector<ShapeRecord> recs;
+	std::vector<Shape*> shapes;
+	std::vector<BoundingBox> boxes;
+
+	LoadRecords (path, recs);
+	BuildShapes (recs, shapes, boxes);
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++) {
+		for (unsigned int j = i + 1; j < shapes.size ( ); j++) {
+
+			PairResult res;
+			unsigned int a = recs[i].id < recs[j].id ? i : j, b = a == i ? j : i;
+
+			res.first = recs[a].id;
+			res.second = recs[b].id;
+			res.type = ProcessData (*shapes[a], *shapes[b], &res.which);
+
+			if (res.type != apart)
+				results.push_back (res);
+		}
+	}
+
+	FreeShapes (shapes);
+}
+
+static bool PairLess (const PairResult& a, const PairResult& b) {
+	return a.first != b.first ? a.first < b.first : a.second < b.second;
+}
+
+/* Collects the pairs of the analysis, and cancels the budget, if any, after the first batch */
+struct Collect {
+	std::vector<PairResult>& mPairs;
+	QueryBudget *mBudget;
+
+	Collect (std::vector<PairResult>& pairs, QueryBudget *budget = NULL)
+		: mPairs (pairs), mBudget (budget) { }
+
+	void operator() (const std::vector<PairResult>& batch) {
+
+		mPairs.insert (mPairs.end ( ), batch.begin ( ), batch.end ( ));
+
+		if (mBudget != NULL)
+			mBudget->Cancel ( );
+	}
+};
+
+/* Analyzes the file and tells if the pairs are those expected, each just once */
+static bool AnalyzeMatches (const char *path, const char *prefix, unsigned long long memoryBudget,
+		std::vector<PairResult> expected) {
+
+	std::vector<PairResult> results;
+	Collect collect (results);
+	float complete = 0;
+
+	if (ExternalAnalyze (path, prefix, memoryBudget, collect, NULL, &complete) == false)
+		return false;
+
+	std::sort (results.begin ( ), results.end ( ), PairLess);
+	std::sort (expected.begin ( ), expected.end ( ), PairLess);
+
+	if (results.size ( ) != expected.size ( ) || complete != 1)
+		return false;
+
+	for (unsigned int k = 0; k < results.size ( ); k++)
+		if (results[k].first != expected[k].first || results[k].second != expected[k].second ||
+				results[k].type != expected[k].type || results[k].which != expected[k].which)
+			return false;
+
+	return true;
+}
+
+int main ( ) {
+
+	char path[64], prefix[64];
+
+	snprintf (path, sizeof (path), "/tmp/analyze-test-%d.rec", (int) getpid ( ));
+	snprintf (prefix, sizeof (prefix), "/tmp/analyze-test-%d", (int) getpid ( ));
+
+	/* The smallest budget that can spill holds chunks of about five hundred records */
+	unsigned long long small = 4 * RECORD_BUFFER;
+	std::vector<PairResult> expected;
+
+	/* Spread out: pairs straddle the tiles of many chunks */
+	Check (WriteRecords (path, 6000, 300, 8, 0, 1), "write spread records");
+	AllPairs (path, expected);
+
+	Check (expected.size ( ) > 1000, "spread records overlap");
+	Check (AnalyzeMatches (path, prefix, 1ULL << 30, expected), "spread records in one chunk");
+	Check (AnalyzeMatches (path, prefix, small, expected), "spread records over chunks");
+
+	/* A crowd in a few tiles: its chunks are cut again */
+	expected.clear ( );
+	Check (WriteRecords (path, 6000, 300, 8, 2, 2), "write crowded records");
+	AllPairs (path, expected);
+
+	Check (AnalyzeMatches (path, prefix, small, expected), "crowded records cut again");
+
+	/* An empty file has no pairs */
+	expected.clear ( );
+	Check (WriteRecords (path, 0, 300, 8, 0, 3), "write no records");
+	Check (AnalyzeMatches (path, prefix, small, expected), "empty file");
+
+	/* Records all over one point cannot be cut down to the budget */
+	std::vector<PairResult> results;
+	Collect collect (results);
+
+	Check (WriteRecords (path, 3000, 0, 0, 0, 4), "write stacked records");
+	Check (ExternalAnalyze (path, prefix, small, collect) == false, "stacked records fail");
+
+	/* A budget that runs out after the first batch leaves a part of the pairs, each once */
+	WriteRecords (path, 6000, 300, 8, 2, 2);
+	expected.clear ( );
+	AllPairs (path, expected);
+	std::sort (expected.begin ( ), expected.end ( ), PairLess);
+
+	QueryBudget budget;
+	Collect stop (results, &budget);
+	float complete = 1;
+
+	results.clear ( );
+	Check (ExternalAnalyze (path, prefix, small, stop, &budget, &complete), "stopped analysis");
+	std::sort (results.begin ( ), results.end ( ), PairLess);
+
+	bool subset = true;
+
+	for (unsigned int k = 0; k < results.size ( ); k++)
+		subset = subset && (k == 0 || PairLess (results[k - 1], results[k])) &&
+				std::binary_search (expected.begin ( ), expected.end ( ), results[k], PairLess);
+
+	Check (results.size ( ) < expected.size ( ) && subset, "stopped analysis reports a part of the pairs once");
+	Check (complete >= 0 && complete < 1, "stopped analysis is not complete");
+
+	unlink (path);
+
+	if (failures == 0)
+		printf ("All checks passed\n");
+
+	return failures ? 1 : 0;
+}
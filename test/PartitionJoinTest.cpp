@@ -0,0 +1,223 @@
+/*============================================================================
+ Name        : PartitionJoinTest.cpp
+ Author      : Nitin Puranik
+ Description : Regression checks for the partition join, against every
+ 	 	 	   pair of records joined one by one. Build it on its own
+ 	 	 	   against the headers in src and run it; it prints every
+ 	 	 	   failed check and exits with 1 if there was any.
+ ============================================================================*/
+
+#include <cstdio>
+#include <unistd.h>
+#include "../src/PartitionJoin.h"
+
+static int failures = 0;
+
+static void Check (bool ok, const char *what) {
+	if (ok == false) {
+		printf ("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+/*
+ * Writes n rectangles of up to size across, scattered over a square of
+ * side world, except that every crowd-th one is a small one in a square
+ * of side 30 at the middle. The corners are snapped to a grid, so that many of
+ * the rectangles share edges and corners with each other and the tiles.
+ */
+static bool WriteRecords (const char *path, unsigned int n, float world, float size,
+		unsigned int crowd, unsigned int seed) {
+
+	RecordFile file;
+
+	if (file.Open (path, "wb") == false)
+		return false;
+
+	for (unsigned int i = 0; i < n; i++) {
+
+		ShapeRecord rec;
+		float v[4];
+
+		for (int k = 0; k < 4; k++) {
+			seed = seed * 1103515245 + 12345;
+			v[k] = (seed >> 8) / 16777216.0f;
+		}
+
+		float x = v[0] * world, y = v[1] * world;
+		float w = 0.5f + v[2] * size, h = 0.5f + v[3] * size;
+
+		if (crowd > 0 && i % crowd == 0) {
+			x = world / 2 + v[0] * 30;
+			y = world / 2 + v[1] * 30;
+			w = 0.5f + v[2];
+			h = 0.5f + v[3];
+		}
+
+		x = floorf (x * 2) / 2;
+		y = floorf (y * 2) / 2;
+		w = ceilf (w * 2) / 2;
+		h = ceilf (h * 2) / 2;
+
+		float points[8] = { x, y, x + w, y, x + w, y + h, x, y + h };
+
+		rec.id = i;
+		std::copy (points, points + 8, rec.points);
+
+		if (file.Write (rec) == false)
+			return false;
+	}
+
+	return true;
+}
+
+/* Every pair of a record of A and a record of B that is not apart */
+static void AllPairs (const char *pathA, const char *pathB, std::vector<PairResult>& results) {
+
+	std::vector<ShapeRecord> recA, recB;
+	std::vector<Shape*> shapeA, shapeB;
+	std::vector<BoundingBox> boxA, boxB;
+
+	LoadRecords (pathA, recA);
+	LoadRecords (pathB, recB);
+	BuildShapes (recA, shapeA, boxA);
+	BuildShapes (recB, shapeB, boxB);
+
+	for (unsigned int i = 0; i < shapeA.size ( ); i++) {
+		for (unsigned int j = 0; j < shapeB.size ( ); j++) {
+
+			PairResult res;
+
+			res.first = recA[i].id;
+			res.second = recB[j].id;
+			res.type = ProcessData (*shapeA[i], *shapeB[j], &res.which);
+
+			if (res.type != apart)
+				results.push_back (res);
+		}
+	}
+
+	FreeShapes (shapeA);
+	FreeShapes (shapeB);
+}
+
+static bool PairLess (const PairResult& a, const PairResult& b) {
+	return a.first != b.first ? a.first < b.first : a.second < b.second;
+}
+
+/* Collects the pairs of the join, and cancels the budget, if any, after the first batch */
+struct Collect {
+	std::vector<PairResult>& mPairs;
+	QueryBudget *mBudget;
+
+	Collect (std::vector<PairResult>& pairs, QueryBudget *budget = NULL)
+		: mPairs (pairs), mBudget (budget) { }
+
+	void operator() (const std::vector<PairResult>& batch) {
+
+		mPairs.insert (mPairs.end ( ), batch.begin ( ), batch.end ( ));
+
+		if (mBudget != NULL)
+			mBudget->Cancel ( );
+	}
+};
+
+/* Joins the files and tells if the pairs are those expected, each just once */
+static bool JoinMatches (const char *pathA, const char *pathB, const char *prefix,
+		unsigned long long memoryBudget, std::vector<PairResult> expected) {
+
+	std::vector<PairResult> results;
+	Collect collect (results);
+	float complete = 0;
+
+	if (PartitionJoin (pathA, pathB, prefix, memoryBudget, collect, NULL, &complete) == false)
+		return false;
+
+	std::sort (results.begin ( ), results.end ( ), PairLess);
+	std::sort (expected.begin ( ), expected.end ( ), PairLess);
+
+	if (results.size ( ) != expected.size ( ) || complete != 1)
+		return false;
+
+	for (unsigned int k = 0; k < results.size ( ); k++)
+		if (results[k].first != expected[k].first || results[k].second != expected[k].second ||
+				results[k].type != expected[k].type || results[k].which != expected[k].which)
+			return false;
+
+	return true;
+}
+
+int main ( ) {
+
+	char pathA[64], pathB[64], prefix[64];
+
+	snprintf (pathA, sizeof (pathA), "/tmp/join-test-%d.a", (int) getpid ( ));
+	snprintf (pathB, sizeof (pathB), "/tmp/join-test-%d.b", (int) getpid ( ));
+	snprintf (prefix, sizeof (prefix), "/tmp/join-test-%d", (int) getpid ( ));
+
+	/* The smallest budget that can spill holds about a thousand records */
+	unsigned long long small = 4 * RECORD_BUFFER;
+	std::vector<PairResult> expected;
+
+	/* Spread out: pairs straddle the tiles of many partitions */
+	Check (WriteRecords (pathA, 4000, 300, 8, 0, 1) && WriteRecords (pathB, 4000, 300, 8, 0, 2),
+			"write spread records");
+	AllPairs (pathA, pathB, expected);
+
+	Check (expected.size ( ) > 1000, "spread records overlap");
+	Check (JoinMatches (pathA, pathB, prefix, 1ULL << 30, expected), "spread records in memory");
+	Check (JoinMatches (pathA, pathB, prefix, small, expected), "spread records over partitions");
+
+	/* A crowd in a few tiles: its partitions are partitioned again */
+	expected.clear ( );
+	Check (WriteRecords (pathA, 4000, 300, 8, 2, 3) && WriteRecords (pathB, 4000, 300, 8, 3, 4),
+			"write crowded records");
+	AllPairs (pathA, pathB, expected);
+
+	Check (JoinMatches (pathA, pathB, prefix, small, expected), "crowded records partitioned again");
+
+	/* An empty input joins to nothing */
+	expected.clear ( );
+	Check (WriteRecords (pathB, 0, 300, 8, 0, 5), "write no records");
+	Check (JoinMatches (pathA, pathB, prefix, small, expected), "empty input");
+
+	/* Records all over one point cannot be cut down to the budget */
+	std::vector<PairResult> results;
+	Collect collect (results);
+
+	Check (WriteRecords (pathA, 3000, 0, 0, 0, 6) && WriteRecords (pathB, 3000, 0, 0, 0, 7),
+			"write stacked records");
+	Check (PartitionJoin (pathA, pathB, prefix, small, collect) == false, "stacked records fail");
+
+	/* A budget that runs out after the first batch leaves a part of the pairs, each once */
+	WriteRecords (pathA, 4000, 300, 8, 2, 3);
+	WriteRecords (pathB, 4000, 300, 8, 3, 4);
+	expected.clear ( );
+	AllPairs (pathA, pathB, expected);
+	std::sort (expected.begin ( ), expected.end ( ), PairLess);
+
+	QueryBudget budget;
+	Collect stop (results, &budget);
+	float complete = 1;
+
+	results.clear ( );
+	Check (PartitionJoin (pathA, pathB, prefix, small, stop, &budget, &complete), "stopped join");
+	std::sort (results.begin ( ), results.end ( ), PairLess);
+
+	bool subset = true;
+
+	for (unsigned int k = 0; k < results.size ( ); k++)
+		subset = subset && (k == 0 || PairLess (results[k - 1], results[k])) &&
+				std::binary_search (expected.begin ( ), expected.end ( ), results[k], PairLess);
+
+	Check (results.size ( ) < expected.size ( ) && subset, "stopped join reports a part of the pairs once");
+	Check (complete >= 0 && complete < 1, "stopped join is not complete");
+
+	unlink (pathA);
+	unlink (pathB);
+
+	if (failures == 0)
+		printf ("All checks passed\n");
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,300 @@
+/*============================================================================
+ Name        : QueryServerTest.cpp
+ Author      : Nitin Puranik
+ Description : Regression checks for the query server, against every
+ 	 	 	   object looked at one by one. The requests go out split at
+ 	 	 	   odd places, so frames arrive in pieces and several at once.
+ 	 	 	   Build it on its own against the headers in src, with
+ 	 	 	   -pthread, and run it on Linux; it prints every failed check
+ 	 	 	   and exits with 1 if there was any.
+ ============================================================================*/
+
+#include <cstdio>
+#include <map>
+#include <sys/wait.h>
+#include "../src/QueryServer.h"
+
+static int failures = 0;
+
+static void Check (bool ok, const char *what) {
+	if (ok == false) {
+		printf ("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+static Shape *MakeShape (const float *points) {
+	return new Shape (4, points);
+}
+
+/* n rectangles of up to size across over a square of side world, on a grid so that many share edges */
+static void MakeShapes (unsigned int n, float world, float size, unsigned int seed, std::vector<Shape*>& shapes) {
+
+	for (unsigned int i = 0; i < n; i++) {
+
+		float v[4];
+
+		for (int k = 0; k < 4; k++) {
+			seed = seed * 1103515245 + 12345;
+			v[k] = (seed >> 8) / 16777216.0f;
+		}
+
+		float x = floorf (v[0] * world), y = floorf (v[1] * world);
+		float w = ceilf (v[2] * size), h = ceilf (v[3] * size);
+		float points[8] = { x, y, x + w, y, x + w, y + h, x, y + h };
+
+		shapes.push_back (new Shape (4, points));
+	}
+}
+
+/* Appends a request to a stream of them */
+static void Request (std::vector<char>& out, unsigned short op, unsigned int tag, const float *numbers,
+		unsigned int count) {
+
+	RequestHeader request = { (unsigned int) (count * sizeof (float)), tag, op, 0 };
+	const char *p = (const char *) &request;
+
+	out.insert (out.end ( ), p, p + sizeof (request));
+	p = (const char *) numbers;
+	out.insert (out.end ( ), p, p + count * sizeof (float));
+}
+
+static bool ReadAll (int fd, void *buffer, size_t size) {
+
+	char *p = (char *) buffer;
+
+	while (size > 0) {
+		ssize_t got = recv (fd, p, size, 0);
+
+		if (got <= 0)
+			return false;
+
+		p += got;
+		size -= got;
+	}
+
+	return true;
+}
+
+static int Connect (const char *address) {
+
+	for (unsigned int attempt = 0; attempt < 500; attempt++) {
+
+		int fd = ConnectSocket (address);
+
+		if (fd >= 0)
+			return fd;
+
+		usleep (10000);
+	}
+
+	return -1;
+}
+
+/* An answer: its header, and the payloads of all its frames */
+struct Answer {
+	ResponseHeader header;
+	std::vector<char> payload;
+	unsigned int frames;
+};
+
+int main ( ) {
+
+	char address[64];
+	snprintf (address, sizeof (address), "/tmp/server-test-%d.sock", (int) getpid ( ));
+
+	std::vector<Shape*> shapes;
+	MakeShapes (3000, 300, 8, 1, shapes);
+
+	pid_t server = fork ( );
+
+	if (server == 0) {
+		bool ok;
+
+		/* The server removes its socket file once it goes out of scope */
+		{
+			QueryServer serve (shapes, MakeShape);
+
+			ok = serve.Listen (address);
+
+			if (ok)
+				serve.Run ( );
+		}
+
+		_exit (ok ? 0 : 1);
+	}
+
+	int fd = Connect (address);
+	Check (fd >= 0, "connect");
+
+	if (fd < 0) {
+		kill (server, SIGKILL);
+		return 1;
+	}
+
+	float query[8] = { 100, 100, 140, 100, 140, 130, 100, 130 };
+	float point[2] = { shapes[17]->Bounds ( ).xmin + 0.5f, shapes[17]->Bounds ( ).ymin + 0.5f };
+	float window[4] = { 0, 0, 300, 300 };
+	float wrong[3] = { 1, 2, 3 };
+
+	/* The join first, so that the queries behind it are answered while it runs */
+	std::vector<char> stream;
+
+	Request (stream, queryJoin, 10, window, 4);
+	Request (stream, queryPing, 1, NULL, 0);
+	Request (stream, queryOverlap, 2, query, 8);
+	Request (stream, queryPoint, 3, point, 2);
+	Request (stream, 9, 4, NULL, 0);
+	Request (stream, queryOverlap, 5, wrong, 3);
+	Request (stream, queryIntersect, 6, query, 8);
+
+	/* Pieces of 1 to 13 bytes, with pauses, so the frames come in cut up */
+	for (size_t at = 0, piece = 1; at < stream.size ( ); at += piece, piece = piece % 13 + 1) {
+
+		piece = std::min (piece, stream.size ( ) - at);
+		Check (send (fd, &stream[at], piece, MSG_NOSIGNAL) == (ssize_t) piece, "send a piece");
+
+		if (at % 5 == 0)
+			usleep (200);
+	}
+
+	std::map<unsigned int, Answer> answers;
+	std::vector<unsigned int> order;
+	bool joined = false;
+
+	while (joined == false || answers.size ( ) < 7) {
+
+		ResponseHeader response;
+
+		if (ReadAll (fd, &response, sizeof (response)) == false)
+			break;
+
+		Answer& answer = answers[response.tag];
+		size_t size = answer.payload.size ( );
+
+		if (answer.frames++ == 0 && response.tag != 10)
+			order.push_back (response.tag);
+
+		answer.header = response;
+		answer.payload.resize (size + response.length);
+
+		if (response.length > 0 && ReadAll (fd, &answer.payload[size], response.length) == false)
+			break;
+
+		if (response.tag == 10 && response.status != statusMore)
+			joined = true;
+	}
+
+	Check (answers.size ( ) == 7 && joined, "every request answered");
+
+	unsigned int expectedOrder[] = { 1, 2, 3, 4, 5, 6 };
+	Check (order == std::vector<unsigned int> (expectedOrder, expectedOrder + 6), "queries answered in order");
+
+	Check (answers[1].header.status == statusOk && answers[1].payload.empty ( ), "ping");
+	Check (answers[4].header.status == statusUnknownOp && answers[4].payload.empty ( ), "unknown op");
+	Check (answers[5].header.status == statusBadRequest && answers[5].payload.empty ( ), "wrong length");
+
+	/* Every answer against every object looked at one by one */
+	Shape Q (4, query);
+	std::vector<unsigned int> overlap, holds, crosses;
+
+	for (unsigned int k = 0; k < shapes.size ( ); k++) {
+
+		int which;
+		CollisionType type = Classify (Q, *shapes[k], &which);
+
+		if (type != apart)
+			overlap.push_back (k);
+
+		if (type == none)
+			crosses.push_back (k);
+
+		if (shapes[k]->ContainsPoint (point[0], point[1]))
+			holds.push_back (k);
+	}
+
+	std::vector<unsigned int> got;
+	const Answer& a2 = answers[2];
+
+	for (size_t at = 0; at + sizeof (OverlapRecord) <= a2.payload.size ( ); at += sizeof (OverlapRecord)) {
+		OverlapRecord rec;
+		memcpy (&rec, &a2.payload[at], sizeof (rec));
+		got.push_back (rec.object);
+	}
+
+	std::sort (got.begin ( ), got.end ( ));
+	Check (a2.header.status == statusOk && overlap.size ( ) > 10 && got == overlap, "overlap");
+
+	const Answer& a3 = answers[3];
+	got.assign (a3.payload.size ( ) / sizeof (unsigned int), 0);
+
+	if (got.empty ( ) == false)
+		memcpy (&got[0], &a3.payload[0], got.size ( ) * sizeof (unsigned int));
+
+	std::sort (got.begin ( ), got.end ( ));
+	Check (a3.header.status == statusOk && holds.empty ( ) == false && got == holds, "point");
+
+	const Answer& a6 = answers[6];
+	got.clear ( );
+
+	for (size_t at = 0; at + 2 * sizeof (unsigned int) <= a6.payload.size ( ); ) {
+
+		unsigned int object, count;
+		memcpy (&object, &a6.payload[at], sizeof (object));
+		memcpy (&count, &a6.payload[at + sizeof (object)], sizeof (count));
+
+		got.push_back (object);
+		at += 2 * sizeof (unsigned int) + 2 * count * sizeof (float);
+	}
+
+	std::sort (got.begin ( ), got.end ( ));
+	Check (a6.header.status == statusOk && crosses.empty ( ) == false && got == crosses, "intersect");
+
+	/* The join sees every pair of the set, in many frames, each pair once */
+	std::vector<std::pair<unsigned int, unsigned int> > pairs, joinedPairs;
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++) {
+		for (unsigned int j = i + 1; j < shapes.size ( ); j++) {
+			int which;
+			if (Classify (*shapes[i], *shapes[j], &which) != apart)
+				pairs.push_back (std::make_pair (i, j));
+		}
+	}
+
+	const Answer& a10 = answers[10];
+
+	for (size_t at = 0; at + sizeof (JoinRecord) <= a10.payload.size ( ); at += sizeof (JoinRecord)) {
+		JoinRecord rec;
+		memcpy (&rec, &a10.payload[at], sizeof (rec));
+		joinedPairs.push_back (std::make_pair (rec.first, rec.second));
+	}
+
+	std::sort (joinedPairs.begin ( ), joinedPairs.end ( ));
+	Check (a10.frames > 1 && joinedPairs == pairs, "join");
+
+	close (fd);
+
+	/* A frame larger than the server takes cuts the client off */
+	fd = Connect (address);
+
+	RequestHeader huge = { SERVER_MAX_FRAME + 1, 7, queryOverlap, 0 };
+	char byte;
+
+	Check (fd >= 0 && send (fd, &huge, sizeof (huge), MSG_NOSIGNAL) == (ssize_t) sizeof (huge) &&
+			recv (fd, &byte, 1, 0) == 0, "oversized frame cut off");
+
+	close (fd);
+
+	int status = 1;
+	kill (server, SIGTERM);
+	waitpid (server, &status, 0);
+	Check (WIFEXITED (status) && WEXITSTATUS (status) == 0, "server stops on SIGTERM");
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++)
+		delete shapes[i];
+
+	if (failures == 0)
+		printf ("All checks passed\n");
+
+	return failures ? 1 : 0;
+}
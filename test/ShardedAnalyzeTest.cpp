@@ -0,0 +1,243 @@
+/*============================================================================
+ Name        : ShardedAnalyzeTest.cpp
+ Author      : Nitin Puranik
+ Description : Regression checks for the sharded analysis, against every
+ 	 	 	   pair analyzed one by one. Build it on its own against the
+ 	 	 	   headers in src, with -pthread, and run it on Linux; it
+ 	 	 	   prints every failed check and exits with 1 if there was any.
+ ============================================================================*/
+
+#include <cstdio>
+#include "../src/ShardedAnalyze.h"
+
+static int failures = 0;
+
+static void Check (bool ok, const char *what) {
+	if (ok == false) {
+		printf ("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+/* Writes n rectangles of up to size across, scattered over a square of side world */
+static bool WriteRecords (const char *path, unsigned int n, float world, float size, unsigned int seed) {
+
+	RecordFile file;
+
+	if (file.Open (path, "wb") == false)
+		return false;
+
+	for (unsigned int i = 0; i < n; i++) {
+
+		ShapeRecord rec;
+		float v[4];
+
+		for (int k = 0; k < 4; k++) {
+			seed = seed * 1103515245 + 12345;
+			v[k] = (seed >> 8) / 16777216.0f;
+		}
+
+		float x = v[0] * world, y = v[1] * world;
+		float w = 0.5f + v[2] * size, h = 0.5f + v[3] * size;
+
+		/* Snap to a grid, so that many of the rectangles share edges */
+		x = floorf (x * 2) / 2;
+		y = floorf (y * 2) / 2;
+		w = ceilf (w * 2) / 2;
+		h = ceilf (h * 2) / 2;
+
+		float points[8] = { x, y, x + w, y, x + w, y + h, x, y + h };
+
+		rec.id = i;
+		std::copy (points, points + 8, rec.points);
+
+		if (file.Write (rec) == false)
+			return false;
+	}
+
+	return true;
+}
+
+/* Every pair of records that is not apart, analyzed one by one */
+static void AllPairs (const char *path, std::vector<PairResult>& results) {
+
+	std::vector<ShapeRecord> recs;
+	std::vector<Shape*> shapes;
+	std::vector<BoundingBox> boxes;
+
+	LoadRecords (path, recs);
+	BuildShapes (recs, shapes, boxes);
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++) {
+		for (unsigned int j = i + 1; j < shapes.size ( ); j++) {
+
+			PairResult res;
+
+			res.first = recs[i].id;
+			res.second = recs[j].id;
+			res.type = ProcessData (*shapes[i], *shapes[j], &res.which);
+
+			if (res.type != apart)
+				results.push_back (res);
+		}
+	}
+
+	FreeShapes (shapes);
+}
+
+static bool SamePairs (const std::vector<PairResult>& a, const std::vector<PairResult>& b) {
+
+	if (a.size ( ) != b.size ( ))
+		return false;
+
+	for (unsigned int k = 0; k < a.size ( ); k++)
+		if (a[k].first != b[k].first || a[k].second != b[k].second ||
+				a[k].type != b[k].type || a[k].which != b[k].which)
+			return false;
+
+	return true;
+}
+
+/* Forks a process that takes connections at the address and never answers them */
+static pid_t StalledWorker (const char *address) {
+
+	int listener = ListenSocket (address);
+
+	if (listener < 0)
+		return -1;
+
+	pid_t pid = fork ( );
+
+	if (pid == 0) {
+		std::vector<int> held;
+
+		while (true) {
+			int fd = accept (listener, NULL, NULL);
+			if (fd >= 0)
+				held.push_back (fd);
+		}
+	}
+
+	close (listener);
+	return pid;
+}
+
+/*
+ * Forks a process that stops the first other child of this process to
+ * show up, as if that worker had hung. It gives up after a few seconds.
+ */
+static pid_t StopAWorker ( ) {
+
+	pid_t parent = getpid ( );
+	pid_t pid = fork ( );
+
+	if (pid != 0)
+		return pid;
+
+	for (unsigned int attempt = 0; attempt < 500; attempt++) {
+
+		for (pid_t p = parent + 1; p < parent + 4096; p++) {
+
+			char name[64];
+			int ppid = 0;
+			char state;
+
+			snprintf (name, sizeof (name), "/proc/%d/stat", (int) p);
+			FILE *stat = fopen (name, "r");
+
+			if (stat == NULL)
+				continue;
+
+			bool child = fscanf (stat, "%*d %*s %c %d", &state, &ppid) == 2 && ppid == parent && p != getpid ( );
+			fclose (stat);
+
+			if (child) {
+				kill (p, SIGSTOP);
+				_exit (0);
+			}
+		}
+
+		usleep (10000);
+	}
+
+	_exit (1);
+}
+
+int main ( ) {
+
+	char path[64], address[64], missing[64];
+
+	snprintf (path, sizeof (path), "/tmp/shard-test-%d.rec", (int) getpid ( ));
+	snprintf (address, sizeof (address), "/tmp/shard-test-%d.sock", (int) getpid ( ));
+	snprintf (missing, sizeof (missing), "/tmp/shard-test-%d.none", (int) getpid ( ));
+
+	std::vector<PairResult> expected, results;
+	std::vector<std::string> none;
+
+	/* Dense enough that many pairs straddle the edges between shards */
+	Check (WriteRecords (path, 3000, 100, 6, 1), "write records");
+	AllPairs (path, expected);
+
+	Check (ShardedAnalyze (path, none, 1, results) && SamePairs (results, expected), "one worker");
+
+	results.clear ( );
+	Check (ShardedAnalyze (path, none, 7, results) && SamePairs (results, expected), "pairs across shards reported once");
+
+	/* A worker that never answers and one that is not there: both shards are run again */
+	pid_t stalled = StalledWorker (address);
+	std::vector<std::string> addresses;
+
+	addresses.push_back (address);
+	addresses.push_back (missing);
+	addresses.push_back (address);
+
+	results.clear ( );
+	Check (stalled > 0 && ShardedAnalyze (path, addresses, 0, results, 1000) && SamePairs (results, expected),
+			"shards of failed workers run again");
+
+	if (stalled > 0) {
+		kill (stalled, SIGKILL);
+		waitpid (stalled, NULL, 0);
+	}
+
+	unlink (address);
+
+	/* A forked worker that hangs halfway is killed rather than waited on forever */
+	std::vector<ShapeRecord> recs;
+	std::vector<Shape*> shapes;
+	std::vector<BoundingBox> boxes;
+
+	Check (WriteRecords (path, 400000, 2000, 3, 2), "write many records");
+	LoadRecords (path, recs);
+	BuildShapes (recs, shapes, boxes);
+
+	expected.clear ( );
+	AnalyzeSet (shapes, expected);
+	FreeShapes (shapes);
+
+	for (unsigned int k = 0; k < expected.size ( ); k++) {
+		if (expected[k].first > expected[k].second) {
+			std::swap (expected[k].first, expected[k].second);
+			expected[k].which = 1 - expected[k].which;
+		}
+	}
+
+	std::sort (expected.begin ( ), expected.end ( ), [] (const PairResult& a, const PairResult& b) {
+		return a.first != b.first ? a.first < b.first : a.second < b.second;
+	});
+
+	pid_t stopper = StopAWorker ( );
+	int status = 1;
+
+	results.clear ( );
+	Check (ShardedAnalyze (path, none, 2, results, 1000) && SamePairs (results, expected), "hung worker killed");
+	waitpid (stopper, &status, 0);
+	Check (WIFEXITED (status) && WEXITSTATUS (status) == 0, "a worker was stopped");
+
+	unlink (path);
+
+	if (failures == 0)
+		printf ("All checks passed\n");
+
+	return failures ? 1 : 0;
+}
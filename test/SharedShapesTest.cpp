@@ -0,0 +1,193 @@
+/*============================================================================
+ Name        : SharedShapesTest.cpp
+ Author      : Nitin Puranik
+ Description : Regression checks for sets published in shared memory and
+ 	 	 	   the swap of their generations. Build it on its own against
+ 	 	 	   the headers in src, with -pthread, and run it on Linux; it
+ 	 	 	   prints every failed check and exits with 1 if there was any.
+ ============================================================================*/
+
+#include <cstdio>
+#include <sys/wait.h>
+#include "../src/SharedShapes.h"
+#include "../src/BroadPhase.h"
+
+static int failures = 0;
+
+static void Check (bool ok, const char *what) {
+	if (ok == false) {
+		printf ("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+/*
+ * n rectangles over a square of side 300, moved right by 1000 for
+ * every generation, so that a set tells which generation it is from.
+ */
+static void MakeShapes (unsigned int n, unsigned int generation, std::vector<Shape*>& shapes) {
+
+	unsigned int seed = generation;
+
+	for (unsigned int i = 0; i < n; i++) {
+
+		float v[4];
+
+		for (int k = 0; k < 4; k++) {
+			seed = seed * 1103515245 + 12345;
+			v[k] = (seed >> 8) / 16777216.0f;
+		}
+
+		float x = floorf (v[0] * 300) + 1000.0f * generation, y = floorf (v[1] * 300);
+		float w = ceilf (v[2] * 8), h = ceilf (v[3] * 8);
+		float points[8] = { x, y, x + w, y, x + w, y + h, x, y + h };
+
+		shapes.push_back (new Shape (4, points));
+	}
+}
+
+static void FreeAll (std::vector<Shape*>& shapes) {
+	for (unsigned int i = 0; i < shapes.size ( ); i++)
+		delete shapes[i];
+	shapes.clear ( );
+}
+
+/* Tells if two sets hold the same objects, prepared data included */
+static bool SameShapes (const std::vector<Shape*>& a, const std::vector<Shape*>& b) {
+
+	if (a.size ( ) != b.size ( ))
+		return false;
+
+	for (unsigned int i = 0; i < a.size ( ); i++) {
+
+		unsigned int n = a[i]->NumSides ( );
+
+		if (b[i]->NumSides ( ) != n ||
+				std::equal (a[i]->Points ( ), a[i]->Points ( ) + 2 * n, b[i]->Points ( )) == false ||
+				std::equal (a[i]->Normals ( ), a[i]->Normals ( ) + 2 * n, b[i]->Normals ( )) == false ||
+				std::equal (a[i]->EdgeLengths ( ), a[i]->EdgeLengths ( ) + n, b[i]->EdgeLengths ( )) == false ||
+				memcmp (&a[i]->Bounds ( ), &b[i]->Bounds ( ), sizeof (BoundingBox)) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/* Tells if every object of the set lies where the generation puts it */
+static bool FromGeneration (const std::vector<Shape*>& shapes, unsigned long long generation) {
+
+	for (unsigned int i = 0; i < shapes.size ( ); i++)
+		if (shapes[i]->Bounds ( ).xmin < 1000.0f * generation ||
+				shapes[i]->Bounds ( ).xmax > 1000.0f * generation + 400)
+			return false;
+
+	return true;
+}
+
+/*
+ * Forks a reader that attaches over and over while generations are
+ * swapped under it, until it has seen the given one. It exits with 0
+ * only if every attach worked and every set it saw was whole.
+ */
+static pid_t SwappingReader (const char *name, unsigned long long last) {
+
+	pid_t pid = fork ( );
+
+	if (pid != 0)
+		return pid;
+
+	SharedShapeSet set;
+	unsigned long long seen = 0;
+
+	while (seen < last) {
+
+		if (set.Attach (name) == false || set.Generation ( ) < seen || set.Shapes ( ).size ( ) != 2000 ||
+				FromGeneration (set.Shapes ( ), set.Generation ( )) == false)
+			_exit (1);
+
+		seen = set.Generation ( );
+	}
+
+	_exit (0);
+}
+
+int main ( ) {
+
+	char name[64];
+	snprintf (name, sizeof (name), "/shapes-test-%d", (int) getpid ( ));
+
+	SharedShapeSet reader;
+	Check (reader.Attach (name) == false, "nothing to attach to");
+
+	std::vector<Shape*> first, second;
+	unsigned long long generation = 0;
+
+	MakeShapes (2000, 1, first);
+	MakeShapes (2000, 2, second);
+
+	/* A reader sees the objects as published, and analyzes them in place */
+	Check (PublishShapes (name, first, &generation) && generation == 1, "publish");
+	Check (reader.Attach (name) && reader.Generation ( ) == 1 && reader.Stale ( ) == false, "attach");
+	Check (SameShapes (reader.Shapes ( ), first), "shared objects");
+
+	std::vector<PairResult> expected, results;
+	std::vector<Shape*> shared (reader.Shapes ( ));
+
+	AnalyzeSet (first, expected);
+	AnalyzeSet (shared, results);
+
+	bool same = expected.size ( ) == results.size ( ) && expected.empty ( ) == false;
+
+	for (unsigned int k = 0; same && k < results.size ( ); k++)
+		same = results[k].first == expected[k].first && results[k].second == expected[k].second &&
+				results[k].type == expected[k].type && results[k].which == expected[k].which;
+
+	Check (same, "analysis in place");
+
+	/* A swap leaves the attached reader on its generation until it attaches again */
+	Check (PublishShapes (name, second, &generation) && generation == 2, "publish again");
+	Check (reader.Generation ( ) == 1 && reader.Stale ( ) && SameShapes (reader.Shapes ( ), first),
+			"old generation kept");
+	Check (reader.Attach (name) && reader.Generation ( ) == 2 && reader.Stale ( ) == false &&
+			SameShapes (reader.Shapes ( ), second), "new generation");
+
+	/* Objects of different sides cannot go in one set */
+	float triangle[6] = { 0, 0, 1, 0, 0, 1 };
+	std::vector<Shape*> mixed (first);
+	Shape T (3, triangle);
+
+	mixed.push_back (&T);
+	Check (PublishShapes (name, mixed) == false && reader.Stale ( ) == false, "mixed sides");
+
+	/* A reader attaching all along never sees a half written or missing generation */
+	const unsigned long long last = 40;
+	pid_t child = SwappingReader (name, last);
+	int status = 1;
+
+	for (unsigned long long g = 3; g <= last; g++) {
+
+		std::vector<Shape*> shapes;
+		MakeShapes (2000, g, shapes);
+		Check (PublishShapes (name, shapes, &generation) && generation == g, "publish while read");
+		FreeAll (shapes);
+	}
+
+	waitpid (child, &status, 0);
+	Check (WIFEXITED (status) && WEXITSTATUS (status) == 0, "reader during swaps");
+
+	/* Once the name is gone, nothing more attaches, but an attached reader keeps its set */
+	UnpublishShapes (name);
+
+	SharedShapeSet late;
+	Check (late.Attach (name) == false, "unpublished");
+	Check (SameShapes (reader.Shapes ( ), second), "reader keeps its set after unpublish");
+
+	reader.Detach ( );
+	FreeAll (first);
+	FreeAll (second);
+
+	if (failures == 0)
+		printf ("All checks passed\n");
+
+	return failures ? 1 : 0;
+}